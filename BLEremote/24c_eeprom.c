@@ -6,76 +6,303 @@
 //  Copyright (c) 2012 Greener Pastures. All rights reserved.
 //
 
+#include <string.h>
 #include "24c_eeprom.h"
-#include "i2cmaster.h"
+#include "twi.h"
+#include "clock.h"
+
+// A page buffer for the buffered writer
+typedef struct {
+	unsigned char data[ EEPROM_PAGE_SIZE ];
+	uint32_t page;				// Address of the page
+	uint8_t start;				// Range of buffered bytes within the page
+	uint8_t end;
+} WriteBuffer;
+
+static WriteBuffer writeBuffers[2];
+static WriteBuffer *openBuffer;		// Buffer being filled or 0
+static uint8_t nextBuffer;
+
+// One page write at a time: the EEPROM doesn't take the next write before the write cycle of the last one has ended anyway
+static TWITransaction pageWrite;	// The page write of the committed buffer
+static TWITransaction pagePoll;		// ACK polling after the page write
+static WriteBuffer *writeBuffer;	// Buffer being written or 0
+static uint16_t committed;			// micros() when the page write was queued ...
+static uint16_t written;			// ... and when it had been transferred
+
+// A background read crossing a chip boundary: the second part is queued by splitReadDone()
+static struct {
+	TWITransaction *transaction;	// The transaction or 0 if no split read is in progress
+	unsigned char *data;			// Start of the data
+	uint16_t length;				// Total number of bytes
+	uint16_t left;					// Bytes left for the second part or 0 if it has been queued
+	TWICallback callback;			// The caller's callback
+} splitRead;
+
+uint16_t writeCycleTime;
+uint16_t durableTime;
+uint16_t eepromErrors;
+
+/* Returns the number of bytes from an address to the end of its chip */
+static inline uint32_t chipLeft( uint32_t address )
+{
+	return EEPROM_CHIP_SIZE - (address & (EEPROM_CHIP_SIZE-1));
+}
+
+/* Fills in a transaction for the EEPROM. Bits 18:16 of the address select the chip. */
+static void setupTransaction( TWITransaction *transaction, uint8_t read, uint32_t address, unsigned char *data, unsigned int len )
+{
+	transaction->device = EEPROM_ADDRESS | ((address >> 15) & 0x0E);
+	transaction->addressLength = 2;
+	transaction->address = address;
+	transaction->read = read;
+	transaction->data = data;
+	transaction->length = len;
+	transaction->callback = 0;
+}
+
+/* Called from the TWI interrupt handler when a page write has been transferred: the write cycle starts now */
+static void pageWritten( TWITransaction *transaction )
+{
+	written = micros();
+}
+
+/* Called from the TWI interrupt handler when the EEPROM acknowledges again after a page write */
+static void writeDurable( TWITransaction *transaction )
+{
+	uint16_t now = micros();
+	
+	// A missing chip fails both the write and the poll: there is no write cycle to time
+	if( pageWrite.status != TWIStatus_Done || transaction->status != TWIStatus_Done )
+	{
+		eepromErrors++;
+		return;
+	}
+	
+	writeCycleTime = now - written;
+	durableTime = now - committed;
+}
+
+/* Checks whether the page write and its ACK polling are done */
+static inline uint8_t writeDone()
+{
+	return pageWrite.status < TWIStatus_Queued && pagePoll.status < TWIStatus_Queued;
+}
+
+/* Checks whether a page buffer is done writing */
+static inline uint8_t bufferFree( WriteBuffer *buffer )
+{
+	return buffer != writeBuffer || writeDone();
+}
+
+/* Queues the write of the open page buffer followed by ACK polling */
+void commitWrites()
+{
+	WriteBuffer *buffer = openBuffer;
+	
+	if( !buffer )
+		return;
+	openBuffer = 0;
+	
+	// The transactions are free once the last page write has been polled
+	while( !writeDone() )
+		;
+	writeBuffer = buffer;
+	
+	setupTransaction( &pageWrite, 0, buffer->page + buffer->start, buffer->data + buffer->start, buffer->end - buffer->start );
+	pageWrite.callback = pageWritten;
+	setupTransaction( &pagePoll, 0, buffer->page, 0, 0 );		// Poll the chip that was written
+	pagePoll.addressLength = 0;
+	pagePoll.callback = writeDurable;
+	committed = micros();
+	
+	while( !twiSubmit( &pageWrite ))
+		;
+	while( !twiSubmit( &pagePoll ))
+		;
+}
+
+/* Writes everything and waits for the EEPROM */
+void flushWrites()
+{
+	commitWrites();
+	while( !writeDone() )
+		;
+}
+
+/* Called from the TWI interrupt handler when a part of a split read has ended */
+static void splitReadDone( TWITransaction *transaction )
+{
+	if( transaction->status == TWIStatus_Done && splitRead.left )
+	{
+		// First part done: read the rest from the start of the next chip
+		transaction->device += 2;
+		transaction->address = 0;
+		transaction->data += transaction->length;
+		transaction->length = splitRead.left;
+		splitRead.left = 0;
+		if( twiSubmit( transaction ))
+			return;
+		transaction->status = TWIStatus_Error;
+	}
+	
+	// Both parts done (or failed): the caller sees a single read
+	transaction->data = splitRead.data;
+	transaction->length = splitRead.length;
+	transaction->callback = splitRead.callback;
+	splitRead.transaction = 0;
+	if( transaction->callback )
+		transaction->callback( transaction );
+}
 
 /* Writes a single byte to the specified address */
-void writeByte( int address, uint8_t data )
+void writeByte( uint32_t address, uint8_t data )
 {
-	i2c_start_wait( EEPROM_ADDRESS + I2C_WRITE );
-	i2c_write( address >> 8 );	// MSB of address
-	i2c_write( address );		// LSB of address
-	i2c_write( data );			// Data
-	i2c_stop();
+	writeData( address, &data, 1 );
 }
 
 /* Reads a single byte from the specified address */
-uint8_t readByte( int address )
+uint8_t readByte( uint32_t address )
 {
 	uint8_t data;
 	
-	// Random access read
-	i2c_start_wait( EEPROM_ADDRESS + I2C_WRITE );
-	i2c_write( address >> 8 );	// MSB of address
-	i2c_write( address );		// LSB of address
-	i2c_rep_start( EEPROM_ADDRESS + I2C_READ );
-	data = i2c_readNak();		// We don't want more than one byte
-	i2c_stop();
-	
+	readData( address, &data, 1 );
 	return data;	
 }
 
 /* Reads current address byte */
 uint8_t readCurrentByte()
 {
+	TWITransaction transaction;
 	uint8_t data;
 	
-	i2c_start_wait( EEPROM_ADDRESS + I2C_READ );
-	data = i2c_readNak();		// We don't want more than one byte
-	i2c_stop();
+	commitWrites();
+	setupTransaction( &transaction, 1, 0, &data, 1 );
+	transaction.addressLength = 0;		// No address: read from the current address
+	if( twiTransfer( &transaction ) != TWIStatus_Done )
+	{
+		eepromErrors++;
+		return 0xFF;
+	}
 	
 	return data;
 }
 
-/* Reads sequential data from the specified address */
-void readData( int address, unsigned char *data, int len )
+/* Reads sequential data from the specified address. A sequential read wraps around at the end of a chip so it is split at chip boundaries. */
+uint8_t readData( uint32_t address, unsigned char *data, int len )
 {
-	int i;
+	TWITransaction transaction;
+	unsigned int chunk;
+	uint8_t ok = 1;
 
-	i2c_start_wait( EEPROM_ADDRESS + I2C_WRITE );
-	i2c_write( address >> 8 );	// MSB of address
-	i2c_write( address );		// LSB of address
+	if( len <= 0 )
+		return 1;
+	commitWrites();
+	while( len > 0 )
+	{
+		chunk = ((uint32_t)len > chipLeft( address )) ? chipLeft( address ) : (unsigned int)len;
+		setupTransaction( &transaction, 1, address, data, chunk );
+		if( twiTransfer( &transaction ) != TWIStatus_Done )
+		{
+			// The chip did not answer: the data reads as erased
+			memset( data, 0xFF, chunk );
+			eepromErrors++;
+			ok = 0;
+		}
+		address += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+	return ok;
+}
 
-	// Start reading
-	i2c_rep_start( EEPROM_ADDRESS + I2C_READ );
-	for( i = 0; i < len; i++ )
-		*data++ = i2c_read( (i < len-1) );	// Send ACK as long as read<len – i.e. we want another byte
+/* Starts reading sequential data */
+uint8_t readDataAsync( TWITransaction *transaction, uint32_t address, unsigned char *data, unsigned int len, TWICallback callback )
+{
+	setupTransaction( transaction, 1, address, data, len );
+	transaction->callback = callback;
+	
+	if( len > chipLeft( address ))
+	{
+		// Crosses a chip boundary: read up to the end of this chip first
+		if( splitRead.transaction )
+			return 0;
+		splitRead.transaction = transaction;
+		splitRead.data = data;
+		splitRead.length = len;
+		splitRead.left = len - chipLeft( address );
+		splitRead.callback = callback;
+		transaction->length = chipLeft( address );
+		transaction->callback = splitReadDone;
+		if( !twiSubmit( transaction ))
+		{
+			splitRead.transaction = 0;
+			return 0;
+		}
+		return 1;
+	}
 	
-	i2c_stop();
+	return twiSubmit( transaction );
 }
 
-/* Write up to 256 bytes. NB: heed warnings about adderss alignment and data size. */
-void writePage( int address, unsigned char *data, uint8_t len )
+/* Write up to 256 bytes. NB: heed warnings about adderss alignment and data size. Data for the next chip is written there. */
+void writePage( uint32_t address, unsigned char *data, uint8_t len )
 {
-	int i;
+	TWITransaction transaction;
+	uint8_t chunk;
 	
-	i2c_start_wait( EEPROM_ADDRESS + I2C_WRITE );
-	i2c_write( address >> 8 );	// MSB of address
-	i2c_write( address );		// LSB of address
+	commitWrites();
+	while( len )
+	{
+		chunk = ((uint32_t)len > chipLeft( address )) ? chipLeft( address ) : (unsigned int)len;
+		setupTransaction( &transaction, 0, address, data, chunk );
+		if( twiTransfer( &transaction ) != TWIStatus_Done )
+			eepromErrors++;
+		address += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+}
 
-	// Write data
-	for( i = 0; i < len; i++ )
-		i2c_write( *data++ );
+/* Writes any amount of data to any address by collecting it in page buffers. Pages never cross a chip boundary. */
+void writeData( uint32_t address, unsigned char *data, unsigned int len )
+{
+	unsigned int chunk;
+	uint32_t page;
+	uint8_t offset;
 	
-	i2c_stop();
-}
\ No newline at end of file
+	while( len )
+	{
+		// Write up to the next page boundary
+		page = address & ~(EEPROM_PAGE_SIZE-1);
+		offset = address & (EEPROM_PAGE_SIZE-1);
+		chunk = EEPROM_PAGE_SIZE - offset;
+		if( chunk > len )
+			chunk = len;
+		
+		// Combine with the open buffer if the bytes are in the same page and touch or overlap the buffered ones
+		if( openBuffer && (openBuffer->page != page || offset > openBuffer->end || offset + chunk < openBuffer->start) )
+			commitWrites();
+		
+		if( !openBuffer )
+		{
+			openBuffer = &writeBuffers[ nextBuffer ];
+			nextBuffer ^= 1;
+			while( !bufferFree( openBuffer ))
+				;
+			openBuffer->page = page;
+			openBuffer->start = offset;
+			openBuffer->end = offset;
+		}
+		
+		memcpy( openBuffer->data + offset, data, chunk );
+		if( offset < openBuffer->start )
+			openBuffer->start = offset;
+		if( offset + chunk > openBuffer->end )
+			openBuffer->end = offset + chunk;
+		
+		address += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+}
@@ -6,7 +6,11 @@
 //  Copyright (c) 2012 Greener Pastures. All rights reserved.
 //
 
+#ifndef BLEremote_24c_eeprom_h
+#define BLEremote_24c_eeprom_h
+
 #include <avr/io.h>
+#include "twi.h"
 
 /**
 @defgroup jwj_24ceeprom 24C EEPROM library
@@ -17,9 +21,14 @@
  24C EEPROM Library
  
  The 24C EEPROM library contains helper functions for using the 24C (specifically, Microchip 24LC512) series EEPROMs.
+
+ Up to eight chips can share the bus using the chip select pins A2:A0. Addresses are 32 bit: bits 18:16 select the chip and bits 15:0 are the address within the chip, so the chips form one continuous address space of @link EEPROM_SIZE @endlink bytes. Reads and writes that cross from one chip to the next are split by the library.
  
-@note
- This library requires I2C functions compatible with <a href="http://jump.to/fleury">Peter Fleury's I2C (TWI) Master Software Library</a>!
+The functions queue transactions with the interrupt driven TWI driver (twi.h). The read functions wait for the transaction to end; readDataAsync() returns immediately.
+
+writeData() and writeByte() are buffered: the data is collected in one of two page buffers and consecutive writes to the same page are combined into a single page write. A page buffer is committed – i.e. the page write is queued – when data for another page arrives, before any read and by commitWrites(). Every page write is followed by an ACK polling transaction which ends when the EEPROM has finished its internal write cycle, so the main loop never waits for the write cycle unless it commits a page while the last one is still being written, needs a page buffer that is still busy or calls flushWrites(). The page buffers share one write and one polling transaction: one page is written at a time while the other buffer is being filled.
+
+A chip that does not answer fails each transfer after the TWI driver's retry limit instead of hanging the bus. Failed reads return 0xFF bytes, failed writes are dropped, and both are counted in @link eepromErrors @endlink.
 
  @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
  
@@ -27,45 +36,100 @@
 
 /**@{*/
 
-/** Defines the I2C device address of the EEPROM device. This address must already be shifted one byte to the left to make room for the read/write bit. So for a device where the upper four bits are configured as 1010 (e.g. M24C64) and the Chip Enable pins E2:E0 are all tied to ground, the final address is 0xA0. */
+/** Defines the I2C device address of the first EEPROM device. This address must already be shifted one byte to the left to make room for the read/write bit. So for a device where the upper four bits are configured as 1010 (e.g. M24C64) and the Chip Enable pins E2:E0 are all tied to ground, the final address is 0xA0. The following chips must have their chip select pins set to 1, 2, 3 etc. */
 #define EEPROM_ADDRESS 0xA0
 
-/** Writes a single byte to the specified destination address.
- @param address The 16 bit memory address to write to.
+/** Number of EEPROM chips: 1 to 8. */
+#define EEPROM_CHIPS 1
+
+/** Page size of the EEPROM device in bytes. Page writes must not cross a page boundary. */
+#define EEPROM_PAGE_SIZE 128
+
+/** Size of one EEPROM chip in bytes. */
+#define EEPROM_CHIP_SIZE 0x10000UL
+
+/** Total size of the EEPROM chips in bytes. */
+#define EEPROM_SIZE (EEPROM_CHIP_SIZE * EEPROM_CHIPS)
+
+/** Duration in µs of the last EEPROM write cycle: measured with micros() from the end of the page write until the ACK poll was answered. */
+extern uint16_t writeCycleTime;
+
+/** Time in µs from when the last page write was committed until the data was durable – i.e. the wait in the TWI queue, the transfer and the write cycle. Measured with micros(). */
+extern uint16_t durableTime;
+
+/** Number of EEPROM transfers that failed – typically because a chip did not answer within @link TWI_MAX_RETRIES @endlink attempts. */
+extern uint16_t eepromErrors;
+
+/** Writes a single byte to the specified destination address. The write is buffered.
+ @param address The 32 bit memory address to write to.
  @param data The 8 bit value to store.
  */
-void writeByte( int address, uint8_t data );
+void writeByte( uint32_t address, uint8_t data );
 
 /** Writes a 32 byte page to the specified address.
- @param address The 16 bit memory address to write to.
+ @param address The 32 bit memory address to write to.
  @param data Pointer to the data to write.
  @param len Length of data to write. **NOTE: This should not exceed 128 bytes or weird stuff will happen**
  
  A page is 128 bytes long. When writing a page, an internal memory address pointer is increased for every byte. But only the last 7 bits are increased. So if the data is longer than 128 bytes or the address is not aligned to the start of a page, the address pointer will wrap around to the start of the page and continue writing.
  
  @warning To align the address to the start of a page, the last seven bits of the address _must_ be 0. If this is not the case, the address pointer will wrap around to the start of the page and continue so the data written will not be in the same sequence as the original data.
+ @note Data crossing from one chip to the next is written with one page write to each chip.
  */
-void writePage( int address, unsigned char *data, uint8_t len );
+void writePage( uint32_t address, unsigned char *data, uint8_t len );
+
+/** Writes data of any length to any address. The write is buffered.
+ @param address The 32 bit memory address to write to.
+ @param data Pointer to the data to write.
+ @param len Length of data to write.
+ 
+ The data is split into page writes so no page boundary is crossed. The function returns when the data has been copied to the page buffers; it waits only if it needs a page buffer whose write is still in progress.
+ @see flushWrites
+ */
+void writeData( uint32_t address, unsigned char *data, unsigned int len );
+
+/** Queues the page write for the buffered data. Waits only until the last page write has ended – not for this one. */
+void commitWrites();
+
+/** Writes all buffered data and waits until the EEPROM has finished writing it. */
+void flushWrites();
 
 /** Reads one byte from the specified address.
- @param address The 16 bit address to read from.
- @return The 8 bit value stored at the specified address.
+ @param address The 32 bit address to read from.
+ @return The 8 bit value stored at the specified address or 0xFF if the chip did not answer.
  */
-uint8_t readByte( int address );
+uint8_t readByte( uint32_t address );
 
 /** Reads the byte at the current memory address. The address pointer is incremented after reading.
- @returns The 8 bit value stored at the current memory address.
+ @returns The 8 bit value stored at the current memory address or 0xFF if the chip did not answer.
  */
 uint8_t readCurrentByte();
 
 
 /**
  @brief Reads sequential data.
- @param address The 16 bit memory address to start reading from.
+ @param address The 32 bit memory address to start reading from.
  @param data Pointer to a buffer to receive read data.
  @param len Number of bytes to read.
  
- This function reads `len` bytes from the specified address and forward.
+ @return 1 if the data was read or 0 if a chip did not answer. The bytes from that chip are then set to 0xFF – they read as erased.
+ 
+ This function reads `len` bytes from the specified address and forward. A read crossing from one chip to the next is done as one sequential read from each chip.
  */
-void readData( int address, unsigned char *data, int len );
-/**@}*/
\ No newline at end of file
+uint8_t readData( uint32_t address, unsigned char *data, int len );
+
+/** Starts reading sequential data in the background.
+ @param transaction Pointer to a transaction structure which must remain untouched until the read has ended.
+ @param address The 32 bit memory address to start reading from.
+ @param data Pointer to a buffer to receive read data.
+ @param len Number of bytes to read.
+ @param callback Function called from the TWI interrupt handler when the data has been read or 0.
+ @return 1 if the read was queued or 0 if the TWI queue is full.
+ @note Buffered data which has not been committed is not seen by the read. This function does not commit the buffers itself since it is also called from interrupt handlers.
+ @note A read crossing from one chip to the next is done in two parts: the second part is queued when the first has ended and the callback is called when both have ended. Only one such read can be in progress; 0 is returned for another one.
+ @see twiSubmit
+ */
+uint8_t readDataAsync( TWITransaction *transaction, uint32_t address, unsigned char *data, unsigned int len, TWICallback callback );
+/**@}*/
+
+#endif
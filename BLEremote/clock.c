@@ -0,0 +1,60 @@
+//
+//  clock.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 18-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "clock.h"
+#include "led.h"
+
+static volatile uint16_t milliseconds;
+
+/* Starts Timer2 in CTC mode with a 1 ms period */
+void initClock()
+{
+	TCCR2A = (1<< WGM21);				// CTC mode with OCR2A as TOP
+	TCCR2B = (1<< CS22);				// F_CPU/64
+	OCR2A = CLOCK_OCR;
+	TIMSK2 |= (1<< OCIE2A);
+}
+
+/* Returns the millisecond counter. It is 16 bit so interrupts are disabled while reading it. */
+uint16_t millis()
+{
+	uint16_t value;
+	uint8_t sreg = SREG;
+
+	cli();
+	value = milliseconds;
+	SREG = sreg;
+
+	return value;
+}
+
+/* Returns a µs time stamp. A compare match that has happened but has not been handled yet – e.g. because this is called from another interrupt handler – is counted. */
+uint16_t micros()
+{
+	uint16_t value;
+	uint8_t ticks;
+	uint8_t sreg = SREG;
+
+	cli();
+	value = milliseconds;
+	ticks = TCNT2;
+	if( (TIFR2 & (1<< OCF2A)) && ticks < CLOCK_OCR )
+		value++;
+	SREG = sreg;
+
+	return value * 1000 + ticks * CLOCK_PRESCALE / (F_CPU / 1000000L);
+}
+
+// Interrupt handler for Timer2 compare match A
+ISR( TIMER2_COMPA_vect )
+{
+	milliseconds++;
+	ledTick();
+}
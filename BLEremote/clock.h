@@ -0,0 +1,49 @@
+//
+//  clock.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 18-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_clock_h
+#define BLEremote_clock_h
+
+#include <avr/io.h>
+
+/**
+ @defgroup jwj_clock Millisecond Clock
+ @brief Millisecond time base on Timer2.
+
+ @code #include "clock.h" @endcode
+
+ Millisecond Clock
+
+ Timer0 generates the IR carrier and Timer1 is used for sending and learning, so Timer2 provides the time base for things that happen in the main loop over time – like the delays between the commands of a macro. Timer2 runs in CTC mode and the compare interrupt increments a 16 bit counter and advances the LED pattern (ledTick()).
+
+ The counter wraps around after 65 seconds so time differences must be computed as <tt>(uint16_t)(millis() - start)</tt>.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** Timer2 prescaler: F_CPU/64. */
+#define CLOCK_PRESCALE 64
+
+/** OCR2A value for a 1 ms period. At 12 MHz this is 1.003 ms. */
+#define CLOCK_OCR ((F_CPU / CLOCK_PRESCALE + 500) / 1000 - 1)
+
+/** Starts Timer2 and its compare interrupt. */
+void initClock();
+
+/** Returns the number of milliseconds since initClock() was called, modulo 65536. */
+uint16_t millis();
+
+/** Returns a time stamp in µs from the millisecond counter and Timer2, modulo 65536 – for timing intervals shorter than 65 ms as <tt>(uint16_t)(micros() - start)</tt>. The resolution is one Timer2 tick (5.3 µs at 12 MHz). May be called from interrupt handlers. */
+uint16_t micros();
+
+/**@}*/
+
+#endif
@@ -0,0 +1,110 @@
+//
+//  codecache.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 02-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <string.h>
+#include "infrared.h"
+#include "irprotocol.h"
+#include "codecache.h"
+
+typedef struct {
+	uint8_t command;
+	uint16_t offset;		// Offset of the code in the arena
+	uint16_t length;
+} CacheEntry;
+
+// Entries in most recently used order: entries[0] is the most recently used
+static CacheEntry entries[ CODECACHE_ENTRIES ];
+static uint8_t entryCount;
+static uint16_t arenaUsed;
+static unsigned char arena[ CODECACHE_ARENA_SIZE ];
+
+uint16_t cacheHits;
+uint16_t cacheMisses;
+
+/* Removes the entry at the specified position and moves the codes after it down */
+static void removeEntry( uint8_t index )
+{
+	uint16_t offset = entries[ index ].offset;
+	uint16_t length = entries[ index ].length;
+	uint8_t i;
+
+	// Don't move anything under the transmit interrupt handler's feet. A held compact code would never end by itself, so stop repeating it.
+	holdIRCode( 0 );
+	while( isSendingIR() )
+		;
+
+	memmove( arena + offset, arena + offset + length, arenaUsed - offset - length );
+	arenaUsed -= length;
+
+	memmove( &entries[ index ], &entries[ index+1 ], (entryCount - index - 1) * sizeof( CacheEntry ));
+	entryCount--;
+
+	for( i = 0; i < entryCount; i++ )
+		if( entries[i].offset > offset )
+			entries[i].offset -= length;
+}
+
+/* Looks up a code and moves it to the front of the list */
+unsigned char *cacheLookup( uint8_t commandNumber, unsigned int *len )
+{
+	CacheEntry entry;
+	uint8_t i;
+
+	for( i = 0; i < entryCount; i++ )
+		if( entries[i].command == commandNumber )
+			break;
+
+	if( i == entryCount )
+	{
+		cacheMisses++;
+		return 0;
+	}
+	cacheHits++;
+
+	// Most recently used first
+	entry = entries[i];
+	memmove( &entries[1], &entries[0], i * sizeof( CacheEntry ));
+	entries[0] = entry;
+
+	*len = entry.length;
+	return arena + entry.offset;
+}
+
+/* Makes room for a code at the end of the arena */
+unsigned char *cacheInsert( uint8_t commandNumber, unsigned int len )
+{
+	if( len > CODECACHE_ARENA_SIZE )
+		return 0;
+
+	// Evict least recently used codes until there is room
+	while( entryCount == CODECACHE_ENTRIES || arenaUsed + len > CODECACHE_ARENA_SIZE )
+		removeEntry( entryCount-1 );
+
+	memmove( &entries[1], &entries[0], entryCount * sizeof( CacheEntry ));
+	entries[0].command = commandNumber;
+	entries[0].offset = arenaUsed;
+	entries[0].length = len;
+	entryCount++;
+	arenaUsed += len;
+
+	return arena + entries[0].offset;
+}
+
+/* Removes a code from the cache */
+void cacheInvalidate( uint8_t commandNumber )
+{
+	uint8_t i;
+
+	for( i = 0; i < entryCount; i++ )
+		if( entries[i].command == commandNumber )
+		{
+			removeEntry( i );
+			return;
+		}
+}
@@ -0,0 +1,67 @@
+//
+//  codecache.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 02-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_codecache_h
+#define BLEremote_codecache_h
+
+/**
+ @defgroup jwj_codecache Code Cache
+ @brief SRAM cache of recently sent IR codes.
+
+ @code #include "codecache.h" @endcode
+
+ Code Cache
+
+ Reading a code from the EEPROM takes a few milliseconds of I2C traffic before the first IR edge can go out. The cache keeps the most recently used codes in SRAM so alternating between a few buttons (volume up and down, for example) only reads the EEPROM the first time.
+
+ The codes are stored back to back in a fixed arena of @link CODECACHE_ARENA_SIZE @endlink bytes. The entries are kept in least recently used order and when room is needed for a new code, the least recently used codes are evicted and the codes after them are moved down to close the gap.
+
+ @note Moving cached codes while one of them is being sent would corrupt the transmission, so cacheInsert() and cacheInvalidate() wait until the transmitter is idle.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** Size of the arena in bytes. This must be at least the size of the largest compressed code including its code header (115 bytes). Raw codes are streamed from the EEPROM instead of being cached. */
+#define CODECACHE_ARENA_SIZE 120
+
+/** Maximum number of cached codes. */
+#define CODECACHE_ENTRIES 8
+
+/** Number of cacheLookup() calls that found the code in the cache. */
+extern uint16_t cacheHits;
+
+/** Number of cacheLookup() calls that did not find the code in the cache. */
+extern uint16_t cacheMisses;
+
+/** Looks up a code in the cache and marks it as the most recently used.
+ @param commandNumber The command number.
+ @param len Pointer to a variable which receives the length of the code in bytes.
+ @return A pointer to the cached code or 0 if the code is not in the cache.
+ */
+unsigned char *cacheLookup( uint8_t commandNumber, unsigned int *len );
+
+/** Makes room for a code in the cache, evicting the least recently used codes if necessary.
+
+ The caller must fill in the code. Any pointers previously returned by cacheLookup() or cacheInsert() are invalid afterwards.
+ @param commandNumber The command number. Must not be in the cache already.
+ @param len Length of the code in bytes.
+ @return A pointer to @c len bytes in the arena or 0 if the code is larger than the arena.
+ */
+unsigned char *cacheInsert( uint8_t commandNumber, unsigned int len );
+
+/** Removes a code from the cache. Call this whenever the stored code for a command is changed or deleted.
+ @param commandNumber The command number.
+ */
+void cacheInvalidate( uint8_t commandNumber );
+
+/**@}*/
+
+#endif
@@ -0,0 +1,536 @@
+//
+//  codestore.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 28-06-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <string.h>
+#include <stddef.h>
+#include <util/crc16.h>
+#include "24c_eeprom.h"
+#include "infrared.h"
+#include "irprotocol.h"
+#include "ircompress.h"
+#include "clock.h"
+#include "codestore.h"
+
+// Header page
+typedef struct {
+	uint16_t magic;
+	uint8_t version;
+	uint16_t dataEnd;		// End of the used part of the data area: bits 15:0 ...
+	uint8_t dataChip;		// ... and bits 23:16
+} StoreHeader;
+
+// An allocation table entry in the EEPROM
+typedef struct {
+	uint16_t address;		// Address bits 15:0 or TABLE_EMPTY
+	uint16_t length;		// Length in bits 12:0 and address bits 18:16 in bits 15:13 or TABLE_EMPTY
+} TableEntry;
+
+// Both words of the table entry of an unused command
+#define TABLE_EMPTY 0xFFFF
+
+// Header of every record in the data area. The table entry points to the code right after this.
+typedef struct {
+	uint8_t command;
+	uint16_t length;
+} StoreRecord;
+
+// Size of the buffer used when formatting and compacting
+#define CHUNK_SIZE 32
+
+// The old fixed slot layout: the slot of command n is at n * OLD_SLOT_SIZE in the first chip and holds 0 terminated raw pulses
+#define OLD_SLOT_SIZE 256
+#define OLD_SLOT_PULSES (OLD_SLOT_SIZE / sizeof( unsigned int ) - 1)
+
+static uint32_t dataEnd;
+
+// One bit per command: set when the CRC of a stored code has been checked by verifyCommand()
+static uint8_t verified[ STORE_COMMANDS/8 ];
+
+// The index: one bit per command that has a code and its encoding in a nibble
+static uint8_t stored[ STORE_COMMANDS/8 ];
+static uint8_t encodings[ STORE_COMMANDS/2 ];
+
+uint16_t storedCommands;
+uint16_t storeScanTime;
+
+/* Returns the EEPROM address of the table entry for a command */
+static inline uint32_t entryAddress( uint8_t commandNumber )
+{
+	return STORE_TABLE_ADDRESS + commandNumber * STORE_ENTRY_SIZE;
+}
+
+/* Unpacks a table entry */
+static void unpackEntry( const TableEntry *packed, StoreEntry *entry )
+{
+	if( packed->address == TABLE_EMPTY && packed->length == TABLE_EMPTY )
+	{
+		entry->address = STORE_EMPTY;
+		entry->length = 0;
+		return;
+	}
+	entry->address = packed->address | ((uint32_t)(packed->length >> 13) << 16);
+	entry->length = packed->length & STORE_MAX_LENGTH;
+}
+
+/* Writes the header page */
+static void writeHeader()
+{
+	StoreHeader header;
+
+	header.magic = STORE_MAGIC;
+	header.version = STORE_VERSION;
+	header.dataEnd = dataEnd;
+	header.dataChip = dataEnd >> 16;
+	writeData( 0, (unsigned char*)&header, sizeof( header ));
+}
+
+/* Writes a table entry */
+static void writeEntry( uint8_t commandNumber, uint32_t address, uint16_t length )
+{
+	TableEntry entry;
+
+	entry.address = address;
+	entry.length = length | ((address >> 16) << 13);
+	if( address == STORE_EMPTY )
+		entry.length = TABLE_EMPTY;
+	writeData( entryAddress( commandNumber ), (unsigned char*)&entry, sizeof( entry ));
+}
+
+/* Marks a command's code as not checked */
+static inline void clearVerified( uint8_t commandNumber )
+{
+	verified[ commandNumber >> 3 ] &= ~(1 << (commandNumber & 7));
+}
+
+/* Puts a command in the index */
+static void indexCommand( uint8_t commandNumber, uint8_t encoding )
+{
+	uint8_t mask = 1 << (commandNumber & 7);
+	uint8_t shift = (commandNumber & 1) ? 4 : 0;
+
+	if( !(stored[ commandNumber >> 3 ] & mask) )
+		storedCommands++;
+	stored[ commandNumber >> 3 ] |= mask;
+	encodings[ commandNumber >> 1 ] = (encodings[ commandNumber >> 1 ] & ~(0x0F << shift)) | ((encoding & 0x0F) << shift);
+}
+
+/* Removes a command from the index */
+static void unindexCommand( uint8_t commandNumber )
+{
+	uint8_t mask = 1 << (commandNumber & 7);
+
+	if( stored[ commandNumber >> 3 ] & mask )
+		storedCommands--;
+	stored[ commandNumber >> 3 ] &= ~mask;
+}
+
+/* Checks a code header against its table entry */
+static uint8_t validHeader( const StoreEntry *entry, const CodeHeader *header )
+{
+	return header->magic == CODE_MAGIC && header->version == CODE_VERSION && header->length == entry->length - sizeof( *header );
+}
+
+/* Builds the index from the allocation table and the code headers. The table is read in chunks and only the header of each code is read. */
+static void scanStore()
+{
+	TableEntry entries[ CHUNK_SIZE / sizeof( TableEntry ) ];
+	StoreEntry entry;
+	CodeHeader header;
+	uint16_t start = millis();
+	uint8_t commandNumber = 0;
+	uint8_t i;
+
+	memset( stored, 0, sizeof( stored ));
+	storedCommands = 0;
+	do
+	{
+		readData( entryAddress( commandNumber ), (unsigned char*)entries, sizeof( entries ));
+		for( i = 0; i < sizeof( entries ) / sizeof( TableEntry ); i++, commandNumber++ )
+		{
+			unpackEntry( &entries[i], &entry );
+			if( entry.address == STORE_EMPTY )
+				continue;
+
+			header.magic = 0;
+			if( entry.length >= sizeof( header ))
+				readData( entry.address, (unsigned char*)&header, sizeof( header ));
+			indexCommand( commandNumber, validHeader( &entry, &header ) ? header.encoding : STORE_ENCODING_INVALID );
+		}
+	} while( commandNumber != 0 );
+
+	storeScanTime = millis() - start;
+}
+
+/* Adds bytes to a CRC */
+static uint16_t crcUpdate( uint16_t crc, const unsigned char *data, unsigned int len )
+{
+	while( len-- )
+		crc = _crc_xmodem_update( crc, *data++ );
+	return crc;
+}
+
+/* Adds bytes read from the EEPROM to a CRC */
+static uint16_t crcStored( uint16_t crc, uint32_t address, unsigned int len )
+{
+	unsigned char buffer[ CHUNK_SIZE ];
+	unsigned int chunk;
+
+	while( len )
+	{
+		chunk = (len > CHUNK_SIZE) ? CHUNK_SIZE : len;
+		readData( address, buffer, chunk );
+		crc = crcUpdate( crc, buffer, chunk );
+		address += chunk;
+		len -= chunk;
+	}
+	return crc;
+}
+
+/* Moves data down in the EEPROM in chunks. Moving down is safe even if the areas overlap. */
+static void moveDown( uint32_t to, uint32_t from, unsigned int len )
+{
+	unsigned char buffer[ CHUNK_SIZE ];
+	unsigned int offset, chunk;
+
+	for( offset = 0; offset < len; offset += chunk )
+	{
+		chunk = (len - offset > CHUNK_SIZE) ? CHUNK_SIZE : len - offset;
+		readData( from + offset, buffer, chunk );
+		writeData( to + offset, buffer, chunk );
+	}
+}
+
+/* Returns the CRC of the header fields in front of the CRC field */
+static inline uint16_t headerCRC( const CodeHeader *header )
+{
+	return crcUpdate( 0, (const unsigned char*)header, offsetof( CodeHeader, crc ));
+}
+
+/* Checks a slot of the old layout: 1 to 127 pulses of at most MAXPULSE ticks and a 0. A code learned past the end of the slot is cut at 127 pulses.
+ * Returns the length of the raw code including the 0 or 0 if the slot is empty or does not hold a code.
+ */
+static unsigned int oldSlotLength( unsigned int *pulses )
+{
+	uint8_t i;
+
+	pulses[ OLD_SLOT_PULSES ] = 0;
+	for( i = 0; pulses[i]; i++ )
+		if( pulses[i] > MAXPULSE )
+			return 0;
+
+	return i ? (i + 1) * sizeof( unsigned int ) : 0;
+}
+
+/* Converts the codes of the old fixed slot layout and formats the store with them.
+ * The slots are converted from the top down. Each code is encoded like a learned one and its record is written just below the records before it, at the top of the first chip.
+ * A record never goes below the slot being converted, so only slots that have been read are overwritten. A code that does not fit is dropped.
+ * Then the records are moved down to the data area, the table is written and the header page – over slot 0 – last.
+ */
+static void migrateSlots( unsigned char *buffer )
+{
+	StoreRecord record;
+	CodeHeader header;
+	IRCode code;
+	uint32_t top = EEPROM_CHIP_SIZE - 1;		// Start of the records converted so far
+	uint32_t slot, address;
+	unsigned int len, size;
+	uint8_t commandNumber = 0;
+
+	do
+	{
+		commandNumber--;
+		slot = (uint32_t)commandNumber * OLD_SLOT_SIZE;
+		readData( slot, buffer, OLD_SLOT_SIZE );
+		if( !(len = oldSlotLength( (unsigned int*)buffer )) )
+			continue;
+
+		// Compact record if the protocol is recognized, otherwise the compressed or raw pulses
+		memset( &header, 0, sizeof( header ));
+		if( decodeIR( (unsigned int*)buffer, &code ))
+		{
+			memcpy( buffer, &code, sizeof( code ));
+			len = sizeof( code );
+			header.encoding = code.protocol;
+			header.repeat = code.repeat;
+		}
+		else if( (size = compressIR( buffer )) )
+		{
+			len = size;
+			header.encoding = IRProtocol_Compressed;
+		}
+		else
+			header.encoding = IRProtocol_Raw;
+
+		record.command = commandNumber;
+		record.length = sizeof( header ) + len;
+		size = sizeof( record ) + record.length;
+		if( top < slot + size || top < STORE_DATA_ADDRESS + size )
+			continue;
+		address = top - size;
+
+		header.magic = CODE_MAGIC;
+		header.version = CODE_VERSION;
+		header.length = len;
+		header.crc = crcUpdate( headerCRC( &header ), buffer, len );
+		writeData( address, (unsigned char*)&record, sizeof( record ));
+		writeData( address + sizeof( record ), (unsigned char*)&header, sizeof( header ));
+		writeData( address + sizeof( record ) + sizeof( header ), buffer, len );
+		top = address;
+	} while( commandNumber != 0 );
+
+	// Mark all commands as unused
+	memset( buffer, 0xFF, CHUNK_SIZE );
+	for( address = STORE_TABLE_ADDRESS; address < STORE_DATA_ADDRESS; address += CHUNK_SIZE )
+		writeData( address, buffer, CHUNK_SIZE );
+
+	// Move the records to the start of the data area and point the table to them
+	moveDown( STORE_DATA_ADDRESS, top, EEPROM_CHIP_SIZE - 1 - top );
+	dataEnd = STORE_DATA_ADDRESS + (EEPROM_CHIP_SIZE - 1 - top);
+	for( address = STORE_DATA_ADDRESS; address < dataEnd; address += sizeof( record ) + record.length )
+	{
+		readData( address, (unsigned char*)&record, sizeof( record ));
+		writeEntry( record.command, address + sizeof( record ), record.length );
+	}
+
+	writeHeader();
+	commitWrites();
+}
+
+/* Checks the header page and converts the old slot layout or formats the EEPROM if necessary */
+void initStore( unsigned char *buffer )
+{
+	StoreHeader header;
+
+	// No EEPROM answering: leave the index empty and the store full so nothing is written
+	if( !readData( 0, (unsigned char*)&header, sizeof( header )))
+	{
+		dataEnd = STORE_DATA_END;
+		memset( stored, 0, sizeof( stored ));
+		storedCommands = 0;
+		return;
+	}
+	if( header.magic == STORE_MAGIC && header.version == STORE_VERSION )
+	{
+		dataEnd = header.dataEnd | ((uint32_t)header.dataChip << 16);
+		scanStore();
+		return;
+	}
+
+	// No code store: take over the codes of the old layout – if there are none, this just formats
+	migrateSlots( buffer );
+	scanStore();
+}
+
+/* Looks up a command in the allocation table */
+void lookupCommand( uint8_t commandNumber, StoreEntry *entry )
+{
+	TableEntry packed;
+
+	readData( entryAddress( commandNumber ), (unsigned char*)&packed, sizeof( packed ));
+	unpackEntry( &packed, entry );
+}
+
+/* Reads and checks the header of a stored code */
+uint8_t readCodeHeader( uint8_t commandNumber, StoreEntry *entry, CodeHeader *header )
+{
+	// The index answers for empty commands without reading the EEPROM
+	if( !commandStored( commandNumber ))
+	{
+		entry->address = STORE_EMPTY;
+		entry->length = 0;
+		return 0;
+	}
+
+	lookupCommand( commandNumber, entry );
+	if( entry->address == STORE_EMPTY || entry->length < sizeof( *header ))
+		return 0;
+
+	readData( entry->address, (unsigned char*)header, sizeof( *header ));
+	return validHeader( entry, header );
+}
+
+/* Checks the index for a stored code */
+uint8_t commandStored( uint8_t commandNumber )
+{
+	return stored[ commandNumber >> 3 ] & (1 << (commandNumber & 7));
+}
+
+/* Gets the encoding of a stored code from the index */
+uint8_t commandEncoding( uint8_t commandNumber )
+{
+	if( !commandStored( commandNumber ))
+		return STORE_ENCODING_NONE;
+	return (encodings[ commandNumber >> 1 ] >> ((commandNumber & 1) ? 4 : 0)) & 0x0F;
+}
+
+/* Checks the CRC of a code in SRAM */
+uint8_t checkCode( const CodeHeader *header, const unsigned char *data )
+{
+	return crcUpdate( headerCRC( header ), data, header->length ) == header->crc;
+}
+
+/* Checks the CRC of a stored code */
+uint8_t verifyCommand( uint8_t commandNumber )
+{
+	StoreEntry entry;
+	CodeHeader header;
+	uint8_t mask = 1 << (commandNumber & 7);
+
+	if( !readCodeHeader( commandNumber, &entry, &header ))
+		return 0;
+	if( verified[ commandNumber >> 3 ] & mask )
+		return 1;
+
+	if( crcStored( headerCRC( &header ), entry.address + sizeof( header ), header.length ) != header.crc )
+		return 0;
+
+	verified[ commandNumber >> 3 ] |= mask;
+	return 1;
+}
+
+/* Appends the record for a code whose data is already in place after the record and header and points the table entry to it. The old record is now dead. */
+static void appendRecord( uint8_t commandNumber, CodeHeader *header )
+{
+	StoreRecord record;
+
+	record.command = commandNumber;
+	record.length = sizeof( *header ) + header->length;
+	writeData( dataEnd, (unsigned char*)&record, sizeof( record ));
+	writeData( dataEnd + sizeof( record ), (unsigned char*)header, sizeof( *header ));
+	writeEntry( commandNumber, dataEnd + sizeof( record ), record.length );
+	clearVerified( commandNumber );
+	indexCommand( commandNumber, header->encoding );
+
+	dataEnd += sizeof( record ) + record.length;
+	writeHeader();
+	commitWrites();
+}
+
+/* Stores a code for a command */
+uint8_t storeCommand( uint8_t commandNumber, CodeHeader *header, unsigned char *data, unsigned int len )
+{
+	unsigned int size = sizeof( StoreRecord ) + sizeof( *header ) + len;
+
+	if( sizeof( *header ) + len > STORE_MAX_LENGTH )
+		return 0;
+
+	// Make room if necessary
+	if( dataEnd + size > STORE_DATA_END && compactStore() < size )
+		return 0;
+
+	header->magic = CODE_MAGIC;
+	header->version = CODE_VERSION;
+	header->length = len;
+	header->crc = crcUpdate( headerCRC( header ), data, len );
+
+	// The code first, then the record pointing to it
+	writeData( dataEnd + sizeof( StoreRecord ) + sizeof( *header ), data, len );
+	appendRecord( commandNumber, header );
+
+	return 1;
+}
+
+/* Returns the number of bytes of a code that can be written after the end of the data area */
+static unsigned int spillRoom()
+{
+	uint32_t room = STORE_DATA_END - dataEnd;
+
+	if( room < sizeof( StoreRecord ) + sizeof( CodeHeader ))
+		return 0;
+	room -= sizeof( StoreRecord ) + sizeof( CodeHeader );
+	return (room > STORE_MAX_LENGTH - sizeof( CodeHeader )) ? STORE_MAX_LENGTH - sizeof( CodeHeader ) : room;
+}
+
+/* Returns where a code can be written directly and how long it can be. The store is only compacted by growSpill() when a code actually needs more room. */
+unsigned int beginSpill( uint32_t *address )
+{
+	*address = dataEnd + sizeof( StoreRecord ) + sizeof( CodeHeader );
+	return spillRoom();
+}
+
+/* Compacts the store and moves the part of a code written so far down to the new end of the data area */
+unsigned int growSpill( uint32_t *address, unsigned int written )
+{
+	uint32_t from = *address;
+
+	compactStore();
+	*address = dataEnd + sizeof( StoreRecord ) + sizeof( CodeHeader );
+	if( *address != from )
+		moveDown( *address, from, written );
+
+	return spillRoom();
+}
+
+/* Stores a code written at the address from beginSpill() */
+uint8_t storeSpilledCommand( uint8_t commandNumber, CodeHeader *header, unsigned int len )
+{
+	uint32_t address = dataEnd + sizeof( StoreRecord ) + sizeof( *header );
+
+	if( sizeof( *header ) + len > STORE_MAX_LENGTH || address + len > STORE_DATA_END )
+		return 0;
+
+	// The CRC is computed from what actually got written
+	header->magic = CODE_MAGIC;
+	header->version = CODE_VERSION;
+	header->length = len;
+	header->crc = crcStored( headerCRC( header ), address, len );
+	appendRecord( commandNumber, header );
+
+	return 1;
+}
+
+/* Deletes the code for a command */
+void freeCommand( uint8_t commandNumber )
+{
+	writeEntry( commandNumber, STORE_EMPTY, 0 );
+	clearVerified( commandNumber );
+	unindexCommand( commandNumber );
+}
+
+/* Moves all live records to the start of the data area */
+uint32_t compactStore()
+{
+	StoreRecord record;
+	StoreEntry entry;
+	uint32_t from = STORE_DATA_ADDRESS;
+	uint32_t to = STORE_DATA_ADDRESS;
+	unsigned int size;
+
+	while( from < dataEnd )
+	{
+		// EEPROM not answering: the store counts as full like when initStore() finds no EEPROM
+		if( !readData( from, (unsigned char*)&record, sizeof( record )))
+		{
+			dataEnd = STORE_DATA_END;
+			return 0;
+		}
+		size = sizeof( record ) + record.length;
+		if( record.length > dataEnd - from - sizeof( record ))
+			break;		// Corrupt record: drop the rest
+
+		// A record is live if its command's table entry points to it
+		lookupCommand( record.command, &entry );
+		if( entry.address == from + sizeof( record ))
+		{
+			if( to != from )
+			{
+				moveDown( to, from, size );
+				writeEntry( record.command, to + sizeof( record ), record.length );
+			}
+			to += size;
+		}
+		from += size;
+	}
+
+	dataEnd = to;
+	writeHeader();
+	commitWrites();
+
+	return STORE_DATA_END - dataEnd;
+}
@@ -0,0 +1,214 @@
+//
+//  codestore.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 28-06-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_codestore_h
+#define BLEremote_codestore_h
+
+#include "24c_eeprom.h"
+
+/**
+ @defgroup jwj_codestore Code Store
+ @brief Variable-length storage of IR codes in the EEPROM.
+
+ @code #include "codestore.h" @endcode
+
+ Code Store
+
+ Compact and compressed codes are much smaller than the 256 bytes a fixed slot takes up, so codes are stored with their actual length. The EEPROM is laid out like this:
+
+	0x0000 Header page: magic, version and end of the used data area
+	0x0080 Allocation table: one 4 byte entry (address and length) per command number
+	0x0480 Data area: records consisting of command number, length and the code itself
+
+ The data area runs to the end of the last EEPROM chip (see @link EEPROM_CHIPS @endlink), so with several chips the addresses are 32 bit. A table entry still takes 4 bytes: the top 3 bits of the length word hold bits 18:16 of the address.
+
+ Every code starts with a @link CodeHeader @endlink telling its encoding, carrier frequency, repeat information and length, and a CRC of the header and the code. So a code is read with exactly the number of bytes it has and a corrupted code is rejected before it is sent instead of being sent as garbage.
+
+ At boot initStore() reads the allocation table and the header of every code and builds an index in SRAM: one bit per command telling whether a code is stored and the encoding of the code. So commandStored() tells in a few instructions whether a command is empty, without any EEPROM access. storeCommand() and freeCommand() keep the index up to date.
+
+ Looking up a command is a single read of its table entry. New records are always appended at the end of the data area. When a command is deleted or overwritten only its table entry is changed; the old record is left as a dead record until compactStore() moves the live records down to close the gaps. Since every record carries its own command number and length, compaction is a single pass over the data area.
+
+ @note Writes go through the buffered 24C EEPROM writer. The functions return when the data has been queued; the EEPROM write cycles finish in the background.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** Number of commands in the allocation table. */
+#define STORE_COMMANDS 256
+
+/** Value for the magic number in the header page. */
+#define STORE_MAGIC 0x4952
+
+/** Version of the storage layout. */
+#define STORE_VERSION 1
+
+/** Value for the magic number in a code header. */
+#define CODE_MAGIC 0xC0DE
+
+/** Version of the code header. */
+#define CODE_VERSION 1
+
+/** Value returned by commandEncoding() for a command without a code. */
+#define STORE_ENCODING_NONE 0xFF
+
+/** Value returned by commandEncoding() for a command whose code header is not valid. */
+#define STORE_ENCODING_INVALID 0x0F
+
+/** EEPROM address of the allocation table. This is page aligned so an entry never crosses a page boundary. */
+#define STORE_TABLE_ADDRESS EEPROM_PAGE_SIZE
+
+/** Size of an allocation table entry in the EEPROM. */
+#define STORE_ENTRY_SIZE 4
+
+/** EEPROM address of the data area. */
+#define STORE_DATA_ADDRESS (STORE_TABLE_ADDRESS + STORE_COMMANDS * STORE_ENTRY_SIZE)
+
+/** End of the data area. The last byte is not used so a table entry of all 0xFF bytes is never a code. */
+#define STORE_DATA_END (EEPROM_SIZE - 1)
+
+/** Largest length of a stored code including its header. The top 3 bits of the length word in the table hold the chip number. */
+#define STORE_MAX_LENGTH 0x1FFF
+
+/** Address value for an unused command. An erased table entry reads as this. */
+#define STORE_EMPTY 0xFFFFFFFFUL
+
+/** An allocation table entry as returned by lookupCommand(). */
+typedef struct {
+	/** EEPROM address of the code or @link STORE_EMPTY @endlink */
+	uint32_t address;
+	/** Length of the code in bytes */
+	uint16_t length;
+} StoreEntry;
+
+/** Header in front of every stored code. */
+typedef struct {
+	/** Always @link CODE_MAGIC @endlink */
+	uint16_t magic;
+	/** Always @link CODE_VERSION @endlink */
+	uint8_t version;
+	/** How the code is encoded: an @link IRProtocol @endlink value – @link IRProtocol_Raw @endlink, a protocol for a compact code, @link IRProtocol_Compressed @endlink or @link IRProtocol_Macro @endlink */
+	uint8_t encoding;
+	/** Carrier frequency in kHz or 0 for the default */
+	uint8_t carrier;
+	/** Number of repeat frames */
+	uint8_t repeat;
+	/** Frame repeat period in ms or 0 if unknown */
+	uint16_t period;
+	/** Length of the code following the header */
+	uint16_t length;
+	/** CRC-16 (XMODEM) of the header fields before this one and the code */
+	uint16_t crc;
+} CodeHeader;
+
+/** Number of commands with a stored code according to the index. */
+extern uint16_t storedCommands;
+
+/** Time in ms it took initStore() to build the index. */
+extern uint16_t storeScanTime;
+
+/** Checks the header page and formats the EEPROM if it does not contain a code store – i.e. the magic or the layout version (@link STORE_VERSION @endlink) does not match. Finally the index is built.
+
+ Before formatting, the codes of the old fixed slot layout are taken over: the raw pulses in the 256 byte slot of each command are encoded like a learned code – compact, compressed or raw – and stored for the same command. A slot that does not hold 1 to 127 pulses of at most @link MAXPULSE @endlink ticks is treated as empty, so an EEPROM that never held codes is simply formatted. This reads the whole first chip and takes a few seconds on the first boot.
+
+ If the first EEPROM chip does not answer, nothing is formatted: the index is left empty and the store counts as full, so commands cannot be stored.
+
+ The index is timed with millis() so initClock() must have been called and interrupts must be enabled.
+ @param buffer A 256 byte work buffer for converting the old slots.
+ @warning The slots are overwritten while they are converted. If the power fails before the header page has been written, the conversion starts over on the next boot and slots that have been overwritten by then are dropped or may come back as garbage – learn those codes again. Codes that do not fit below the slots still to be converted (e.g. a raw code in the top slot) are dropped as well.
+ */
+void initStore( unsigned char *buffer );
+
+/** Looks up a command in the allocation table.
+ @param commandNumber The command number.
+ @param entry Pointer to a StoreEntry which receives the address and length of the code. The address is @link STORE_EMPTY @endlink if no code is stored for the command.
+ */
+void lookupCommand( uint8_t commandNumber, StoreEntry *entry );
+
+/** Checks the index for a stored code. No EEPROM access.
+ @param commandNumber The command number.
+ @return Non-zero if a code is stored for the command – even one whose header is not valid.
+ */
+uint8_t commandStored( uint8_t commandNumber );
+
+/** Gets the encoding of a stored code from the index. No EEPROM access.
+ @param commandNumber The command number.
+ @return The encoding from the code header (see @link CodeHeader @endlink), @link STORE_ENCODING_INVALID @endlink if the header is not valid or @link STORE_ENCODING_NONE @endlink if no code is stored.
+ */
+uint8_t commandEncoding( uint8_t commandNumber );
+
+/** Reads and checks the header of the code stored for a command. Returns right away for a command that is empty according to the index.
+ @param commandNumber The command number.
+ @param entry Pointer to a StoreEntry which receives the table entry. The address is @link STORE_EMPTY @endlink if no code is stored for the command.
+ @param header Pointer to a CodeHeader which receives the header.
+ @return 1 if a code with a valid header is stored. The code starts at <tt>entry->address + sizeof( CodeHeader )</tt>.
+ */
+uint8_t readCodeHeader( uint8_t commandNumber, StoreEntry *entry, CodeHeader *header );
+
+/** Checks the CRC of a code in SRAM.
+ @param header Pointer to the code header.
+ @param data Pointer to the code following the header.
+ @return 1 if the code is intact.
+ */
+uint8_t checkCode( const CodeHeader *header, const unsigned char *data );
+
+/** Checks the CRC of a stored code by reading it from the EEPROM. Used for raw codes which are streamed instead of read into SRAM. A code that has been checked once is not read again until it is replaced.
+ @param commandNumber The command number.
+ @return 1 if the code is intact.
+ */
+uint8_t verifyCommand( uint8_t commandNumber );
+
+/** Stores a code for a command. Any code already stored for the command is replaced.
+
+ If there is not enough room at the end of the data area, the store is compacted first.
+ @param commandNumber The command number.
+ @param header Pointer to the code header. The caller fills in the encoding, carrier, repeat and period fields; the rest is filled in here.
+ @param data Pointer to the code.
+ @param len Length of the code in bytes.
+ @return 1 if the code was stored or 0 if there is not enough room or the code is longer than @link STORE_MAX_LENGTH @endlink.
+ */
+uint8_t storeCommand( uint8_t commandNumber, CodeHeader *header, unsigned char *data, unsigned int len );
+
+/** Prepares for writing a code directly to the end of the data area – for codes which are too long to be collected in SRAM, such as the long codes written by learnIR(). The store is not compacted here; call growSpill() if the code turns out to need more room than is free.
+
+ Nothing else may be stored until storeSpilledCommand() has been called; a code that is abandoned is simply overwritten by the next one.
+ @param address Pointer to a variable which receives the EEPROM address to write the code to.
+ @return Number of bytes that can be written at the address.
+ */
+unsigned int beginSpill( uint32_t *address );
+
+/** Makes more room for a code being written at the address from beginSpill(). The store is compacted and the part of the code written so far is moved down to the new end of the data area.
+ @param address Pointer to the variable holding the address from beginSpill(). It receives the new address of the code.
+ @param written Number of bytes of the code written so far.
+ @return Number of bytes that can be written at the new address.
+ */
+unsigned int growSpill( uint32_t *address, unsigned int written );
+
+/** Stores a code that has been written to the address returned by beginSpill(). The CRC is computed by reading the code back from the EEPROM.
+ @param commandNumber The command number.
+ @param header Pointer to the code header. The caller fills in the encoding, carrier, repeat and period fields; the rest is filled in here.
+ @param len Length of the code in bytes.
+ @return 1 if the code was stored or 0 if it is too long.
+ */
+uint8_t storeSpilledCommand( uint8_t commandNumber, CodeHeader *header, unsigned int len );
+
+/** Deletes the code for a command. The space is reclaimed by the next compaction.
+ @param commandNumber The command number.
+ */
+void freeCommand( uint8_t commandNumber );
+
+/** Moves all live records to the start of the data area so all free space is at the end.
+ @return Number of free bytes after compaction.
+ */
+uint32_t compactStore();
+
+/**@}*/
+
+#endif
@@ -0,0 +1,121 @@
+//
+//  frame.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 16-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <stdio.h>
+#include <util/crc16.h>
+#include "serial.h"
+#include "frame.h"
+
+// Receiver states
+enum FrameStates
+{
+	Frame_Idle,
+	Frame_Length,
+	Frame_Sequence,
+	Frame_Payload,
+	Frame_CRCHigh,
+	Frame_CRCLow
+};
+
+static uint8_t frameState = Frame_Idle;
+static uint8_t payloadPos;
+static uint16_t crc;
+static uint16_t receivedCRC;
+
+unsigned char frameBuffer[ FRAME_MAX_PAYLOAD ];
+uint8_t frameLength;
+uint8_t frameSequence;
+uint16_t framesReceived;
+uint16_t frameErrors;
+
+/* Checks whether a frame is being received */
+uint8_t frameActive()
+{
+	return frameState != Frame_Idle;
+}
+
+/* Frame receiver state machine */
+uint8_t frameReceive( uint8_t c )
+{
+	switch( frameState )
+	{
+		case Frame_Idle:
+			if( c == FRAME_SYNC )
+				frameState = Frame_Length;
+			break;
+
+		case Frame_Length:
+			if( c > FRAME_MAX_PAYLOAD )
+			{
+				// Can't be a frame of ours
+				frameErrors++;
+				frameState = Frame_Idle;
+				break;
+			}
+			frameLength = c;
+			crc = _crc_xmodem_update( 0, c );
+			frameState = Frame_Sequence;
+			break;
+
+		case Frame_Sequence:
+			frameSequence = c;
+			crc = _crc_xmodem_update( crc, c );
+			payloadPos = 0;
+			frameState = frameLength ? Frame_Payload : Frame_CRCHigh;
+			break;
+
+		case Frame_Payload:
+			frameBuffer[ payloadPos++ ] = c;
+			crc = _crc_xmodem_update( crc, c );
+			if( payloadPos == frameLength )
+				frameState = Frame_CRCHigh;
+			break;
+
+		case Frame_CRCHigh:
+			receivedCRC = c << 8;
+			frameState = Frame_CRCLow;
+			break;
+
+		case Frame_CRCLow:
+			frameState = Frame_Idle;
+			if( (receivedCRC | c) != crc )
+			{
+				frameErrors++;
+				break;
+			}
+			framesReceived++;
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Sends a frame. Replies must not be lost so the transmit buffer is allowed to block. */
+void frameSend( uint8_t sequence, unsigned char *data, uint8_t len )
+{
+	uint8_t policy = txPolicy;
+	uint16_t crc;
+
+	txPolicy = TxPolicy_Block;
+
+	fputc( FRAME_SYNC, &mystdout );
+	fputc( len, &mystdout );
+	fputc( sequence, &mystdout );
+	crc = _crc_xmodem_update( 0, len );
+	crc = _crc_xmodem_update( crc, sequence );
+	for( ; len; len--, data++ )
+	{
+		fputc( *data, &mystdout );
+		crc = _crc_xmodem_update( crc, *data );
+	}
+	fputc( crc >> 8, &mystdout );
+	fputc( crc, &mystdout );
+
+	txPolicy = policy;
+}
@@ -0,0 +1,126 @@
+//
+//  frame.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 16-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_frame_h
+#define BLEremote_frame_h
+
+#include <avr/io.h>
+
+/**
+ @defgroup jwj_frame Binary Frames
+ @brief Binary framed command protocol.
+
+ @code #include "frame.h" @endcode
+
+ Binary Frames
+
+ Besides the ASCII command lines, commands can be sent in binary frames. One frame can carry many operations and is answered by a single reply frame, so a batch of commands costs one BLE round trip instead of one per command. A frame looks like this:
+
+	0xA5 (sync)
+	length of the payload (0–@link FRAME_MAX_PAYLOAD @endlink)
+	sequence number
+	payload
+	CRC-16 (XMODEM: polynomial 0x1021, initial value 0) of the length, sequence number and payload – most significant byte first
+
+ The sync byte never starts an ASCII command so the two can be mixed freely. A frame with a wrong CRC is dropped and counted in @link frameErrors @endlink; the host will not get a reply and must resend it.
+
+ The request payload is a sequence of operations. Each operation is an opcode (@link FrameOp @endlink) followed by its arguments. The reply frame has the same sequence number and contains one @link FrameStatus @endlink byte per operation – followed by the result for @link FrameOp_Query @endlink and @link FrameOp_Info @endlink. Operations are executed in order; an unknown opcode or missing arguments end the batch with @link FrameStatus_BadOp @endlink. If the results of the remaining operations would not fit in the reply frame, the batch ends with @link FrameStatus_Truncated @endlink and the host must send the operations that were not executed again. A learn operation always ends the batch the same way.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** The byte that starts a frame. */
+#define FRAME_SYNC 0xA5
+
+/** Maximum payload length of a frame. */
+#define FRAME_MAX_PAYLOAD 128
+
+/** Number of header field bytes in front of the code in a @link FrameOp_Upload @endlink operation. */
+#define FRAME_UPLOAD_HEADER 5
+
+/** Operation codes. 16 bit arguments are little endian. */
+typedef enum {
+	/** Send stored code. The code is queued and sent when the codes before it are done. Argument: command number. */
+	FrameOp_Send = 'S',
+	/** Learn code. Argument: command number. Ends the batch: any operations after it are answered with @link FrameStatus_Truncated @endlink. */
+	FrameOp_Learn = 'L',
+	/** Erase stored code. Argument: command number. */
+	FrameOp_Erase = 'E',
+	/** Send protocol code. Arguments: protocol, 16 bit address, 16 bit command, repeat. */
+	FrameOp_Protocol = 'P',
+	/** Query stored code. Argument: command number. Result: 16 bit length of the stored code (0 if none). */
+	FrameOp_Query = 'Q',
+	/** Store code. Arguments: command number, length of the rest of the arguments, encoding (an @link IRProtocol @endlink value), carrier frequency in kHz or 0, number of repeat frames, 16 bit frame repeat period in ms and the code itself (raw, compact, compressed or macro). The rest of the code header is added by the receiver. */
+	FrameOp_Upload = 'U',
+	/** Link statistics. No arguments. Result: 16 bit number of frames received and 16 bit number of frames dropped because of CRC errors. */
+	FrameOp_Info = 'I',
+	/** Abort the macro being played and all queued commands. No arguments. */
+	FrameOp_Abort = 'A',
+	/** Send stored code now: stops the code being sent and goes to the front of the send queue. Argument: command number. */
+	FrameOp_Urgent = '!',
+	/** Busy query. No arguments. Result: number of commands queued or being sent. */
+	FrameOp_Busy = 'B',
+	/** Press stored code: the code is repeated until it is released. Argument: command number. */
+	FrameOp_Press = 'H',
+	/** Release the pressed code. No arguments. */
+	FrameOp_Release = 'R'
+} FrameOp;
+
+/** Operation status values in the reply frame. */
+typedef enum {
+	/** The operation succeeded */
+	FrameStatus_OK = 0,
+	/** There is no code stored for the command */
+	FrameStatus_NotStored = 1,
+	/** Learning or storing the code failed */
+	FrameStatus_Failed = 2,
+	/** Unknown operation or missing arguments. The rest of the frame is ignored. */
+	FrameStatus_BadOp = 3,
+	/** The reply frame is full or a learn operation ended the batch. Followed by the number of operations that were executed; the rest of the frame is ignored. */
+	FrameStatus_Truncated = 4
+} FrameStatus;
+
+/** Payload of the last received frame. The buffer is free once the frame has been handled: main.c receives command lines in it. */
+extern unsigned char frameBuffer[ FRAME_MAX_PAYLOAD ];
+
+/** Payload length of the last received frame. */
+extern uint8_t frameLength;
+
+/** Sequence number of the last received frame. */
+extern uint8_t frameSequence;
+
+/** Number of valid frames received. */
+extern uint16_t framesReceived;
+
+/** Number of frames dropped because of a CRC error. */
+extern uint16_t frameErrors;
+
+/** Checks whether a frame is being received.
+ @return Non-zero if the next received byte belongs to a frame.
+ */
+uint8_t frameActive();
+
+/** Passes a received byte to the frame receiver. The first byte of a frame must be @link FRAME_SYNC @endlink.
+ @param c The received byte.
+ @return 1 if a complete and valid frame has been received. The payload is then in @link frameBuffer @endlink.
+ */
+uint8_t frameReceive( uint8_t c );
+
+/** Sends a frame.
+ @param sequence The sequence number.
+ @param data Pointer to the payload.
+ @param len Length of the payload.
+ */
+void frameSend( uint8_t sequence, unsigned char *data, uint8_t len );
+
+/**@}*/
+
+#endif
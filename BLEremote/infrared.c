@@ -9,99 +9,146 @@
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include <stdio.h>
+#include <string.h>
 #include "infrared.h"
+#include "ircompress.h"
+#include "clock.h"
 
 extern FILE mystdout;
 
-// The following variables are used when learning IR codes
 volatile unsigned int pulseDuration;
-volatile unsigned int pulseBufPr;
+
+// The following variables are used when learning IR codes
+static volatile uint16_t captureRing[ CAPTURE_RING_SIZE ];	// Edge intervals in capture timer counts
+static volatile uint8_t ringHead;	// Written by the interrupt handler only
+static volatile uint8_t ringTail;	// Written by learnIR() only
 volatile unsigned int pulseOverflow;
+static unsigned int captureTimeout;	// Number of MAXPULSE durations to wait for the initial signal
+volatile uint16_t lastEdge;			// Timer1 timestamp of the previous edge
+volatile uint8_t captureLevel;		// Pin level after the previous edge – 0 means IR is being received
+volatile uint8_t captureStarted;	// Set when the initial signal has been seen
+volatile uint8_t captureDone;		// Set by the interrupt handlers when the recording has ended
+volatile IRError captureStatus;
 
+// The following variables are used when sending IR codes
 unsigned int* pulseBuffer;
+volatile uint32_t pulseCycles;		// Timer1 cycles left of the current pulse
+IRPulseSource pulseSource;			// Supplies the pulse durations while sending
+
+uint8_t learnedCarrier;
+unsigned int learnedLength;
+uint16_t learnedStart;
 
-/* Sends a high-low pulse
- * Specify times for high duration and low duration in ms
+// The following variables are used when a long code is compressed while it is being learned
+static unsigned char *spillBuffer;		// The learn buffer: two chunks of packed symbols
+static LearnSpill spillFunction;
+static unsigned int spillSize;
+static unsigned int spillPending;		// Number of the finished chunk waiting to be written plus one or 0
+
+// Offset of the packed symbols in a long code: the header and a full timing table come first
+#define LONG_CODE_SYMBOLS (sizeof( IRCompressedHeader ) + IRCOMPRESS_MAX_WIDTHS * sizeof( unsigned int ))
+#if CARRIER_SENSE
+static volatile uint8_t carrierOverflows;	// Timer0 overflows while counting carrier pulses
+
+// Common carrier frequencies in kHz
+static const uint8_t carriers[] = { 30, 33, 36, 38, 40, 56 };
+#endif
+
+/* Sends a pulse specified as 0.01 ms durations
  */
-void sendPulseD( double highTime, double lowTime )
+void sendPulse( unsigned int highTime, unsigned int lowTime )
 {
 	IR_HIGH;
-	_delay_ms( highTime );
+	_delay_us( highTime * TICK_DURATION - TRIM );
 	IR_LOW;
-	_delay_ms( lowTime );
+	_delay_us( lowTime * TICK_DURATION - TRIM );
 }
 
-/* Sends a byte
- * LSB first
+/* Schedules the next Timer1 compare match.
+ * Timer1 runs free so the next match is simply added to the previous one which means that interrupt latency does not accumulate.
+ * Pulses longer than the 16 bit timer range are split into chunks of 32768 cycles; only the last chunk of a pulse ends with an edge.
  */
-void sendNECByte( uint8_t data )
+static inline void scheduleCompare()
 {
-	// LSB first
-	int i;
-	for( i=0; i<8; i++ )
-		if( (data >> i) & 0x01 )
-			// Send "1" bit
-			sendPulseD( 0.36, 1.48 );
-		else
-			// Send "0" bit
-			sendPulseD( 0.36, 0.36 );
+	uint16_t chunk;
+	
+	if( pulseCycles > 0xFFFF )
+		chunk = 0x8000;
+	else
+		chunk = pulseCycles;
+	
+	pulseCycles -= chunk;
+	OCR1A += chunk;
 }
 
-/* Sends the command byte
- * followed by the inverted command byte
- */
-void sendNECCommand( uint8_t data )
+/* Pulse source for sending a pulse sequence from a buffer */
+static unsigned int nextBufferPulse()
 {
-	sendNECByte( data );
-	sendNECByte( ~data );
+	return *pulseBuffer++;
 }
 
-/* JVC commands consist of a 8.4 - 4.2 ms lead-in followed by one address byte (LSB) and one command byte (LSB).
- * Logical 1 is 0.56 - 1.54 ms
- * Logical 0 is 0.56 - 0.49 ms
- *
- * Protocol description: http://www.sbprojects.com/knowledge/ir/jvc.php
- * Rotel DVD remote codes can be found here: http://www.remotecentral.com/cgi-bin/codes/rotel/rdv-1080/
- * Commands are specified as 0000 (learned) 006d (38 kHz) 0001 (one seq 1 pair) 0011 (17 seq 2 pairs – last is lead out)
- *  followed by 013e 009e (lead-in) and 0014 003c (logical 1) and 0014 0014 (logical 0).
+/* Timer-based method for sending a pulse sequence.
+ * TIMER1 is set up as a free-running counter at the CPU clock and output compare A is programmed with the width of the whole pulse.
+ * On every compare match the IR signal is toggled and the next pulse is fetched from the pulse source and scheduled – i.e. one interrupt per edge.
+ * When the pulse source returns zero, the IR is set low and the timer stopped.
  */
-void sendJVCByte( uint8_t data )
+void sendPulses( IRPulseSource source )
 {
+	pulseSource = source;
 	
+	// Set pulseDuration to first value
+	pulseDuration = pulseSource();
+	if( pulseDuration == 0 )
+		return;
+	
+	// Stop TIMER1 and schedule the end of the first pulse
+	TCCR1B = 0;
+	TCCR1A = 0;								// WGM mode 0: normal, free running
+	TCNT1 = 0;
+	OCR1A = 0;
+	pulseCycles = (uint32_t)pulseDuration * TICK_CYCLES;
+	scheduleCompare();
+	TIFR1 = (1<< OCF1A);					// Clear any stale compare match
+	TIMSK1 = (1<< OCIE1A);					// Enable output compare A match interrupt
+	
+	// IR high for the first value and start the timer
+	IR_HIGH;
+	TCCR1B = TICK_PRESCALER1;
 }
 
-/* Sends a pulse specified as 0.01 ms durations
+/* Checks whether the transmit interrupt is enabled
  */
-void sendPulse( unsigned int highTime, unsigned int lowTime )
+uint8_t isSendingIR()
 {
-	IR_HIGH;
-	_delay_us( highTime * TICK_DURATION - TRIM );
-	IR_LOW;
-	_delay_us( lowTime * TICK_DURATION - TRIM );
+	return TIMSK1 & (1<< OCIE1A);
 }
 
-/* Timer-based method for sending a command sequence.
- * TIMER1 is set up in CTC mode with the same period as when learning IR codes.
- * pulseDuration is set to the learned values and decreased on every compare match interrupt.
- * When pulseDuration is at zero, the IR signal is toggled and the data pointer is increased to next value.
- * If the pointer points to zero, the IR is set low and the timer stopped.
+/* Stops the code being sent. The carrier is switched off first so the code ends with the IR low.
+ */
+void stopIR()
+{
+	uint8_t sreg = SREG;
+	
+	cli();
+	if( TIMSK1 & (1<< OCIE1A) )
+	{
+		TIMSK1 = 0;
+		TCCR1B = 0;
+		IR_LOW;
+		pulseCycles = 0;
+	}
+	SREG = sreg;
+}
+
+/* Sends a pulse sequence from a buffer.
  */
 void sendSequence2( unsigned char *data )
 {
 	// Point to sequence data
 	pulseBuffer = (unsigned int*)data;	// Typecast to int* so increments work
-	
-	// Configure TIMER1 with the same sample interval as when learning.
-	OCR1A = TICK_OCR;						// Use same period as the sampling interval
-	TCCR1B = (1<< WGM12) | TICK_PRESCALER1;	// WGM mode 4: CTC w/ OCR1A as TOP and prescaler to match sampling interval period
-	TIMSK1 = (1<< OCIE1A);					// Enable output compare A match interrupt
-	
-	// IR high for the first value
-	IR_HIGH;
-	
-	// Set pulseDuration to first value
-	pulseDuration = *pulseBuffer++;
+	sendPulses( nextBufferPulse );
 }
 
 /* Sends a complete data sequence.
@@ -120,126 +167,386 @@ void sendSequence( unsigned char *data )
 }
 
 /* Timer1 Compare Match interrupt handler
- * This is used when sending commands.
+ * This is used when sending commands. It fires once per edge (plus once per 32768 cycles of very long pulses).
  */
 ISR( TIMER1_COMPA_vect )
 {
-	// No: decrease counter and toggle IR if we're at zero
-	if( --pulseDuration == 0 )
+	// Are we still inside a pulse that is longer than one timer period?
+	if( pulseCycles )
+	{
+		scheduleCompare();
+		return;
+	}
+	
+	IR_TOGGLE;
+	
+	// Set new duration. Duration is specified in TICK_DURATION periods.
+	pulseDuration = pulseSource();
+	
+	// Are we at end of sequence?
+	if( pulseDuration == 0 )
 	{
-		IR_TOGGLE;
+		// Yes: IR low
+		IR_LOW;
+		
+		// Stop timer
+		TIMSK1 = 0;
+		TCCR1B = 0;
+		return;
+	}
 	
-		// Set new duration. Duration is specified in TICK_DURATION periods.
-		pulseDuration = *pulseBuffer++;
+	// The tick-based handler kept every pulse but the first one for one extra tick. Keep doing that so stored codes produce the same edges.
+	pulseCycles = ((uint32_t)pulseDuration + 1) * TICK_CYCLES;
+	scheduleCompare();
+}
 
-		// Are we at end of sequence?
-		if( pulseDuration == 0 )
+/* Pin change interrupt handler for the IR sensor pin
+ * Timestamps every edge using the free-running Timer1 and stores the time since the previous edge.
+ */
+ISR( IRSENSOR_vect )
+{
+	uint16_t now = TCNT1;
+	uint8_t level = IRSENSOR_PIN & (1<< IRSENSOR_BIT);
+	uint8_t next;
+	
+	// Ignore changes on the other pins in the group and glitches too short to be seen as a level change
+	if( captureDone || level == captureLevel )
+		return;
+	captureLevel = level;
+	
+	if( captureStarted )
+	{
+		// Queue the time since the previous edge for learnIR()
+		next = (ringHead + 1) & (CAPTURE_RING_SIZE-1);
+		if( next == ringTail )
 		{
-			// Yes: IR low
-			IR_LOW;
-			
-			// Stop timer
-			TCCR1B = 0;
+			captureStatus = IRError_Overrun;
+			captureDone = 1;
+			return;
 		}
-		pulseDuration++;	// Increase pulse duration by one
+		captureRing[ ringHead ] = now - lastEdge;
+		ringHead = next;
 	}
+	else if( level == 0 )
+		// The first edge (pin LOW: signal received) only starts the recording
+		captureStarted = 1;
+	else
+		// Pin went HIGH before we have seen a start: we started in the middle of a signal
+		return;
+	
+	// Move the timeout to MAXPULSE after this edge. A match of the old timeout may be pending if the edge came just as it ran out – it must not end the recording.
+	lastEdge = now;
+	OCR1B = now + CAPTURE_MAXPULSE;
+	TIFR1 = (1<< OCF1B);
 }
 
-/* Timer0 Compare Match interrupt handler
+/* Timer1 Compare Match B interrupt handler
+ * This is used when learning: no edge has been seen for MAXPULSE ticks.
  */
-ISR( TIMER0_COMPA_vect )
+ISR( TIMER1_COMPB_vect )
 {
-	// Increase pulse duration
-	pulseDuration++;
+	// learnIR() may have ended the recording already
+	if( captureDone )
+		return;
 	
-	// Check for pulse duration overflow
-	if( pulseDuration >= MAXPULSE )
+	// Still waiting for the initial signal?
+	if( !captureStarted )
 	{
-		pulseOverflow++;
-		pulseDuration = 0;
+		OCR1B += CAPTURE_MAXPULSE;
+		if( ++pulseOverflow < captureTimeout )
+			return;
+		captureStatus = IRError_NoSignal;
 	}
+	else if( captureLevel == 0 )
+		// HIGH signal too long
+		captureStatus = IRError_HighPulseTooLong;
+	else
+		// LOW overflow is interpreted as "signal end"
+		captureStatus = IRError_NoError;
+	
+	captureDone = 1;
 }
 
-/* Record an IR signal and store it in the specified data buffer
- */
-IRError learnIR( unsigned char *data )
+#if CARRIER_SENSE
+/* Timer0 overflow interrupt handler: only used while counting carrier pulses */
+ISR( TIMER0_OVF_vect )
 {
-	unsigned int *ptr = (unsigned int*)data;	// Typecast to unsigned int*
+	carrierOverflows++;
+}
+
+/* Computes the carrier frequency from the number of carrier pulses and the total mark time of the learned code */
+static uint8_t measureCarrier( uint32_t pulses, uint32_t markTicks )
+{
+	unsigned int kHz;
+	uint8_t j;
+
+	if( markTicks == 0 || pulses == 0 )
+		return 0;
+
+	// The receiver module stretches the marks a little so snap to the nearest common frequency
+	kHz = (pulses * 1000 + markTicks * TICK_DURATION / 2) / (markTicks * TICK_DURATION);
+	for( j = 0; j < sizeof( carriers ); j++ )
+		if( kHz * 10 >= carriers[j] * 9 && kHz * 10 <= carriers[j] * 11 )
+			return carriers[j];
+
+	return (kHz < 20 || kHz > 100) ? 0 : kHz;
+}
+#endif
+
+/* Ends the recording from learnIR() unless the interrupt handlers have ended it already */
+static void endCapture( IRError status )
+{
+	cli();
+	if( !captureDone )
+	{
+		captureStatus = status;
+		captureDone = 1;
+	}
+	sei();
+}
+
+/* Writes a chunk of packed symbols of a long code. Returns 0 if the spill function has run out of room. */
+static uint8_t writeChunk( unsigned int chunk )
+{
+	return spillFunction( LONG_CODE_SYMBOLS + chunk * LEARN_SPILL_CHUNK, spillBuffer + (chunk & 1) * LEARN_SPILL_CHUNK, LEARN_SPILL_CHUNK );
+}
+
+/* Compresses pulse number k of a long code and puts its symbol in the learn buffer. Returns 0 if the code doesn't fit. */
+static uint8_t addSymbol( IRCompressor *compressor, unsigned int k, unsigned int width )
+{
+	unsigned int pos = k / 2;		// Two symbols per byte, the first one in the low nibble
+	uint8_t symbol = compressPulse( compressor, width );
 	
-	IRError status = IRError_NoError;
+	if( symbol == 0xFF || LONG_CODE_SYMBOLS + pos >= spillSize )
+		return 0;
 	
-	DDRD |= (1<< PD6);	// PD6/OC0A -> output
-	DDRB |= (1<< PB1);	// PB1/OC1A -> output
+	if( k & 1 )
+	{
+		spillBuffer[ pos % (2 * LEARN_SPILL_CHUNK) ] |= symbol << 4;
+		return 1;
+	}
 	
-	// Initialize Timer0 for the specified sample interval (we're not sending IR codes while we're learning so we might as well use the same timer instead of hogging one more timer).
-	TCCR0A = (1<< WGM01);		// CTC mode
-	TCCR0B = TICK_PRESCALER;	// Start with prescaler 1
-	OCR0A = TICK_OCR;			// Sample interval
-	TIMSK0 = (1<< OCIE0A);		// Enable OCRA interrupt 
-	sei();
+	// Starting a new chunk: the previous one is finished. It is written at the next gap in the signal – or now if the one before it still hasn't been written.
+	if( pos && pos % LEARN_SPILL_CHUNK == 0 )
+	{
+		if( spillPending && !writeChunk( spillPending - 1 ))
+			return 0;
+		spillPending = pos / LEARN_SPILL_CHUNK;
+	}
+	spillBuffer[ pos % (2 * LEARN_SPILL_CHUNK) ] = symbol;
+	return 1;
+}
+
+/* Writes the rest of a long code and its header. Returns the length of the code or 0 if the spill function has run out of room. */
+static unsigned int finishLongCode( IRCompressor *compressor, unsigned int count )
+{
+	IRCompressedHeader header;
+	unsigned int bytes = (count + 1) / 2;
+	unsigned int last = (bytes - 1) / LEARN_SPILL_CHUNK;
+	
+	if( spillPending && !writeChunk( spillPending - 1 ))
+		return 0;
+	if( !spillFunction( LONG_CODE_SYMBOLS + last * LEARN_SPILL_CHUNK, spillBuffer + (last & 1) * LEARN_SPILL_CHUNK, bytes - last * LEARN_SPILL_CHUNK ))
+		return 0;
+	
+	// Header and a full timing table. The unused entries are never referenced.
+	header.marker = IRCODE_MARKER;
+	header.protocol = IRProtocol_Compressed;
+	header.tableSize = IRCOMPRESS_MAX_WIDTHS;
+	header.symbolBits = 4;
+	header.pulseCount = count;
+	memset( compressor->table + compressor->tableSize, 0, (IRCOMPRESS_MAX_WIDTHS - compressor->tableSize) * sizeof( unsigned int ));
+	memcpy( spillBuffer, &header, sizeof( header ));
+	memcpy( spillBuffer + sizeof( header ), compressor->table, IRCOMPRESS_MAX_WIDTHS * sizeof( unsigned int ));
+	if( !spillFunction( 0, spillBuffer, LONG_CODE_SYMBOLS ))
+		return 0;
+	
+	return LONG_CODE_SYMBOLS + bytes;
+}
+
+/* Record an IR signal and store it in the specified data buffer – or compress it and write it through the spill function if it is too long
+ */
+IRError learnIR( unsigned char *data, LearnSpill spill, unsigned int size, unsigned int timeout )
+{
+	unsigned int *pulses = (unsigned int*)data;
+	IRCompressor compressor;
+	unsigned int count = 0;
+	unsigned int width, i;
+	uint16_t gap;
+	uint8_t started = 0;
+#if CARRIER_SENSE
+	uint32_t carrierPulses;
+	uint32_t markTicks = 0;
+#endif
 	
 	// Init
-	pulseDuration = 0;
-	pulseBufPr = 0;
+	ringHead = 0;
+	ringTail = 0;
 	pulseOverflow = 0;
+	captureTimeout = timeout;
+	captureLevel = IRSENSOR_PIN & (1<< IRSENSOR_BIT);
+	captureStarted = 0;
+	captureDone = 0;
+	learnedCarrier = 0;
+	learnedLength = 0;
+	spillBuffer = data;
+	spillFunction = spill;
+	spillSize = size;
+	spillPending = 0;
 	
-	// Wait for initial signal
-	while( (IRSENSOR_PIN & (1<< IRSENSOR_BIT)) && pulseOverflow < TIMEOUT_COUNT )
-		;
-
-	// Check for timeout
-	if( pulseOverflow >= TIMEOUT_COUNT )
-	{
-		status = IRError_NoSignal;
-		goto done;
-	}
-
-	while( 1 )
+#if CARRIER_SENSE
+	// Count the raw sensor's carrier pulses on T0 instead of generating the carrier
+	TCCR0A = 0;
+	TCCR0B = (1<< CS02) | (1<< CS01) | (1<< CS00);		// External clock on T0, rising edge
+	TCNT0 = 0;
+	carrierOverflows = 0;
+	TIFR0 = (1<< TOV0);
+	TIMSK0 = (1<< TOIE0);
+#endif
+	
+	// Initialize Timer1 as a free-running timestamp counter and use compare B for timeouts
+	TCCR1B = 0;
+	TCCR1A = 0;											// WGM mode 0: normal, free running
+	TCNT1 = 0;
+	OCR1B = CAPTURE_MAXPULSE;
+	TIFR1 = (1<< OCF1B);								// Clear any stale compare match
+	TIMSK1 = (1<< OCIE1B);								// Enable output compare B match interrupt
+	TCCR1B = CAPTURE_PRESCALER;
+	
+	// Enable pin change interrupt for the IR sensor
+	IRSENSOR_PCMSK |= (1<< IRSENSOR_PCINT);
+	PCIFR = (1<< IRSENSOR_PCIE);
+	PCICR |= (1<< IRSENSOR_PCIE);
+	set_sleep_mode( SLEEP_MODE_IDLE );					// Idle keeps Timer0, Timer1, Timer2 and the pin change interrupt running
+	sei();
+	
+	// Take the edges from the interrupt handler until the recording has ended
+	for( ;; )
 	{
-		// Wait for LOW pulse (=pin HIGH) or pulse overflow
-		cli();
-		pulseDuration = 0;
-		pulseOverflow = 0;
-		sei();
-		while( (IRSENSOR_PIN & (1<< IRSENSOR_BIT)) == 0 && pulseOverflow == 0 )
-			;
+		if( ringTail == ringHead )
+		{
+			if( captureDone )
+				break;
+			
+			// Note the time of the first edge – the loop gets here right after it
+			if( captureStarted && !started )
+			{
+				learnedStart = millis();
+				started = 1;
+			}
+			
+			// Nothing received: write a finished chunk of a long code if the signal has a gap now
+			if( spillPending )
+			{
+				cli();
+				gap = TCNT1 - lastEdge;
+				sei();
+				if( gap >= LEARN_SPILL_GAP )
+				{
+					if( !writeChunk( spillPending - 1 ))
+						endCapture( IRError_SigTooLong );
+					spillPending = 0;
+				}
+				
+				// Keep polling: sleeping until the next millisecond tick would use up half of the gap the chunk is written in
+				continue;
+			}
+			
+			// Sleep until the next edge, timeout or clock tick. Interrupts are disabled for the check so an edge after it still wakes us: sleep_cpu() is executed before any pending interrupt.
+			cli();
+			if( ringTail == ringHead && !captureDone )
+			{
+				sleep_enable();
+				sei();
+				sleep_cpu();
+				sleep_disable();
+			}
+			sei();
+			continue;
+		}
 		
-		if( pulseOverflow > 0 )
+		// Scale the timestamp difference to ticks (rounded to nearest). A 0 would end the code.
+		width = ((uint32_t)captureRing[ ringTail ] * CAPTURE_DIVIDER + TICK_CYCLES/2) / TICK_CYCLES;
+		ringTail = (ringTail + 1) & (CAPTURE_RING_SIZE-1);
+		if( width == 0 )
+			width = 1;
+#if CARRIER_SENSE
+		if( !(count & 1) )
+			markTicks += width;
+#endif
+		
+		if( count < LEARN_MAX_PULSES )
 		{
-			// HIGH signal too long to store in one byte
-			status = IRError_HighPulseTooLong;
-			goto done;
+			pulses[ count++ ] = width;
+			continue;
 		}
-
-		// Store HIGH value
-		ptr[ pulseBufPr++ ] = pulseDuration;
 		
-		// Wait for HIGH pulse (=pin LOW) or pulse overflow
-		cli();
-		pulseDuration = 0;
-		sei();
-		while( (IRSENSOR_PIN & (1<< IRSENSOR_BIT)) && pulseOverflow == 0 )
-			;
+		if( count == LEARN_MAX_PULSES )
+		{
+			// Too long for the buffer: compress the pulses so far in place (a symbol never overwrites a pulse not yet read) and the rest as they arrive
+			if( !spill )
+			{
+				endCapture( IRError_SigTooLong );
+				break;
+			}
+			initCompressor( &compressor );
+			for( i = 0; i < count; i++ )
+				if( !addSymbol( &compressor, i, pulses[i] ))
+					break;
+			if( i < count )
+			{
+				endCapture( IRError_SigTooLong );
+				break;
+			}
+		}
 		
-		if( pulseOverflow > 0 )
+		if( !addSymbol( &compressor, count++, width ))
 		{
-			// LOW overflow is interpreted as "signal end"
+			endCapture( IRError_SigTooLong );
 			break;
-			goto done;
 		}
-		
-		// Store LOW value
-		ptr[ pulseBufPr++ ] = pulseDuration;
 	}
 	
-	// Terminate with 0
-	ptr[ pulseBufPr ] = 0;
+	// Stop capturing
+	PCICR &= ~(1<< IRSENSOR_PCIE);
+	IRSENSOR_PCMSK &= ~(1<< IRSENSOR_PCINT);
+	TIMSK1 = 0;
+	TCCR1B = 0;
+#if CARRIER_SENSE
+	TCCR0B = 0;
+	TIMSK0 = 0;
+	carrierPulses = ((uint32_t)carrierOverflows << 8) | TCNT0;
+	if( TIFR0 & (1<< TOV0) )
+		carrierPulses += 256;		// Overflow after the interrupt was disabled
+	initIR();				// Back to generating the carrier
+#endif
+	
+	if( captureStatus == IRError_NoError )
+	{
+		// Terminate a short code with 0. A long code gets its header.
+		if( count <= LEARN_MAX_PULSES )
+			pulses[ count ] = 0;
+		else if( (learnedLength = finishLongCode( &compressor, count )) == 0 )
+			captureStatus = IRError_SigTooLong;
+#if CARRIER_SENSE
+		learnedCarrier = measureCarrier( carrierPulses, markTicks );
+#endif
+	}
+	
+	return captureStatus;
+}
+
+/* Sets the carrier frequency. Timer0 runs at F_CPU/8 so the period is rounded to 0.67 µs. */
+void setCarrier( uint8_t kHz )
+{
+	uint8_t top;
 
-done:
-	// Re-initialize for IR sending
-	initIR();
+	if( kHz < 20 || kHz > 100 )
+		kHz = CARRIER_DEFAULT;
 
-	return status;
+	top = (F_CPU / 8 / 1000 + kHz/2) / kHz - 1;
+	OCR0A = top;
+	OCR0B = (top + 1) / 3;
 }
 
 /* Initializes the PWM timer */
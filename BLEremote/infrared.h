@@ -19,7 +19,9 @@
  
  These functions send the IR codes as sequences of on-off pulses.
  
- Timer0 is used to generate a 38 kHz PWM signal with a duty cycle of 1/3 on the OC0B (PD5) pin.
+ Timer0 is used to generate a 38 kHz PWM signal with a duty cycle of 1/3 on the OC0B (PD5) pin. The carrier frequency can be changed per code with setCarrier().
+ 
+ IR receiver modules remove the carrier so learnIR() can't see it. If a raw IR photodiode/phototransistor is connected to the T0 (PD4) pin and @link CARRIER_SENSE @endlink is set, Timer0 counts its pulses while learning and the carrier frequency is stored in @link learnedCarrier @endlink.
  
  Calculate the correct OCR0A and prescaler values at http://www.et06.dk/atmega_timers/.
  @see OCR0A_VALUE
@@ -49,6 +51,12 @@
 /** Define the prescaler flags to match the OCR0A value for a PWM frequency of 38 kHz. Values can be calculated here: http://www.et06.dk/atmega_timers/ */
 #define PRESCALER_FLAGS (1<< CS01)
 
+/** Default carrier frequency in kHz. */
+#define CARRIER_DEFAULT 38
+
+/** Set to 1 if a raw (not demodulating) IR sensor is connected to the T0 (PD4) pin so the carrier frequency can be measured while learning. */
+#define CARRIER_SENSE 0
+
 /** The trim value is a number that is _subtracted_ from the specified time durations in order to compensate for the extra CPU cycles used in control loops etc. This value is really best determined by measuring the on/off times on an oscilloscope and adjusting the value (higher values = shorter durations) until the measured duration matches the specified duration. */
 #define TRIM 0
 
@@ -62,50 +70,92 @@
  */
 #define IRSENSOR_BIT PB2
 
-/** Maximum number of ticks (one tick equals TICK_DURATION µs for either a HIGH or LOW pulse. */
+/** The pin change mask register for the IR input pin. Configure this to match IRSENSOR_PIN.
+ @see IRSENSOR_PCINT
+ */
+#define IRSENSOR_PCMSK PCMSK0
+
+/** The pin change interrupt bit for the IR input pin. Configure this to match IRSENSOR_BIT.
+ @see IRSENSOR_PCMSK
+ */
+#define IRSENSOR_PCINT PCINT2
+
+/** The pin change interrupt enable bit (in PCICR) for the pin group containing the IR input pin. */
+#define IRSENSOR_PCIE PCIE0
+
+/** The pin change interrupt vector for the pin group containing the IR input pin. */
+#define IRSENSOR_vect PCINT0_vect
+
+/** Maximum number of ticks (one tick equals TICK_DURATION µs) for either a HIGH or LOW pulse. */
 #define MAXPULSE 5000
 
-/** Sample period length in microseconds. At every tick the IR input signal is sampled. This must correspond to the @link TICK_OCR @endlink value. */
+/** Tick length in microseconds. Pulse durations are stored in ticks. This must correspond to the @link TICK_OCR @endlink value. */
 #define TICK_DURATION 5
 
-/** Number of MAXPULSE durations allowed until timeout occurs. This is used when waiting for the initial signal. If a time equal to TIMEOUT_COUNT * MAXPULSE * TICK_DURATION microseconds passes, a timeout occurs. */
+/** Number of MAXPULSE durations allowed until timeout occurs. This is used when waiting for the initial signal. If a time equal to TIMEOUT_COUNT * MAXPULSE * TICK_DURATION microseconds passes, a timeout occurs. Pass this to learnIR() unless a shorter wait is wanted. */
 #define TIMEOUT_COUNT 400
 
-/** Output compare value for the 8 bit Timer0 to match the TICK_DURATION. Values can be calculated here: http://www.et06.dk/atmega_timers/
+/** Length of one tick in CPU cycles minus one. Stored codes use TICK_OCR+1 cycles per tick since the original sampling timer ran in CTC mode with this value as TOP. Values can be calculated here: http://www.et06.dk/atmega_timers/
  */
 #define TICK_OCR 0x3C
 
-/** Prescaler for the TICK_OCR value to match the TICK_DURATION.
+/** Number of CPU cycles in one tick.
+ When sending and learning, pulse durations are converted between Timer1 counts and ticks using this value so the transmitted edges match the learned ones exactly.
  */
-#define TICK_PRESCALER (1<< CS00)
+#define TICK_CYCLES (TICK_OCR + 1)
 
-/** Prescaler for TIMER1. TICK_OCR is used both for TIMER0 (when learning) and TIMER1 (when sending).
+/** Prescaler for TIMER1. Timer1 runs free at the CPU clock when sending and the compare match is scheduled one whole pulse ahead.
  */
 #define TICK_PRESCALER1 (1<< CS10)
 
+/** Prescaler for TIMER1 when learning. Timer1 runs free and is used as a timestamp counter for the edges of the IR signal.
+ At 12 MHz this gives a resolution of 0.67 µs and the counter wraps every 43.7 ms which is longer than the longest pulse we accept (MAXPULSE).
+ @see CAPTURE_DIVIDER
+ */
+#define CAPTURE_PRESCALER (1<< CS11)
+
+/** The division factor matching CAPTURE_PRESCALER. */
+#define CAPTURE_DIVIDER 8
+
+/** MAXPULSE converted to capture timer counts. */
+#define CAPTURE_MAXPULSE ((uint16_t)((uint32_t)MAXPULSE * TICK_CYCLES / CAPTURE_DIVIDER))
+
+/** Number of edges the capture interrupt handler can buffer before learnIR() takes them. Must be a power of 2 and no larger than 256. */
+#define CAPTURE_RING_SIZE 32
+
+/** Number of pulses that fit in the learn buffer as raw durations – 256 bytes including the 0 terminator. Longer codes are compressed while they are being received. */
+#define LEARN_MAX_PULSES 127
+
+/** A long code is written to the EEPROM only when no edge has been seen for this number of capture timer counts (2 ms) – so the EEPROM traffic happens in the gaps of the signal. */
+#define LEARN_SPILL_GAP ((uint16_t)(2000UL * (F_CPU / 1000000UL) / CAPTURE_DIVIDER))
+
+/** Number of bytes of a long code that learnIR() collects before writing them to the EEPROM. Matches the EEPROM page size. */
+#define LEARN_SPILL_CHUNK 128
+
 /** Error codes for the learnIR() function
  */
 typedef enum {
 	/** No error - operation suceeded */
 	IRError_NoError = 0,
-	/** The signal length exceeds 64 byte pairs and so cannot fit in the 256 byte data buffer */
+	/** The signal does not fit: it is longer than @link LEARN_MAX_PULSES @endlink pulses and there is no room in the EEPROM for it or it has more than @link IRCOMPRESS_MAX_WIDTHS @endlink different pulse widths */
 	IRError_SigTooLong = 1,
 	/** No signal was detected */
 	IRError_NoSignal = 2,
 	/** A HIGH pulse duration exceeded 25 ms */
 	IRError_HighPulseTooLong = 3,
 	/** A LOW pulse duration exceeded 25 ms */
-	IRError_LowPulseTooLong = 4
+	IRError_LowPulseTooLong = 4,
+	/** The edges came faster than they could be processed */
+	IRError_Overrun = 5
 } IRError;
 
-/** Sends an on-off pulse.
- @param highTime Time in milliseconds for the *ON* part of the pulse.
- @param lowTime Time in milliseconds for the *OFF* part of the pulse.
- 
- This method uses `double` parameters for the time specification.
- @see sendPulse
+/** A function called by learnIR() to write a part of a long code to the EEPROM.
+ @param offset Offset of the data from the start of the code.
+ @param data Pointer to the data.
+ @param len Number of bytes.
+ @return 1 if the data was written or 0 if there is no room for it – which ends the learning with @link IRError_SigTooLong @endlink.
  */
-void sendPulseD( double highTime, double lowTime );
+typedef uint8_t (*LearnSpill)( unsigned int offset, unsigned char *data, uint8_t len );
 
 /** Sends an on-off pulse.
  @param highTime Time in 100 µs for the *ON* part of the pulse.
@@ -113,23 +163,9 @@ void sendPulseD( double highTime, double lowTime );
  
  This method uses byte integer parameters for the time specification. The times are in 100 µs. Thus, a value of 16 will translate to 1.6 ms.
  Maximum duration for either on or off is 25.5 ms.
- 
- @see sendPulseD
  */
 void sendPulse( unsigned int highTime, unsigned int lowTime );
 
-/** Sends a NEC1 byte.
- @deprecated Not up-to-date: timing has been manually trimmed.
- */
-void sendNECByte( uint8_t data );
-
-/** Sends a NEC1 command byte.
- 
- Sends the byte followed by the inverted byte.
- @deprecated Not up-to-date: timing has been manually trimmed.
- */
-void sendNECCommand( uint8_t data );
-
 /** Sends a IR pulse sequence
  
  The IR data passed in the `data` parameter must consist of an array of byte pairs terminated by 0x00.
@@ -142,23 +178,81 @@ void sendNECCommand( uint8_t data );
  */
 void sendSequence( unsigned char *data );
 
+/** A function supplying pulse durations to the transmit interrupt handler.
+ 
+ The function is called once for every edge – from the Timer1 interrupt handler, except for the first pulse – and must return the duration of the next pulse in ticks. Pulses alternate between ON and OFF starting with ON. Return 0 to end the sequence.
+ @see sendPulses
+ */
+typedef unsigned int (*IRPulseSource)( void );
+
+/** Sends an IR pulse sequence in the background using Timer1.
+ 
+ Timer1 runs free and the output compare register is programmed with the width of each whole pulse, so there is only one interrupt per edge. Pulses longer than the 16 bit timer range are split into a few extra compare periods.
+ 
+ The function returns as soon as the first pulse has been started.
+ @param source The function supplying the pulse durations.
+ @see TICK_CYCLES
+ */
+void sendPulses( IRPulseSource source );
+
+/** Sends an IR pulse sequence from a buffer in the background using Timer1.
+ 
+ The IR data passed in the `data` parameter must be an array of 16 bit ON and OFF durations in ticks (@link TICK_DURATION @endlink µs) terminated by a 0 value – i.e. the format produced by learnIR().
+ 
+ The function returns as soon as the first pulse has been started. The buffer must remain untouched until the sequence has been sent.
+ @param data A pointer to a 0 terminated array of 16 bit pulse durations.
+ @see sendPulses
+ */
 void sendSequence2( unsigned char *data );
 
+/** Carrier frequency in kHz measured by the last learnIR() call or 0 if it could not be measured. Measurements are rounded to the nearest common carrier frequency (30, 33, 36, 38, 40 or 56 kHz) if within 10%.
+ @see CARRIER_SENSE
+ */
+extern uint8_t learnedCarrier;
+
+/** Length in bytes of the compressed code written through the spill function by the last learnIR() call or 0 if the code is in the data buffer. */
+extern unsigned int learnedLength;
+
+/** millis() at the first edge of the signal recorded by the last learnIR() call. */
+extern uint16_t learnedStart;
+
+/** Sets the carrier frequency for the following codes. The duty cycle remains 1/3.
+ @param kHz Carrier frequency in kHz (20–100) or 0 for @link CARRIER_DEFAULT @endlink.
+ */
+void setCarrier( uint8_t kHz );
+
+/** Checks whether an IR sequence is being sent in the background.
+ @return Non-zero while the transmit interrupt handler is running.
+ */
+uint8_t isSendingIR();
+
+/** Stops the IR sequence being sent in the background. Does nothing if nothing is being sent.
+ */
+void stopIR();
+
 /** Initializes Timer0 for 38 kHz PWM.
  @note Pin OC0B (PD5) is configured as output and used for the PWM signal.
  */
 void initIR();
 
-/** Reads an IR code and stores the on-off time pairs in the specified data buffer.
+/** Reads an IR code and stores the on-off pulse durations in the specified data buffer.
+ 
+ The signal will be stored as 16 bit values where the first value is ON time in ticks (@link TICK_DURATION @endlink µs), the second value is OFF time and so on. The sequence is terminated by a 0 value.
+ 
+ Every edge of the signal is timestamped by a pin change interrupt reading the free-running Timer1 (@link CAPTURE_PRESCALER @endlink) and put in a small ring buffer. learnIR() takes the edges out while the signal is being received and scales them to ticks. While the ring buffer is empty the CPU sleeps in idle mode until the next interrupt – unless a chunk of a long code is waiting for a gap in the signal, which is polled for.
  
- The signal will be stored as byte pairs where the first byte is ON time in 0.1 ms and the second byte is OFF time in 0.1 ms. The sequence is terminated by a 0x00 byte.
+ Air conditioner and projector remotes send hundreds of pulses. When a signal gets longer than @link LEARN_MAX_PULSES @endlink, the pulses received so far are compressed in place and the rest are compressed as they arrive (see compressPulse()). The compressed code is collected in the data buffer and written through the spill function in @link LEARN_SPILL_CHUNK @endlink byte chunks when the signal has a gap, so the length of a code is limited by the EEPROM and not by SRAM. The result has the format of compressIR() with 4 bit symbols and a full 16 entry timing table; its length is put in @link learnedLength @endlink.
  
- If the signal length exceeds 128 bytes, an @link IRError_SigTooLong @endlink is returned.
- @param data A pointer to 128 bytes large memory block for storing the recorded IR signal.
+ If the signal doesn't fit, @link IRError_SigTooLong @endlink is returned.
+ @note Timer1 is used while learning so no IR code can be sent at the same time.
+ @param data A pointer to a 256 byte memory block for storing the recorded IR signal.
+ @param spill Function writing a long code to the EEPROM or 0 to allow only @link LEARN_MAX_PULSES @endlink pulses.
+ @param spillSize Largest number of bytes a long code may take. The spill function can still run out of room before that.
+ @param timeout Number of MAXPULSE durations to wait for the signal to start – @link TIMEOUT_COUNT @endlink for 10 s.
  @return 0 if a valid signal was recorded. Otherwise a @link IRError @endlink value is returned.
- @retval 0 A valid signal was recorded and stored in the data buffer.
+ @retval 0 A valid signal was recorded and stored in the data buffer or written through the spill function.
  */ 
-IRError learnIR( unsigned char *data );
+IRError learnIR( unsigned char *data, LearnSpill spill, unsigned int spillSize, unsigned int timeout );
 
 /**@}*/
 
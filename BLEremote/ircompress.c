@@ -0,0 +1,194 @@
+//
+//  ircompress.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 21-06-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <string.h>
+#include "ircompress.h"
+
+// The following variables are used when sending compressed codes
+static const unsigned int *widthTable;
+static const unsigned char *symbolPtr;
+static unsigned int symbolsLeft;
+static uint8_t symbolBits;
+static uint8_t symbolShift;
+static const unsigned char *frameStart;	// First symbol of the code – where every repeat frame starts
+static uint8_t framesLeft;				// Repeat frames still to be sent
+static uint32_t framePeriod;			// Frame repeat period in ticks
+static uint32_t frameTime;				// Ticks sent of the current frame
+static unsigned int framePulses;
+
+/* Returns the index of the table entry closest to the specified width */
+static uint8_t nearestWidth( const unsigned int *table, uint8_t tableSize, unsigned int width )
+{
+	uint8_t i, best = 0;
+	unsigned int diff, bestDiff = 0xFFFF;
+
+	for( i = 0; i < tableSize; i++ )
+	{
+		diff = (width > table[i]) ? width - table[i] : table[i] - width;
+		if( diff < bestDiff )
+		{
+			bestDiff = diff;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+/* Starts an on-the-fly compression */
+void initCompressor( IRCompressor *compressor )
+{
+	compressor->tableSize = 0;
+}
+
+/* Adds a pulse to the timing table and returns its symbol. Every table entry is the running average of its members. */
+uint8_t compressPulse( IRCompressor *compressor, unsigned int width )
+{
+	unsigned int *table = compressor->table;
+	uint8_t n = nearestWidth( table, compressor->tableSize, width );
+
+	if( compressor->tableSize && width + table[n]/8 + IR_US( 60 ) >= table[n] && width <= table[n] + table[n]/8 + IR_US( 60 ))
+	{
+		if( compressor->members[n] < 0xFF )
+			compressor->members[n]++;
+		table[n] += ((long)width - (long)table[n]) / compressor->members[n];
+		return n;
+	}
+	if( compressor->tableSize < IRCOMPRESS_MAX_WIDTHS )
+	{
+		n = compressor->tableSize++;
+		table[n] = width;
+		compressor->members[n] = 1;
+		return n;
+	}
+	return 0xFF;
+}
+
+/* Compresses a raw IR code in place */
+unsigned int compressIR( unsigned char *data )
+{
+	unsigned int *pulses = (unsigned int*)data;
+	IRCompressor compressor;
+	unsigned int *table = compressor.table;
+	uint8_t tableSize;
+	uint8_t bits, n;
+	unsigned int count, k, packedSize, tableBytes;
+	IRCompressedHeader header;
+
+	// Cluster the pulse widths
+	initCompressor( &compressor );
+	for( count = 0; pulses[ count ]; count++ )
+		if( compressPulse( &compressor, pulses[ count ] ) == 0xFF )
+			return 0;
+	tableSize = compressor.tableSize;
+
+	if( count == 0 )
+		return 0;
+
+	bits = (tableSize <= 2) ? 1 : (tableSize <= 4) ? 2 : 4;
+	packedSize = (count * bits + 7) / 8;
+	tableBytes = tableSize * sizeof( unsigned int );
+
+	// Replace the pulses by packed symbols from the start of the buffer. A symbol is never written beyond the pulse being read.
+	for( k = 0; k < count; k++ )
+	{
+		n = nearestWidth( table, tableSize, pulses[k] );
+		if( (k * bits) % 8 == 0 )
+			data[ k*bits/8 ] = n;
+		else
+			data[ k*bits/8 ] |= n << ((k * bits) % 8);
+	}
+
+	// Make room for the header and the table
+	memmove( data + sizeof( header ) + tableBytes, data, packedSize );
+
+	header.marker = IRCODE_MARKER;
+	header.protocol = IRProtocol_Compressed;
+	header.tableSize = tableSize;
+	header.symbolBits = bits;
+	header.pulseCount = count;
+	memcpy( data, &header, sizeof( header ));
+	memcpy( data + sizeof( header ), table, tableBytes );
+
+	return sizeof( header ) + tableBytes + packedSize;
+}
+
+/* Returns the total size of a compressed code */
+unsigned int compressedIRSize( const unsigned char *data )
+{
+	IRCompressedHeader header;
+
+	memcpy( &header, data, sizeof( header ));
+	return sizeof( header ) + header.tableSize * sizeof( unsigned int ) + (header.pulseCount * header.symbolBits + 7) / 8;
+}
+
+/* Pulse source for the transmit interrupt handler: unpacks the next symbol and looks up its width.
+ * After the last pulse of a frame, the gap up to the frame period is returned and the code is started over if there are repeat frames left.
+ */
+static unsigned int nextCompressedPulse()
+{
+	uint8_t symbol;
+	unsigned int width;
+
+	if( symbolsLeft == 0 )
+	{
+		if( framesLeft == 0 )
+			return 0;
+		framesLeft--;
+		symbolPtr = frameStart;
+		symbolShift = 0;
+		symbolsLeft = framePulses;
+
+		// The frame ended with a mark so the gap is the rest of the period
+		if( frameTime >= framePeriod )
+			width = IRCOMPRESS_FRAME_GAP;
+		else if( framePeriod - frameTime > 0xFFFF )
+			width = 0xFFFF;
+		else
+			width = framePeriod - frameTime;
+		frameTime = 0;
+		return width;
+	}
+	symbolsLeft--;
+
+	symbol = (*symbolPtr >> symbolShift) & ((1 << symbolBits) - 1);
+	symbolShift += symbolBits;
+	if( symbolShift == 8 )
+	{
+		symbolShift = 0;
+		symbolPtr++;
+	}
+
+	width = widthTable[ symbol ];
+	frameTime += width;
+	return width;
+}
+
+/* Starts sending a compressed IR code */
+void sendCompressedIR( const unsigned char *data, uint8_t repeat, uint16_t period )
+{
+	IRCompressedHeader header;
+
+	memcpy( &header, data, sizeof( header ));
+
+	widthTable = (const unsigned int*)(data + sizeof( header ));
+	symbolPtr = data + sizeof( header ) + header.tableSize * sizeof( unsigned int );
+	symbolsLeft = header.pulseCount;
+	symbolBits = header.symbolBits;
+	symbolShift = 0;
+
+	// A frame ending with a space can't be followed by a gap
+	frameStart = symbolPtr;
+	framePulses = header.pulseCount;
+	framesLeft = (header.pulseCount & 1) ? repeat : 0;
+	framePeriod = (uint32_t)period * IR_US( 1000 );
+	frameTime = 0;
+
+	sendPulses( nextCompressedPulse );
+}
@@ -0,0 +1,107 @@
+//
+//  ircompress.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 21-06-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_ircompress_h
+#define BLEremote_ircompress_h
+
+#include "irprotocol.h"
+
+/**
+ @defgroup jwj_ircompress IR Compression Functions
+ @brief Functions for compressing raw IR codes.
+
+ @code #include "ircompress.h" @endcode
+
+ IR Compression Functions
+
+ Codes that are not recognized by decodeIR() are stored as raw pulse durations. But even then a remote only uses a few different pulse widths. compressIR() clusters the widths into a small timing table (up to @link IRCOMPRESS_MAX_WIDTHS @endlink entries) and replaces every pulse by its index in the table. The indices are packed 1, 2 or 4 bits per symbol depending on the size of the table.
+
+ A compressed code looks like this:
+
+	IRCompressedHeader (7 bytes)
+	timing table (16 bit tick values)
+	packed symbols (first symbol in the least significant bits)
+
+ The symbols are unpacked one at a time by the transmit interrupt handler so a compressed code is sent directly from the compressed data.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** Maximum number of different pulse widths in a compressed code. */
+#define IRCOMPRESS_MAX_WIDTHS 16
+
+/** Gap in ticks between repeat frames when the frame period is unknown or shorter than the frame. */
+#define IRCOMPRESS_FRAME_GAP MAXPULSE
+
+/** Header of a compressed code. The first three bytes match @link IRCode @endlink so the formats can be told apart. */
+typedef struct {
+	/** Always @link IRCODE_MARKER @endlink */
+	uint16_t marker;
+	/** Always @link IRProtocol_Compressed @endlink */
+	uint8_t protocol;
+	/** Number of entries in the timing table */
+	uint8_t tableSize;
+	/** Number of bits per symbol: 1, 2 or 4 */
+	uint8_t symbolBits;
+	/** Number of pulses */
+	uint16_t pulseCount;
+} IRCompressedHeader;
+
+/** State of an on-the-fly compression: the timing table built so far. Used by learnIR() for codes too long for the learn buffer. */
+typedef struct {
+	/** Pulse widths in ticks – the running average of the members of each entry */
+	unsigned int table[ IRCOMPRESS_MAX_WIDTHS ];
+	/** Number of pulses in each entry (saturates at 255) */
+	uint8_t members[ IRCOMPRESS_MAX_WIDTHS ];
+	/** Number of entries used */
+	uint8_t tableSize;
+} IRCompressor;
+
+/** Starts an on-the-fly compression.
+ @param compressor Pointer to the compression state.
+ */
+void initCompressor( IRCompressor *compressor );
+
+/** Adds a pulse to an on-the-fly compression. The pulse is matched against the timing table with the same tolerance as compressIR() uses and a new entry is added if it doesn't match any.
+
+ Unlike compressIR() the symbol of a pulse is decided right away, so the pulses can be packed (4 bits per symbol) and written out before the signal has ended.
+ @param compressor Pointer to the compression state.
+ @param width Pulse width in ticks.
+ @return The symbol for the pulse or 0xFF if it matches no entry and the table is full.
+ */
+uint8_t compressPulse( IRCompressor *compressor, unsigned int width );
+
+/** Compresses a raw IR code in place.
+ @param data A pointer to a 0 terminated array of pulse durations as recorded by learnIR(). The compressed code replaces the raw code.
+ @return Size in bytes of the compressed code. 0 if the code uses too many different pulse widths (or is empty) – the data is left untouched then.
+ */
+unsigned int compressIR( unsigned char *data );
+
+/** Returns the total size in bytes of a compressed code.
+ @param data A pointer to the compressed code. Only the header is used so this can be called when only the header has been read from EEPROM.
+ */
+unsigned int compressedIRSize( const unsigned char *data );
+
+/** Starts sending a compressed IR code.
+
+ The function returns as soon as the first pulse has been started. The data must remain untouched until the code has been sent.
+
+ A code that ends with a mark can be sent several times: each repeat frame starts one frame period after the previous one, so the gap after a frame is the period minus the length of the frame. This is how a code learned by learnFrames() is sent.
+ @param data A pointer to the compressed code.
+ @param repeat Number of repeat frames to send after the first one.
+ @param period Frame repeat period in ms or 0 if unknown – the frames are then separated by @link IRCOMPRESS_FRAME_GAP @endlink.
+ @see sendPulses
+ */
+void sendCompressedIR( const unsigned char *data, uint8_t repeat, uint16_t period );
+
+/**@}*/
+
+#endif
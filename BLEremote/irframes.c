@@ -0,0 +1,208 @@
+//
+//  irframes.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include "irframes.h"
+
+// State of a multi-frame learning. Lives on the stack of learnFrames() so it takes no SRAM the rest of the time.
+typedef struct {
+	IRCompressor reference;			// Timing table of the first frame averaged over all matching frames
+	uint8_t symbols[ (LEARN_MAX_PULSES + 1) / 2 ];	// Width class of every pulse of the first frame – two per byte, first in the low nibble
+	unsigned int pulses;			// Number of pulses in a frame
+	uint8_t split;					// Set when the captures are split into frames at the gaps
+	uint8_t frames;					// Number of matching frames
+	uint16_t lastStart;				// millis() at the start of the previous matching frame
+	uint8_t pressFrames;			// Matching frames of the current press
+	uint8_t presses;				// Number of presses ended so far
+	uint8_t repeat;					// Smallest number of repeat frames of the presses ended so far
+	uint16_t periodSum;				// Sum of the times between repeat frames in ms
+	uint8_t periods;				// Number of times in periodSum
+} FrameLearner;
+
+/* Returns the number of pulses up to the end of the capture or – if split is set – the first gap between frames */
+static unsigned int frameLength( const unsigned int *pulses, uint8_t split )
+{
+	unsigned int n;
+
+	for( n = 0; pulses[n]; n++ )
+		if( split && (n & 1) && pulses[n] >= LEARN_FRAME_GAP )
+			break;
+
+	return n;
+}
+
+/* Returns the width class of a pulse of the first frame */
+static uint8_t symbolAt( const FrameLearner *learner, unsigned int i )
+{
+	return (i & 1) ? learner->symbols[ i/2 ] >> 4 : learner->symbols[ i/2 ] & 0x0F;
+}
+
+/* Makes the pulses the reference frame. Returns 0 if they use too many widths. */
+static uint8_t setReference( FrameLearner *learner, const unsigned int *pulses, unsigned int count )
+{
+	unsigned int i;
+	uint8_t symbol;
+
+	initCompressor( &learner->reference );
+	for( i = 0; i < count; i++ )
+	{
+		symbol = compressPulse( &learner->reference, pulses[i] );
+		if( symbol == 0xFF )
+			return 0;
+		if( i & 1 )
+			learner->symbols[ i/2 ] |= symbol << 4;
+		else
+			learner->symbols[ i/2 ] = symbol;
+	}
+	learner->pulses = count;
+
+	return 1;
+}
+
+/* Checks a frame against the reference: every pulse must fall into the same width class. If add is set, the widths of a matching frame are added to the timing table. */
+static uint8_t matchFrame( FrameLearner *learner, const unsigned int *pulses, unsigned int count, uint8_t add )
+{
+	IRCompressor trial = learner->reference;
+	unsigned int i;
+
+	if( count != learner->pulses )
+		return 0;
+	for( i = 0; i < count; i++ )
+		if( compressPulse( &trial, pulses[i] ) != symbolAt( learner, i ))
+			return 0;
+
+	if( add )
+	{
+		learner->reference = trial;
+		learner->frames++;
+	}
+	return 1;
+}
+
+/* Ends a press: the repeat count is the smallest number of repeat frames in a press */
+static void endPress( FrameLearner *learner )
+{
+	if( learner->presses == 0 || learner->pressFrames - 1 < learner->repeat )
+		learner->repeat = learner->pressFrames - 1;
+	learner->presses++;
+}
+
+/* Counts a matching frame starting at the specified millis() time as a repeat frame or as the first frame of a new press */
+static void countFrame( FrameLearner *learner, uint16_t start )
+{
+	uint16_t interval = start - learner->lastStart;
+
+	if( interval < LEARN_REPEAT_WINDOW )
+	{
+		learner->pressFrames++;
+		learner->periodSum += interval;
+		learner->periods++;
+	}
+	else
+	{
+		endPress( learner );
+		learner->pressFrames = 1;
+	}
+	learner->lastStart = start;
+}
+
+/* Learns a code from several frames */
+IRError learnFrames( unsigned char *data, LearnSpill spill, unsigned int spillSize, LearnedFrames *result )
+{
+	unsigned int *pulses = (unsigned int*)data;
+	FrameLearner learner;
+	IRError status;
+	uint8_t carrier, seen;
+	unsigned int i, pos, count, summed;
+	uint32_t offset;
+
+	result->frames = 1;
+	result->repeat = 0;
+	result->period = 0;
+
+	// The first frame. A long code is in the EEPROM already.
+	status = learnIR( data, spill, spillSize, TIMEOUT_COUNT );
+	if( status != IRError_NoError || learnedLength )
+		return status;
+	carrier = learnedCarrier;
+
+	// The first frame is the reference. If the capture goes on with something else, the frames are parts of one code and the whole capture is the reference.
+	learner.split = 1;
+	count = frameLength( pulses, 1 );
+	if( !setReference( &learner, pulses, count ))
+		return status;
+	if( pulses[ count ] && !matchFrame( &learner, pulses + count + 1, frameLength( pulses + count + 1, 1 ), 0 ))
+	{
+		learner.split = 0;
+		count = frameLength( pulses, 0 );
+		if( !setReference( &learner, pulses, count ))
+			return status;
+	}
+
+	// A repeat frame can only follow a frame which ends with a mark
+	if( !(count & 1) )
+		return status;
+
+	learner.frames = 1;
+	learner.lastStart = learnedStart;
+	learner.pressFrames = 1;
+	learner.presses = 0;
+	learner.repeat = 0;
+	learner.periodSum = 0;
+	learner.periods = 0;
+	seen = 1;
+	pos = count;
+	summed = 0;
+	offset = 0;
+
+	for( ;; )
+	{
+		// The rest of the frames in this capture. pulses[ pos ] is the gap after the previous frame.
+		while( pulses[ pos ] && seen < LEARN_MAX_FRAMES )
+		{
+			pos++;
+			while( summed < pos )
+				offset += pulses[ summed++ ];
+			count = frameLength( pulses + pos, 1 );
+			seen++;
+			if( matchFrame( &learner, pulses + pos, count, 1 ))
+				countFrame( &learner, learnedStart + (offset + IR_US( 500 )) / IR_US( 1000 ));
+			pos += count;
+		}
+		if( seen >= LEARN_MAX_FRAMES )
+			break;
+
+		// The next capture replaces this one in the buffer. Anything but a valid signal ends the learning.
+		if( learnIR( data, 0, 0, LEARN_NEXT_TIMEOUT ) != IRError_NoError )
+			break;
+		seen++;
+		count = frameLength( pulses, learner.split );
+		if( matchFrame( &learner, pulses, count, 1 ))
+			countFrame( &learner, learnedStart );
+		pos = count;
+		summed = 0;
+		offset = 0;
+	}
+
+	// The last press counts unless it was cut short by the frame limit
+	if( seen < LEARN_MAX_FRAMES || learner.presses == 0 )
+		endPress( &learner );
+
+	// Rebuild the frame from the averaged widths
+	for( i = 0; i < learner.pulses; i++ )
+		pulses[i] = learner.reference.table[ symbolAt( &learner, i ) ];
+	pulses[ learner.pulses ] = 0;
+	learnedCarrier = carrier;
+
+	result->frames = learner.frames;
+	result->repeat = learner.repeat;
+	if( learner.periods )
+		result->period = learner.periodSum / learner.periods;
+
+	return IRError_NoError;
+}
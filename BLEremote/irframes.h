@@ -0,0 +1,71 @@
+//
+//  irframes.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_irframes_h
+#define BLEremote_irframes_h
+
+#include "ircompress.h"
+
+/**
+ @defgroup jwj_irframes Multi-frame Learning
+ @brief Learning a code from several frames.
+
+ @code #include "irframes.h" @endcode
+
+ Multi-frame Learning
+
+ A single capture is noisy: every pulse width is off by the receiver's jitter and the sampling error. But most remotes send a code several times – as repeat frames while the button is down and every time it is pressed. learnFrames() keeps learning for a while after the first frame and uses every frame that matches it.
+
+ The first frame is split into its pulse widths with the on-the-fly compressor (see compressPulse()), which gives every pulse a symbol – its width class – and a timing table. A later frame matches if every pulse falls into the same class as in the first frame. The pulses of a matching frame are then added to the timing table, so in the end every width class is the average of all its pulses in all frames. The learned frame is rebuilt from the symbols and the averaged table.
+
+ Frames are told apart by their gaps: a space of at least @link LEARN_FRAME_GAP @endlink within a capture ends a frame, and learnIR() ends a capture after 25 ms without an edge. A frame starting less than @link LEARN_REPEAT_WINDOW @endlink ms after the previous one is a repeat frame of the same press – the time between them is the frame repeat period. Otherwise the frame starts a new press.
+
+ Frames that don't match the first one – such as NEC repeat codes or RC-5 frames with the other toggle bit – are skipped. Codes with more than @link IRCOMPRESS_MAX_WIDTHS @endlink different widths and long codes are learned from the first frame alone.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** Maximum number of frames used for learning a code. */
+#define LEARN_MAX_FRAMES 8
+
+/** Number of MAXPULSE durations (25 ms) to wait for the next frame. Learning ends when no frame has been received for this long. */
+#define LEARN_NEXT_TIMEOUT 40
+
+/** Shortest space in ticks which separates two frames in the same capture. Longer than any space within a frame of the common protocols (4.5 ms for NEC). */
+#define LEARN_FRAME_GAP IR_US( 8000 )
+
+/** A frame starting less than this number of ms after the previous one is a repeat frame of the same press. */
+#define LEARN_REPEAT_WINDOW 200
+
+/** Result of learnFrames() besides the code itself. */
+typedef struct {
+	/** Number of frames the code was averaged from */
+	uint8_t frames;
+	/** Number of repeat frames after the first one – the smallest number seen in a press */
+	uint8_t repeat;
+	/** Frame repeat period in ms or 0 if no repeat frames were seen */
+	uint16_t period;
+} LearnedFrames;
+
+/** Learns a code from several frames.
+
+ Takes the first frame with learnIR() and then keeps learning until no frame has been received for @link LEARN_NEXT_TIMEOUT @endlink MAXPULSE durations or @link LEARN_MAX_FRAMES @endlink frames have been received.
+ @param data A pointer to a 256 byte memory block which receives a single frame in the format of learnIR(). Pulses are rebuilt from the averaged widths unless the code was learned from the first frame alone.
+ @param spill Function writing a long code to the EEPROM – passed on to learnIR() for the first frame. A long code is learned from a single frame and is left in the EEPROM with its length in @link learnedLength @endlink.
+ @param spillSize Largest number of bytes a long code may take.
+ @param result Pointer to a LearnedFrames which receives the number of frames, the repeat count and the period.
+ @return The status of the first frame: 0 if a valid signal was recorded. Errors in later frames just end the learning.
+ */
+IRError learnFrames( unsigned char *data, LearnSpill spill, unsigned int spillSize, LearnedFrames *result );
+
+/**@}*/
+
+#endif
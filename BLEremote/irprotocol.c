@@ -0,0 +1,565 @@
+//
+//  irprotocol.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 14-06-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <string.h>
+#include "irprotocol.h"
+
+/* Signal elements are stored as signed tick values: a mark is positive and a space is negative.
+ */
+#define MARK( us ) ((int16_t)IR_US( us ))
+#define SPACE( us ) (-(int16_t)IR_US( us ))
+
+#define RC6_T ((int16_t)IR_RC6_UNIT)
+#define RC5_T ((int16_t)IR_RC5_UNIT)
+
+/* Value for IRProtocolTiming.bits when the number of bits is given by IRCode.bits */
+#define VARIABLE_BITS 0xFF
+
+/* Protocol timing. Every bit is sent as two elements. For pulse distance/width coding the first element is a mark. For biphase coding the levels depend on the bit value.
+ * The same table is used for recognizing pulse distance/width coded signals and for generating all protocols.
+ */
+typedef struct {
+	const int16_t *leader;		// Leader elements (in flash)
+	uint8_t leaderLength;
+	uint8_t bits;				// Bits per frame
+	uint8_t msbFirst;
+	int16_t zero[2];			// Elements for a 0 bit
+	int16_t one[2];				// Elements for a 1 bit
+	int16_t stopMark;			// 0 if the last bit is not followed by a stop mark
+	unsigned int period;		// Frame repeat period
+	uint8_t repeatProtocol;		// Protocol used for repeat frames
+	uint8_t repeatLeader;		// 0 if repeat frames are sent without the leader
+} IRProtocolTiming;
+
+static const int16_t necLeader[] PROGMEM = { MARK( 9000 ), SPACE( 4500 ) };
+static const int16_t necRepeatLeader[] PROGMEM = { MARK( 9000 ), SPACE( 2250 ) };
+static const int16_t jvcLeader[] PROGMEM = { MARK( 8400 ), SPACE( 4200 ) };
+static const int16_t sonyLeader[] PROGMEM = { MARK( 2400 ), SPACE( 600 ) };
+
+// RC-6 mode 0 leader (6T mark, 2T space), start bit (1), mode bits (000) and the double length trailer bit (toggle 0)
+static const int16_t rc6Leader[] PROGMEM = {
+	6*RC6_T, -2*RC6_T,
+	RC6_T, -RC6_T,
+	-RC6_T, RC6_T, -RC6_T, RC6_T, -RC6_T, RC6_T,
+	-2*RC6_T, 2*RC6_T
+};
+
+static const IRProtocolTiming protocolTiming[] PROGMEM = {
+	[IRProtocol_NEC] = {
+		necLeader, 2, 32, 0, { MARK( 560 ), SPACE( 560 ) }, { MARK( 560 ), SPACE( 1690 ) }, MARK( 560 ), IR_US( 108000 ), IRProtocol_NECRepeat, 1
+	},
+	[IRProtocol_NECRepeat] = {
+		necRepeatLeader, 2, 0, 0, { 0, 0 }, { 0, 0 }, MARK( 560 ), IR_US( 108000 ), IRProtocol_NECRepeat, 1
+	},
+	[IRProtocol_RC5] = {
+		NULL, 0, 14, 1, { RC5_T, -RC5_T }, { -RC5_T, RC5_T }, 0, IR_US( 113778 ), IRProtocol_RC5, 0
+	},
+	[IRProtocol_RC6] = {
+		rc6Leader, 12, 16, 1, { -RC6_T, RC6_T }, { RC6_T, -RC6_T }, 0, IR_US( 106667 ), IRProtocol_RC6, 1
+	},
+	[IRProtocol_JVC] = {
+		jvcLeader, 2, 16, 0, { MARK( 526 ), SPACE( 526 ) }, { MARK( 526 ), SPACE( 1574 ) }, MARK( 526 ), IR_US( 55000 ), IRProtocol_JVC, 0
+	},
+	[IRProtocol_Sony] = {
+		sonyLeader, 2, VARIABLE_BITS, 0, { MARK( 600 ), SPACE( 600 ) }, { MARK( 1200 ), SPACE( 600 ) }, 0, IR_US( 45000 ), IRProtocol_Sony, 1
+	}
+};
+
+// Number of half-bit slots in an RC-5 frame and an RC-6 mode 0 frame (after the leader)
+#define RC5_SLOTS 28
+#define RC6_SLOTS 44
+
+/* Checks if a measured duration matches the expected value.
+ * IR receivers typically stretch marks and shorten spaces by up to about 100 µs so we allow 25% plus a little.
+ */
+static uint8_t matches( unsigned int measured, unsigned int expected )
+{
+	unsigned int tolerance = expected/4 + IR_US( 60 );
+
+	return measured + tolerance >= expected && measured <= expected + tolerance;
+}
+
+/* Decodes one frame of a pulse distance/width coded protocol starting at data[pos].
+ * Returns the position after the frame (i.e. of the gap before the next frame or the 0 terminator) or 0 if the frame could not be decoded.
+ */
+static unsigned int decodeFrame( const unsigned int *data, unsigned int pos, uint8_t protocol, uint8_t needLeader, uint32_t *value, uint8_t *bits )
+{
+	IRProtocolTiming t;
+	uint32_t v = 0;
+	uint8_t n, maxBits;
+
+	memcpy_P( &t, &protocolTiming[ protocol ], sizeof( t ));
+	maxBits = (t.bits == VARIABLE_BITS) ? 32 : t.bits;
+
+	// Leader (JVC repeat frames are sent without it)
+	if( data[pos] && matches( data[pos], pgm_read_word( &t.leader[0] )) && matches( data[pos+1], -(int16_t)pgm_read_word( &t.leader[1] )))
+		pos += 2;
+	else if( needLeader )
+		return 0;
+
+	for( n = 0; n < maxBits && data[pos]; n++ )
+	{
+		if( t.stopMark )
+		{
+			// Pulse distance: fixed mark, the space gives the bit value
+			if( !matches( data[pos], t.zero[0] ))
+				return 0;
+			if( matches( data[pos+1], -t.one[1] ))
+				v |= (uint32_t)1 << n;
+			else if( !matches( data[pos+1], -t.zero[1] ))
+				break;		// Not a bit: this is the stop mark
+			pos += 2;
+		}
+		else
+		{
+			// Pulse width: the mark gives the bit value, fixed space
+			if( matches( data[pos], t.one[0] ))
+				v |= (uint32_t)1 << n;
+			else if( !matches( data[pos], t.zero[0] ))
+				return 0;
+			pos++;
+
+			// No regular space after the last bit
+			if( !matches( data[pos], -t.zero[1] ))
+			{
+				n++;
+				break;
+			}
+			pos++;
+		}
+	}
+
+	// Stop mark
+	if( t.stopMark )
+	{
+		if( !matches( data[pos], t.stopMark ))
+			return 0;
+		pos++;
+	}
+
+	if( t.bits != VARIABLE_BITS && n != t.bits )
+		return 0;
+
+	*value = v;
+	*bits = n;
+	return pos;
+}
+
+/* Decodes a complete pulse distance/width coded signal and counts repeated frames.
+ * A repeat frame is either an identical frame or – for NEC – the protocol's repeat code, which is what sendIRCode() sends.
+ */
+static uint8_t decodePulseProtocol( const unsigned int *data, uint8_t protocol, uint32_t *value, uint8_t *bits, uint8_t *repeat )
+{
+	unsigned int pos, next;
+	uint32_t nextValue;
+	uint8_t nextBits;
+	uint8_t needLeader = pgm_read_byte( &protocolTiming[ protocol ].repeatLeader );
+	uint8_t repeatProtocol = pgm_read_byte( &protocolTiming[ protocol ].repeatProtocol );
+
+	pos = decodeFrame( data, 0, protocol, 1, value, bits );
+	if( pos == 0 )
+		return 0;
+
+	// Any further frames must be repeats
+	*repeat = 0;
+	while( data[pos] )
+	{
+		next = decodeFrame( data, pos+1, protocol, needLeader, &nextValue, &nextBits );	// Skip the gap
+		if( next == 0 && repeatProtocol != protocol && (next = decodeFrame( data, pos+1, repeatProtocol, 1, &nextValue, &nextBits )))
+		{
+			// The repeat code carries no bits
+			nextValue = *value;
+			nextBits = *bits;
+		}
+		if( next == 0 || nextValue != *value || nextBits != *bits || *repeat == 0xFF )
+			return 0;
+		pos = next;
+		(*repeat)++;
+	}
+
+	return 1;
+}
+
+/* Expands a biphase coded signal to half-bit slots of the specified length. Slot levels are stored as a bit array (1 = mark).
+ * `first` leading space slots are inserted before the first mark.
+ * Returns the number of slots or 0 if a pulse isn't a whole number of slots (up to maxRun) or the signal is too long.
+ */
+static uint8_t expandSlots( const unsigned int *data, unsigned int unit, uint8_t maxRun, uint8_t first, uint8_t *slots, uint8_t maxSlots )
+{
+	uint8_t n = first;
+	uint8_t level = 1;
+	uint8_t run;
+
+	memset( slots, 0, (maxSlots+7)/8 );
+
+	for( ; *data; data++, level ^= 1 )
+	{
+		// Round to nearest number of slots
+		run = (*data + unit/2) / unit;
+		if( run == 0 || run > maxRun || n + run > maxSlots )
+			return 0;
+
+		for( ; run; run--, n++ )
+			if( level )
+				slots[ n/8 ] |= 1 << (n & 7);
+	}
+
+	return n;
+}
+
+/* Returns the level of the specified slot */
+static inline uint8_t slot( const uint8_t *slots, uint8_t n )
+{
+	return (slots[ n/8 ] >> (n & 7)) & 1;
+}
+
+/* Reads `count` biphase bits MSB first starting at slot `n`. A bit is a mark-space or space-mark pair; `onePhase` is the level of the first half of a 1 bit.
+ * Returns 0 in *ok if a pair is not a valid bit.
+ */
+static uint16_t readBiphase( const uint8_t *slots, uint8_t n, uint8_t count, uint8_t onePhase, uint8_t *ok )
+{
+	uint16_t v = 0;
+
+	for( ; count; count--, n += 2 )
+	{
+		if( slot( slots, n ) == slot( slots, n+1 ))
+			*ok = 0;
+		v = (v << 1) | (slot( slots, n ) == onePhase);
+	}
+
+	return v;
+}
+
+/* RC-5: S1 S2 T A4..A0 C5..C0. A 1 bit is space-mark. S2 is the inverted 7th command bit (RC-5X).
+ */
+static uint8_t decodeRC5( const unsigned int *data, IRCode *code )
+{
+	uint8_t slots[ (RC5_SLOTS+7)/8 ];
+	uint8_t n, ok = 1;
+	uint16_t v;
+
+	// The first half of S1 is a space which is not seen. The last half may be a space as well.
+	n = expandSlots( data, IR_RC5_UNIT, 2, 1, slots, RC5_SLOTS );
+	if( n < RC5_SLOTS-1 )
+		return 0;
+
+	v = readBiphase( slots, 0, 14, 0, &ok );
+	if( !ok || !(v & 0x2000) )
+		return 0;
+
+	code->address = (v >> 6) & 0x1F;
+	code->command = (v & 0x3F) | ((v & 0x1000) ? 0 : 0x40);
+	return 1;
+}
+
+/* RC-6 mode 0: leader (6T mark, 2T space), start bit, 3 mode bits, double length trailer (toggle) bit, 8 address bits and 8 command bits.
+ * A 1 bit is mark-space.
+ */
+static uint8_t decodeRC6( const unsigned int *data, IRCode *code )
+{
+	uint8_t slots[ (RC6_SLOTS+7)/8 ];
+	uint8_t n, ok = 1;
+	uint16_t v;
+
+	// Leader
+	if( !data[1] || !matches( data[0], 6*IR_RC6_UNIT ) || !matches( data[1], 2*IR_RC6_UNIT ))
+		return 0;
+
+	// The last half of the last bit may be a space which is not seen
+	n = expandSlots( data+2, IR_RC6_UNIT, 3, 0, slots, RC6_SLOTS );
+	if( n < RC6_SLOTS-1 )
+		return 0;
+
+	// Start bit (1) and mode bits (000)
+	if( readBiphase( slots, 0, 4, 1, &ok ) != 0x08 || !ok )
+		return 0;
+
+	// Trailer bit is two slots per half
+	if( slot( slots, 8 ) != slot( slots, 9 ) || slot( slots, 10 ) != slot( slots, 11 ) || slot( slots, 8 ) == slot( slots, 10 ))
+		return 0;
+
+	v = readBiphase( slots, 12, 16, 1, &ok );
+	if( !ok )
+		return 0;
+
+	code->address = v >> 8;
+	code->command = v & 0xFF;
+	return 1;
+}
+
+/* Tries to recognize the protocol of a learned IR code */
+uint8_t decodeIR( const unsigned int *data, IRCode *code )
+{
+	uint32_t value;
+	uint8_t bits;
+
+	memset( code, 0, sizeof( *code ));
+	code->marker = IRCODE_MARKER;
+
+	if( data[0] == 0 )
+		return 0;
+
+	// NEC repeat code: leader and stop mark only
+	if( data[1] && data[2] && data[3] == 0 && decodeFrame( data, 0, IRProtocol_NECRepeat, 1, &value, &bits ) == 3 )
+	{
+		code->protocol = IRProtocol_NECRepeat;
+		return 1;
+	}
+
+	if( decodePulseProtocol( data, IRProtocol_NEC, &value, &bits, &code->repeat ))
+	{
+		code->protocol = IRProtocol_NEC;
+		code->address = value;
+		code->command = value >> 16;
+		return 1;
+	}
+
+	if( decodePulseProtocol( data, IRProtocol_JVC, &value, &bits, &code->repeat ))
+	{
+		code->protocol = IRProtocol_JVC;
+		code->address = value & 0xFF;
+		code->command = (value >> 8) & 0xFF;
+		return 1;
+	}
+
+	if( decodePulseProtocol( data, IRProtocol_Sony, &value, &bits, &code->repeat ) && (bits == 12 || bits == 15 || bits == 20) )
+	{
+		code->protocol = IRProtocol_Sony;
+		code->bits = bits;
+		code->command = value & 0x7F;
+		code->address = value >> 7;
+		return 1;
+	}
+
+	if( decodeRC5( data, code ))
+	{
+		code->protocol = IRProtocol_RC5;
+		return 1;
+	}
+
+	if( decodeRC6( data, code ))
+	{
+		code->protocol = IRProtocol_RC6;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Pulse generator states */
+enum GeneratorStates
+{
+	Generator_Leader,
+	Generator_Bits,
+	Generator_Stop,
+	Generator_Gap
+};
+
+/* State of the pulse generator used by sendIRCode().
+ * Once the transmission has started, this is only accessed from the Timer1 interrupt handler.
+ */
+static struct {
+	IRProtocolTiming timing;	// Timing of the current frame
+	uint32_t value;				// Frame bits
+	uint32_t mask;				// Mask for the next bit
+	uint8_t protocol;
+	uint8_t bits;
+	uint8_t bitsLeft;
+	uint8_t step;				// Leader element or half of the current bit
+	uint8_t framesLeft;
+	uint8_t state;
+	unsigned int frameTime;		// Duration of the current frame so far
+	int16_t pending;			// Element read ahead when merging elements into pulses (0 = end of signal)
+} generator;
+
+static volatile uint8_t holdFrames;		// Set while repeat frames are to be sent until released
+
+/* Prepares the generator for the next frame */
+static void startFrame( uint8_t protocol, uint8_t leader )
+{
+	memcpy_P( &generator.timing, &protocolTiming[ protocol ], sizeof( generator.timing ));
+	if( !leader )
+		generator.timing.leaderLength = 0;
+
+	generator.bitsLeft = (generator.timing.bits == VARIABLE_BITS) ? generator.bits : generator.timing.bits;
+	if( generator.timing.msbFirst )
+		generator.mask = (uint32_t)1 << (generator.bitsLeft - 1);
+	else
+		generator.mask = 1;
+
+	generator.step = 0;
+	generator.frameTime = 0;
+	generator.state = Generator_Leader;
+}
+
+/* Returns the next signal element: > 0 for a mark, < 0 for a space or 0 at the end of the signal */
+static int16_t nextElement()
+{
+	int16_t e;
+
+	for( ;; )
+	{
+		switch( generator.state )
+		{
+			case Generator_Leader:
+				if( generator.step < generator.timing.leaderLength )
+				{
+					e = pgm_read_word( &generator.timing.leader[ generator.step++ ] );
+					generator.frameTime += (e > 0) ? e : -e;
+					return e;
+				}
+				generator.step = 0;
+				generator.state = Generator_Bits;
+				break;
+
+			case Generator_Bits:
+				if( generator.bitsLeft == 0 )
+				{
+					generator.state = Generator_Stop;
+					break;
+				}
+
+				e = (generator.value & generator.mask) ? generator.timing.one[ generator.step ] : generator.timing.zero[ generator.step ];
+				if( ++generator.step == 2 )
+				{
+					// Next bit
+					generator.step = 0;
+					generator.bitsLeft--;
+					if( generator.timing.msbFirst )
+						generator.mask >>= 1;
+					else
+						generator.mask <<= 1;
+				}
+				generator.frameTime += (e > 0) ? e : -e;
+				return e;
+
+			case Generator_Stop:
+				generator.state = Generator_Gap;
+				if( generator.timing.stopMark )
+				{
+					generator.frameTime += generator.timing.stopMark;
+					return generator.timing.stopMark;
+				}
+				break;
+
+			default:
+				if( generator.framesLeft == 0 && !holdFrames )
+					return 0;
+				if( generator.framesLeft )
+					generator.framesLeft--;
+
+				// Pad to the frame period and start the next frame
+				if( generator.frameTime < generator.timing.period )
+					e = -(int16_t)(generator.timing.period - generator.frameTime);
+				else
+					e = SPACE( 10000 );
+				startFrame( generator.timing.repeatProtocol, generator.timing.repeatLeader );
+				return e;
+		}
+	}
+}
+
+/* Pulse source for the transmit interrupt handler.
+ * Merges consecutive elements with the same level into one pulse. A trailing space is not sent.
+ */
+static unsigned int nextGeneratedPulse()
+{
+	int16_t e = generator.pending;
+	int16_t next;
+	unsigned int ticks;
+
+	if( e == 0 )
+		return 0;
+
+	ticks = (e > 0) ? e : -e;
+	for( ;; )
+	{
+		next = nextElement();
+		if( next == 0 )
+		{
+			generator.pending = 0;
+			return (e > 0) ? ticks : 0;
+		}
+		if( (next > 0) != (e > 0) )
+		{
+			generator.pending = next;
+			return ticks;
+		}
+		ticks += (next > 0) ? next : -next;
+	}
+}
+
+/* Returns the usual carrier frequency of a protocol */
+uint8_t protocolCarrier( uint8_t protocol )
+{
+	switch( protocol )
+	{
+		case IRProtocol_RC5:
+		case IRProtocol_RC6:
+			return 36;
+		case IRProtocol_Sony:
+			return 40;
+		default:
+			return CARRIER_DEFAULT;
+	}
+}
+
+/* Keeps sending repeat frames or stops after the current frame */
+void holdIRCode( uint8_t hold )
+{
+	holdFrames = hold;
+}
+
+/* Starts sending a compact IR code */
+void sendIRCode( const IRCode *code )
+{
+	int16_t e;
+
+	if( code->protocol == IRProtocol_Raw || code->protocol > IRProtocol_Sony )
+		return;
+
+	// Bit layout of the frame
+	switch( code->protocol )
+	{
+		case IRProtocol_RC5:
+			// S1, S2 (inverted command bit 6), toggle (always 0), address and command
+			generator.value = 0x2000 | ((code->command & 0x40) ? 0 : 0x1000) | ((code->address & 0x1F) << 6) | (code->command & 0x3F);
+			break;
+		case IRProtocol_RC6:
+			generator.value = ((code->address & 0xFF) << 8) | (code->command & 0xFF);
+			break;
+		case IRProtocol_JVC:
+			generator.value = (code->address & 0xFF) | ((code->command & 0xFF) << 8);
+			break;
+		case IRProtocol_Sony:
+			generator.value = (code->command & 0x7F) | ((uint32_t)code->address << 7);
+			break;
+		default:
+			generator.value = code->address | ((uint32_t)code->command << 16);
+			break;
+	}
+
+	generator.protocol = code->protocol;
+	generator.bits = code->bits;
+	generator.framesLeft = code->repeat;
+
+	// Sony devices need to see the frame at least three times
+	if( code->protocol == IRProtocol_Sony && generator.framesLeft < 2 )
+		generator.framesLeft = 2;
+
+	startFrame( code->protocol, 1 );
+
+	// The signal must start with a mark (the first half of an RC-5 frame is a space)
+	while( (e = nextElement()) < 0 )
+		;
+	generator.pending = e;
+
+	sendPulses( nextGeneratedPulse );
+}
@@ -0,0 +1,124 @@
+//
+//  irprotocol.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 14-06-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_irprotocol_h
+#define BLEremote_irprotocol_h
+
+#include "infrared.h"
+
+/**
+ @defgroup jwj_irprotocol IR Protocol Functions
+ @brief Functions for recognizing and generating common IR protocols.
+
+ @code #include "irprotocol.h" @endcode
+
+ IR Protocol Functions
+
+ A learned code is a raw list of pulse durations (see learnIR()). Most remotes use one of a few well-known protocols so instead of storing 67 pulse durations for an NEC code which really is 4 bytes, decodeIR() tries to recognize the protocol and returns a compact @link IRCode @endlink record which is stored instead.
+
+ sendIRCode() generates the pulses for a compact code while it is being sent. It can also be used for sending codes that have never been learned.
+
+ The following protocols are recognized: NEC (and the NEC repeat code), RC-5, RC-6 (mode 0), JVC and Sony SIRC (12, 15 and 20 bits). Protocol descriptions can be found at http://www.sbprojects.com/knowledge/ir/
+
+ The timing of each protocol is described by one entry in a table in flash. All timing constants are converted to ticks (@link TICK_DURATION @endlink µs) at compile time using @link IR_US @endlink.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** Converts a duration in microseconds to ticks. Use with constant values only so the conversion is done by the compiler. */
+#define IR_US( us ) ((unsigned int)(((uint32_t)(us) * (F_CPU / 1000000UL) + TICK_CYCLES/2) / TICK_CYCLES))
+
+/** Marker value for the first word of a compact code. A raw code never starts with a 0 duration so this tells the two formats apart. */
+#define IRCODE_MARKER 0x0000
+
+/** Half-bit length for RC-5 in ticks */
+#define IR_RC5_UNIT IR_US( 889 )
+
+/** Half-bit length for RC-6 in ticks */
+#define IR_RC6_UNIT IR_US( 444 )
+
+/** IR protocols recognized by decodeIR()
+ */
+typedef enum {
+	/** No protocol recognized: the code is stored as raw pulse durations */
+	IRProtocol_Raw = 0,
+	/** NEC: 32 bits; address in the 16 address bits and command in the 16 command bits (command and inverted command) */
+	IRProtocol_NEC = 1,
+	/** The NEC repeat code (9 ms – 2.25 ms – 560 µs) */
+	IRProtocol_NECRepeat = 2,
+	/** Philips RC-5: 5 bit address and 7 bit command (including the RC-5X field bit) */
+	IRProtocol_RC5 = 3,
+	/** Philips RC-6 mode 0: 8 bit address and 8 bit command */
+	IRProtocol_RC6 = 4,
+	/** JVC: 8 bit address and 8 bit command */
+	IRProtocol_JVC = 5,
+	/** Sony SIRC: 7 bit command and 5, 8 or 13 bit address */
+	IRProtocol_Sony = 6,
+	/** Not a protocol: a raw code compressed with compressIR(). The record is an @link IRCompressedHeader @endlink and not an IRCode. */
+	IRProtocol_Compressed = 7,
+	/** Not a protocol: a macro. The record is a @link MacroHeader @endlink followed by the steps. */
+	IRProtocol_Macro = 8
+} IRProtocol;
+
+/** A compact, protocol-decoded IR code.
+
+ This is what gets stored in EEPROM instead of the raw pulse durations when the protocol has been recognized.
+ */
+typedef struct {
+	/** Always @link IRCODE_MARKER @endlink */
+	uint16_t marker;
+	/** An @link IRProtocol @endlink value */
+	uint8_t protocol;
+	/** Number of bits in a frame. Only used for Sony where it is 12, 15 or 20 */
+	uint8_t bits;
+	/** Device address */
+	uint16_t address;
+	/** Command */
+	uint16_t command;
+	/** Number of extra frames sent after the first one */
+	uint8_t repeat;
+} IRCode;
+
+/** Tries to recognize the protocol of a learned IR code.
+
+ The entire signal must consist of frames of one protocol with the same address and command – otherwise it is not recognized. Repeated frames are counted in `repeat`. For NEC the repeat frames may be NEC repeat codes as well as copies of the first frame, so a captured NEC frame followed by repeat codes gives the same code that sendIRCode() sends for it.
+ @param data A pointer to a 0 terminated array of pulse durations as recorded by learnIR().
+ @param code A pointer to an IRCode struct which receives the decoded code.
+ @return 1 if the protocol was recognized. Otherwise 0 and the code should be stored as raw data.
+ */
+uint8_t decodeIR( const unsigned int *data, IRCode *code );
+
+/** Starts sending a compact IR code.
+
+ The pulses are generated on the fly from the protocol timing table by the Timer1 interrupt handler so no EEPROM access or pulse buffer is needed. The first frame is followed by `repeat` repeat frames at the protocol's frame period (NEC sends NEC repeat codes, JVC sends frames without the leader). Sony codes are always sent at least three times.
+ 
+ The function returns as soon as the first pulse has been started.
+ @param code A pointer to the code to send. The code is copied so it does not need to remain valid.
+ @see sendPulses
+ */
+void sendIRCode( const IRCode *code );
+
+/** Returns the usual carrier frequency of a protocol.
+ @param protocol An @link IRProtocol @endlink value.
+ @return Carrier frequency in kHz: 36 for RC-5 and RC-6, 40 for Sony and @link CARRIER_DEFAULT @endlink for everything else.
+ */
+uint8_t protocolCarrier( uint8_t protocol );
+
+/** Makes sendIRCode() keep sending repeat frames at the protocol's frame period after the `repeat` frames – like a remote does while a button is held down.
+
+ Call this with 1 before sendIRCode() and with 0 when the button is released. The frame being sent is completed.
+ @param hold 1 to keep sending or 0 to stop.
+ */
+void holdIRCode( uint8_t hold );
+
+/**@}*/
+
+#endif
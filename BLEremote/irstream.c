@@ -0,0 +1,213 @@
+//
+//  irstream.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 04-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <string.h>
+#include "infrared.h"
+#include "ircompress.h"
+#include "24c_eeprom.h"
+#include "irstream.h"
+
+static unsigned char streamBuffer[2][ STREAM_CHUNK_SIZE ];
+static TWITransaction fetch[2];					// EEPROM reads for each buffer
+static volatile uint8_t streamLength[2];		// Number of bytes in each buffer. 0 means the buffer is free.
+static uint8_t readBuffer;						// Buffer being sent by the interrupt handler
+static uint8_t readPos;							// Byte position in that buffer
+static uint32_t streamAddress;					// EEPROM address of the next chunk
+static volatile unsigned int streamLeft;		// Bytes left to read
+
+// The following variables are used when streaming a compressed code
+static IRCompressedHeader streamHeader;
+static unsigned int streamTable[ IRCOMPRESS_MAX_WIDTHS ];
+static unsigned int symbolsLeft;
+static uint8_t symbolByte;
+static uint8_t symbolShift;
+
+// The following variables are used for the repeat frames of a compressed code
+static uint32_t frameAddress;			// EEPROM address of the first chunk – where every repeat frame starts
+static unsigned int frameBytes;			// Length of the symbols
+static uint8_t framesLeft;				// Repeat frames still to be sent
+static uint32_t framePeriod;			// Frame repeat period in ticks
+static uint32_t frameTime;				// Ticks sent of the current frame
+
+uint16_t streamUnderruns;
+
+/* Called from the TWI interrupt handler when a chunk has been read: hands the buffer to the transmit interrupt handler */
+static void chunkRead( TWITransaction *transaction )
+{
+	uint8_t buffer = (transaction == &fetch[0]) ? 0 : 1;
+
+	if( transaction->status == TWIStatus_Done )
+		streamLength[ buffer ] = transaction->length;
+	else
+		streamLeft = 0;		// Read error: end the code when the other buffer has been sent
+}
+
+/* Starts reading the next chunk into the specified buffer in the background */
+static void fetchChunk( uint8_t buffer )
+{
+	uint8_t len = (streamLeft > STREAM_CHUNK_SIZE) ? STREAM_CHUNK_SIZE : streamLeft;
+
+	if( readDataAsync( &fetch[ buffer ], streamAddress, streamBuffer[ buffer ], len, chunkRead ))
+	{
+		streamAddress += len;
+		streamLeft -= len;
+	}
+}
+
+/* Takes the next byte from the stream buffers. Returns 0 if there is none. */
+static uint8_t nextStreamByte( uint8_t *byte )
+{
+	if( streamLength[ readBuffer ] == 0 )
+	{
+		// No data: either the code has ended or we're sending faster than we can read
+		if( streamLeft || fetch[ readBuffer ].status >= TWIStatus_Queued )
+			streamUnderruns++;
+		return 0;
+	}
+
+	*byte = streamBuffer[ readBuffer ][ readPos++ ];
+
+	// Buffer empty: refill it and switch to the other one
+	if( readPos >= streamLength[ readBuffer ] )
+	{
+		streamLength[ readBuffer ] = 0;
+		if( streamLeft )
+			fetchChunk( readBuffer );
+		readBuffer ^= 1;
+		readPos = 0;
+	}
+
+	return 1;
+}
+
+/* Pulse source for the transmit interrupt handler: takes the next pulse from the stream buffers */
+static unsigned int nextStreamPulse()
+{
+	uint8_t low, high;
+
+	if( !nextStreamByte( &low ) || !nextStreamByte( &high ))
+		return 0;
+	return low | (high << 8);
+}
+
+/* Starts reading the symbols over from the first chunk for a repeat frame. The reads run during the gap before the frame.
+ * Returns 0 if a read is still queued for one of the buffers.
+ */
+static uint8_t restartStream()
+{
+	if( fetch[0].status >= TWIStatus_Queued || fetch[1].status >= TWIStatus_Queued )
+		return 0;
+
+	streamLength[0] = 0;
+	streamLength[1] = 0;
+	readBuffer = 0;
+	readPos = 0;
+	streamAddress = frameAddress;
+	streamLeft = frameBytes;
+	fetchChunk( 0 );
+	if( streamLeft )
+		fetchChunk( 1 );
+	return 1;
+}
+
+/* Pulse source for the transmit interrupt handler: unpacks the next symbol from the stream buffers and looks up its width.
+ * After the last pulse of a frame, the gap up to the frame period is returned and the code is read again if there are repeat frames left – as nextCompressedPulse() does.
+ */
+static unsigned int nextStreamSymbol()
+{
+	uint8_t symbol;
+	unsigned int width;
+
+	if( symbolsLeft == 0 )
+	{
+		if( framesLeft == 0 || !restartStream() )
+			return 0;
+		framesLeft--;
+		symbolsLeft = streamHeader.pulseCount;
+		symbolShift = 0;
+
+		// The frame ended with a mark so the gap is the rest of the period
+		if( frameTime >= framePeriod )
+			width = IRCOMPRESS_FRAME_GAP;
+		else if( framePeriod - frameTime > 0xFFFF )
+			width = 0xFFFF;
+		else
+			width = framePeriod - frameTime;
+		frameTime = 0;
+		return width;
+	}
+	symbolsLeft--;
+
+	if( symbolShift == 0 && !nextStreamByte( &symbolByte ))
+		return 0;
+	symbol = (symbolByte >> symbolShift) & ((1 << streamHeader.symbolBits) - 1);
+	symbolShift = (symbolShift + streamHeader.symbolBits) & 7;
+
+	width = streamTable[ symbol ];
+	frameTime += width;
+	return width;
+}
+
+/* Reads the first chunk of a code */
+unsigned char *beginStream( uint32_t address, unsigned int length )
+{
+	uint8_t len = (length > STREAM_CHUNK_SIZE) ? STREAM_CHUNK_SIZE : length;
+
+	// The buffers may still be in use
+	while( isSendingIR() || fetch[0].status >= TWIStatus_Queued || fetch[1].status >= TWIStatus_Queued )
+		;
+
+	readData( address, streamBuffer[0], len );
+	streamLength[0] = len;
+	streamLength[1] = 0;
+	streamAddress = address + len;
+	streamLeft = length - len;
+	symbolsLeft = 0;
+	frameAddress = address;
+	frameBytes = length;
+
+	return streamBuffer[0];
+}
+
+/* Reads the header and timing table of a compressed code and the first chunk of its symbols */
+unsigned char *beginCompressedStream( uint32_t address, unsigned int length )
+{
+	IRCompressedHeader header;
+	unsigned int tableBytes;
+
+	readData( address, (unsigned char*)&header, sizeof( header ));
+	if( header.pulseCount == 0 || header.tableSize > IRCOMPRESS_MAX_WIDTHS || length < compressedIRSize( (unsigned char*)&header ))
+		return 0;
+
+	// beginStream() waits until the header and table of the previous code are no longer used
+	tableBytes = header.tableSize * sizeof( unsigned int );
+	beginStream( address + sizeof( header ) + tableBytes, length - sizeof( header ) - tableBytes );
+	streamHeader = header;
+	readData( address + sizeof( header ), (unsigned char*)streamTable, tableBytes );
+	symbolsLeft = streamHeader.pulseCount;
+	symbolShift = 0;
+
+	return (unsigned char*)&streamHeader;
+}
+
+/* Sends the code. The rest of it is read by the interrupt handlers. */
+void streamIR( uint8_t repeat, uint16_t period )
+{
+	readBuffer = 0;
+	readPos = 0;
+	if( streamLeft )
+		fetchChunk( 1 );
+
+	// Only a compressed code ending with a mark is repeated, as by sendCompressedIR()
+	framesLeft = (symbolsLeft && (streamHeader.pulseCount & 1)) ? repeat : 0;
+	framePeriod = (uint32_t)period * IR_US( 1000 );
+	frameTime = 0;
+
+	sendPulses( symbolsLeft ? nextStreamSymbol : nextStreamPulse );
+}
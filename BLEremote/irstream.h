@@ -0,0 +1,69 @@
+//
+//  irstream.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 04-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_irstream_h
+#define BLEremote_irstream_h
+
+/**
+ @defgroup jwj_irstream IR Streaming Functions
+ @brief Functions for sending raw IR codes directly from the EEPROM.
+
+ @code #include "irstream.h" @endcode
+
+ IR Streaming Functions
+
+ A raw code can be 256 bytes and reading all of it before the first edge takes more than 10 ms. Instead the code is read in chunks of @link STREAM_CHUNK_SIZE @endlink bytes into two buffers: as soon as the first chunk has been read, the transmit interrupt handler starts sending from it while the next chunk is read into the other buffer. When the interrupt handler has emptied a buffer it switches to the other one and queues a read of the next chunk into the emptied buffer. The reads are run by the TWI interrupt handler so the main loop is not involved at all.
+
+ Compressed codes which are too long for the code cache are streamed too. Their timing table is read into SRAM first and the transmit interrupt handler unpacks the symbols from the stream buffers.
+
+ Reading a chunk takes less than 1 ms at 200 kHz SCL, which is much shorter than the 8 pulses in a chunk, so the interrupt handler never has to wait for data. Should it happen anyway, the code is cut short and @link streamUnderruns @endlink is incremented.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** Size of each of the two stream buffers in bytes. Must be even. */
+#define STREAM_CHUNK_SIZE 16
+
+/** Number of times the transmit interrupt handler found no data in the stream buffers. */
+extern uint16_t streamUnderruns;
+
+/** Reads the first chunk of a code from the EEPROM into the stream buffer.
+
+ Waits for any code being sent to finish first since the buffers are reused.
+ @param address EEPROM address of the code.
+ @param length Length of the code in bytes.
+ @return A pointer to the first chunk – @link STREAM_CHUNK_SIZE @endlink bytes or the length of the code if it is shorter. This can be used to check the format of the code before streamIR() is called.
+ */
+unsigned char *beginStream( uint32_t address, unsigned int length );
+
+/** Reads the header and timing table of a compressed code (see compressIR()) and the first chunk of its symbols – for compressed codes too long for the code cache such as the long codes written by learnIR().
+
+ Waits for any code being sent to finish first since the buffers are reused.
+ @param address EEPROM address of the code.
+ @param length Length of the code in bytes.
+ @return A pointer to a copy of the @link IRCompressedHeader @endlink or 0 if the header doesn't match the length.
+ */
+unsigned char *beginCompressedStream( uint32_t address, unsigned int length );
+
+/** Sends the code whose first chunk was read by beginStream() or beginCompressedStream().
+
+ Transmission starts immediately and the function returns. The rest of the code is read in the background while it is being sent.
+
+ A compressed code that ends with a mark is sent with repeat frames like sendCompressedIR() does. Its symbols are read from the EEPROM again for every frame; the reads run during the gap between the frames.
+ @param repeat Number of repeat frames to send after the first one. Ignored for raw codes.
+ @param period Frame repeat period in ms or 0 if unknown – the frames are then separated by @link IRCOMPRESS_FRAME_GAP @endlink.
+ @see sendPulses
+ */
+void streamIR( uint8_t repeat, uint16_t period );
+
+/**@}*/
+
+#endif
@@ -0,0 +1,92 @@
+//
+//  led.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 20-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "led.h"
+
+#define LED_MASK ((1<< LED_GREEN_BIT) | (1<< LED_RED_BIT))
+
+static const LEDStep *pattern;			// Next step of the pattern being played or 0
+static uint8_t stepLeft;				// Units left of the current step
+static uint8_t unitLeft;				// ms left of the current unit
+static uint8_t background = LED_Off;
+static uint8_t steady;					// Set when a pattern has ended with a color that remains on
+
+/* Switches the LEDs */
+static inline void showColor( uint8_t color )
+{
+	LED_PORT = (LED_PORT & ~LED_MASK) | (color & LED_MASK);
+}
+
+/* Shows the next step of the pattern. Interrupts must be disabled. */
+static void nextStep()
+{
+	uint8_t color = pgm_read_byte( &pattern->color );
+	uint8_t time = pgm_read_byte( &pattern->time );
+
+	if( time == 0 )
+	{
+		// End of pattern
+		pattern = 0;
+		steady = (color != LED_Background);
+		showColor( steady ? color : background );
+		return;
+	}
+
+	showColor( color );
+	stepLeft = time;
+	unitLeft = LED_UNIT_MS;
+	pattern++;
+}
+
+/* Configures the LED pins */
+void initLED()
+{
+	LED_DDR |= LED_MASK;
+	showColor( LED_Off );
+}
+
+/* Sets the background color */
+void setLED( uint8_t color )
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	background = color;
+	steady = 0;
+	if( !pattern )
+		showColor( color );
+	SREG = sreg;
+}
+
+/* Starts a pattern */
+void playLED( const LEDStep *newPattern )
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	pattern = newPattern;
+	nextStep();
+	SREG = sreg;
+}
+
+/* Called every ms */
+void ledTick()
+{
+	if( !pattern )
+		return;
+
+	if( --unitLeft )
+		return;
+	unitLeft = LED_UNIT_MS;
+
+	if( --stepLeft == 0 )
+		nextStep();
+}
@@ -0,0 +1,81 @@
+//
+//  led.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 20-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_led_h
+#define BLEremote_led_h
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+/**
+ @defgroup jwj_led LED Patterns
+ @brief Non-blocking status LED patterns.
+
+ @code #include "led.h" @endcode
+
+ LED Patterns
+
+ The status LED is a red/green dual LED. Flashes and blinks are described by pattern tables in flash and played by ledTick() which is called from the millisecond clock interrupt, so showing an error or a "learned" flash never delays the next command.
+
+ When a pattern has ended, the LED goes back to the background color set with setLED() – green while connected and off otherwise. A pattern can also end with a color that stays on until the next pattern, e.g. yellow while learning.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** The PORTx of the LED pins. */
+#define LED_PORT PORTB
+/** The DDRx of the LED pins. */
+#define LED_DDR DDRB
+/** The Pxy of the green LED. */
+#define LED_GREEN_BIT PB0
+/** The Pxy of the red LED. */
+#define LED_RED_BIT PB1
+
+/** Duration in ms of one time unit in a pattern step. */
+#define LED_UNIT_MS 10
+
+/** LED colors. */
+typedef enum {
+	LED_Off = 0,
+	LED_Green = (1<< LED_GREEN_BIT),
+	LED_Red = (1<< LED_RED_BIT),
+	LED_Yellow = (1<< LED_GREEN_BIT) | (1<< LED_RED_BIT),
+	/** Only valid in the last step of a pattern: go back to the background color */
+	LED_Background = 0xFF
+} LEDColor;
+
+/** A step of a pattern. */
+typedef struct {
+	/** An @link LEDColor @endlink value */
+	uint8_t color;
+	/** Duration in units of @link LED_UNIT_MS @endlink. 0 ends the pattern: the color remains on. */
+	uint8_t time;
+} LEDStep;
+
+/** Configures the LED pins as outputs. */
+void initLED();
+
+/** Sets the background color which is shown when no pattern is playing.
+ @param color An @link LEDColor @endlink value.
+ */
+void setLED( uint8_t color );
+
+/** Starts playing a pattern. A pattern already playing is replaced.
+ @param pattern Pointer to the pattern in flash. The last step must have time 0.
+ */
+void playLED( const LEDStep *pattern );
+
+/** Advances the pattern being played. Called every millisecond from the clock interrupt handler. */
+void ledTick();
+
+/**@}*/
+
+#endif
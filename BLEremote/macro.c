@@ -0,0 +1,125 @@
+//
+//  macro.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 18-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <string.h>
+#include "sendqueue.h"
+#include "irprotocol.h"
+#include "clock.h"
+#include "macro.h"
+
+// Player states
+enum MacroStates
+{
+	Macro_Idle,
+	Macro_Start,		// The current step is to be sent
+	Macro_Sending,		// Waiting for a transmission of the current step to finish
+	Macro_Gap			// Waiting for the delay after a transmission
+};
+
+static MacroStep steps[ MACRO_MAX_STEPS ];
+static uint8_t stepCount;
+static uint8_t step;				// Current step
+static uint8_t sent;				// Number of transmissions of the current step
+static uint8_t prefetched;			// Set when the next step has been prefetched
+static uint8_t macroState = Macro_Idle;
+static uint16_t gapStart;
+static uint16_t gapLength;
+
+/* Starts playing a macro */
+uint8_t startMacro( const unsigned char *data, unsigned int len )
+{
+	const MacroHeader *header = (const MacroHeader*)data;
+
+	if( len < sizeof( MacroHeader ) || header->marker != IRCODE_MARKER || header->protocol != IRProtocol_Macro ||
+	    header->steps == 0 || header->steps > MACRO_MAX_STEPS || len != MACRO_SIZE( header->steps ))
+		return 0;
+
+	memcpy( steps, data + sizeof( MacroHeader ), header->steps * sizeof( MacroStep ));
+	stepCount = header->steps;
+	step = 0;
+	sent = 0;
+	macroState = Macro_Start;
+
+	return 1;
+}
+
+/* Stops the macro */
+void abortMacro()
+{
+	macroState = Macro_Idle;
+}
+
+/* Sends the current step again on the next poll */
+void retryMacroStep()
+{
+	if( macroState != Macro_Sending )
+		return;
+	sent--;
+	macroState = Macro_Start;
+}
+
+/* Checks whether a macro is playing */
+uint8_t macroActive()
+{
+	return macroState != Macro_Idle;
+}
+
+/* Advances the player one step if it is time to */
+uint8_t macroPoll( uint8_t *command )
+{
+	switch( macroState )
+	{
+		case Macro_Start:
+			// Send the current step
+			*command = steps[ step ].command;
+			sent++;
+			macroState = Macro_Sending;
+			return MacroAction_Send;
+
+		case Macro_Sending:
+			if( sendQueueBusy() )
+				break;
+
+			// Transmission done: pause before the next transmission or the next step
+			gapStart = millis();
+			if( sent <= steps[ step ].repeat )
+				gapLength = MACRO_REPEAT_GAP;
+			else
+			{
+				gapLength = steps[ step ].delay;
+				prefetched = 0;
+				step++;
+				sent = 0;
+			}
+			macroState = Macro_Gap;
+			break;
+
+		case Macro_Gap:
+			if( step >= stepCount )
+			{
+				// That was the last step
+				macroState = Macro_Idle;
+				break;
+			}
+
+			// Use the delay to read the next code from the EEPROM
+			if( sent == 0 && !prefetched )
+			{
+				prefetched = 1;
+				*command = steps[ step ].command;
+				return MacroAction_Prefetch;
+			}
+
+			if( (uint16_t)(millis() - gapStart) >= gapLength )
+				macroState = Macro_Start;
+			break;
+	}
+
+	return MacroAction_None;
+}
@@ -0,0 +1,100 @@
+//
+//  macro.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 18-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_macro_h
+#define BLEremote_macro_h
+
+#include <avr/io.h>
+
+/**
+ @defgroup jwj_macro Macros
+ @brief Playback of stored command sequences.
+
+ @code #include "macro.h" @endcode
+
+ Macros
+
+ A macro is a list of steps – command number, number of extra transmissions and a delay – which is stored in the code store like any other code. It starts with the same marker as a compact code but with @link IRProtocol_Macro @endlink as the protocol, so sending the command number a macro is stored under plays the macro. Turning on the TV, the receiver and the player is then a single command instead of three round trips with pauses in between.
+
+ The macro is played back by macroPoll() which the main loop calls whenever it is idle. It never waits: it tells the main loop what to do next – queue a code on the send queue or prefetch the next one from the EEPROM during the delay – and returns. So commands keep being received while a macro is playing and a macro can be aborted with abortMacro().
+
+ Macros can not contain other macros. Steps referring to a macro or to an empty command are skipped.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** Maximum number of steps in a macro. */
+#define MACRO_MAX_STEPS 16
+
+/** Pause in ms between the transmissions of a step that is sent more than once. */
+#define MACRO_REPEAT_GAP 40
+
+/** Header of a macro. The first three bytes match @link IRCode @endlink so the formats can be told apart. */
+typedef struct {
+	/** Always @link IRCODE_MARKER @endlink */
+	uint16_t marker;
+	/** Always @link IRProtocol_Macro @endlink */
+	uint8_t protocol;
+	/** Number of steps following the header */
+	uint8_t steps;
+} MacroHeader;
+
+/** A step of a macro. */
+typedef struct {
+	/** The command number to send */
+	uint8_t command;
+	/** Number of extra transmissions of the command */
+	uint8_t repeat;
+	/** Delay in ms after the last transmission before the next step */
+	uint16_t delay;
+} MacroStep;
+
+/** What the main loop should do next. */
+typedef enum {
+	/** Nothing */
+	MacroAction_None = 0,
+	/** Send the command */
+	MacroAction_Send = 1,
+	/** Read the command from the EEPROM so it is ready when it is to be sent */
+	MacroAction_Prefetch = 2
+} MacroAction;
+
+/** Returns the size in bytes of a macro with a number of steps. */
+#define MACRO_SIZE( steps ) (sizeof( MacroHeader ) + (steps) * sizeof( MacroStep ))
+
+/** Starts playing a macro. Any macro already playing is aborted.
+ @param data Pointer to the macro. The steps are copied so the data may change afterwards.
+ @param len Length of the macro in bytes.
+ @return 1 if the macro was started or 0 if it is invalid.
+ */
+uint8_t startMacro( const unsigned char *data, unsigned int len );
+
+/** Stops the macro being played. A code already being sent is finished. */
+void abortMacro();
+
+/** Takes back the last @link MacroAction_Send @endlink so the next macroPoll() returns it again. Call this when the command could not be queued.
+ */
+void retryMacroStep();
+
+/** Checks whether a macro is being played.
+ @return Non-zero while a macro is playing.
+ */
+uint8_t macroActive();
+
+/** Advances the macro being played. Call this from the main loop whenever it is idle.
+ @param command Pointer to a variable which receives the command number for @link MacroAction_Send @endlink and @link MacroAction_Prefetch @endlink.
+ @return A @link MacroAction @endlink value.
+ */
+uint8_t macroPoll( uint8_t *command );
+
+/**@}*/
+
+#endif
@@ -14,14 +14,31 @@
 #include <string.h>
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/power.h>
 #include "infrared.h"
+#include "irprotocol.h"
+#include "ircompress.h"
+#include "irframes.h"
 #include "24c_eeprom.h"
-#include "i2cmaster.h"
+#include "codestore.h"
+#include "codecache.h"
+#include "irstream.h"
+#include "twi.h"
+#include "serial.h"
+#include "frame.h"
+#include "clock.h"
+#include "macro.h"
+#include "sendqueue.h"
+#include "led.h"
 
-#define RED_ON		PORTB |= (1<< PB1); PORTB &= ~(1<< PB0);
-#define GREEN_ON	PORTB |= (1<< PB0); PORTB &= ~(1<< PB1);
-#define YELLOW_ON	PORTB |= (1<< PB0) | (1<< PB1);	
-#define ALL_OFF		PORTB &= ~(1<< PB0) & ~(1<< PB1);
+// LED patterns. Times are in units of LED_UNIT_MS (10 ms).
+static const LEDStep ledBoot[] PROGMEM = { { LED_Red, 20 }, { LED_Yellow, 20 }, { LED_Green, 20 }, { LED_Background, 0 } };
+static const LEDStep ledLearning[] PROGMEM = { { LED_Yellow, 0 } };
+static const LEDStep ledLearned[] PROGMEM = { { LED_Off, 10 }, { LED_Green, 10 }, { LED_Off, 10 }, { LED_Green, 10 }, { LED_Off, 10 }, { LED_Background, 0 } };
+static const LEDStep ledError[] PROGMEM = { { LED_Red, 50 }, { LED_Background, 0 } };
+static const LEDStep ledNotStored[] PROGMEM = { { LED_Red, 10 }, { LED_Off, 10 }, { LED_Red, 10 }, { LED_Off, 10 }, { LED_Background, 0 } };
+static const LEDStep ledTransmit[] PROGMEM = { { LED_Red, 5 }, { LED_Background, 0 } };
 
 #if defined( DEBUG )
 #define DEBUG_PRINT( stream, msg, ... ) fprintf( stream, msg,  ##__VA_ARGS__ )
@@ -39,119 +56,350 @@ enum States
 	State_DidDisconnect,
 	State_SendTestCmd,
 	State_SendTestCmd2,
-	State_DidConnect
+	State_DidConnect,
+	State_SendProtocol,
+	State_Erase,
+	State_SetBaud,
+	State_StoreMacro,
+	State_Abort,
+	State_Status,
+	State_Press,
+	State_Release
 };
-volatile enum States state = State_NOOP;
-volatile uint8_t nextCommand = 0;
-uint8_t currentCommand = 0;
+enum States state = State_NOOP;
+uint8_t nextCommand = 0;
+uint8_t sendFlags = 0;	// SENDJOB_ flags for the send command
+IRCode currentCode;		// Compact code for the command being sent. The protocol is IRProtocol_Raw if the code is raw pulse durations instead.
+IRCode protocolCode;	// Code received with the 'P' command
+uint32_t requestedBaud;	// Baud rate received with the 'B' command
 
-/* Precompiler stuff for calculating USART baud rate value 
- * Otherwise, use this page: http://www.wormfood.net/avrbaudcalc.php?postbitrate=9600&postclock=12&bit_rate_table=on
- */
-//#define USART_BAUDRATE 2400	// error 0.2% for 1.5 MHz
-#define USART_BAUDRATE 9600	// error 0.2%
-#define BAUD_PRESCALE (((F_CPU / (USART_BAUDRATE * 16UL))) - 1) 
+#define BAUD_CONFIRM_TIMEOUT	1000	// ms to wait for the host to confirm a new baud rate
 
-#define RX_BUF_SIZE	20
-unsigned char usartBuffer[RX_BUF_SIZE];		// USART receive buffer
-volatile unsigned char usartBufPtr=0;		// USART buffer pointer
+#define HOLD_PERIOD		108		// ms between the transmissions of a held raw or compressed code without a learned frame period
+#define HOLD_MAX_TIME	20000	// ms after which a held command is released anyway – in case the release is lost
+uint8_t holding = 0;			// Set while a command is held down
+uint8_t holdNative = 0;			// Set when the held code repeats by itself (compact codes)
+uint8_t holdCommand;
+uint16_t holdStart;				// millis() when the command was pressed
+uint16_t holdLast;				// millis() when the held code was last sent
+uint16_t holdPeriod = HOLD_PERIOD;	// ms between the transmissions of the held code
 
-// Serial stream
-static int uart_putchar( char c, FILE *stream );
-FILE mystdout = FDEV_SETUP_STREAM( uart_putchar, NULL, _FDEV_SETUP_WRITE );
+#define LINE_SIZE	64		// Room for a macro with a few steps
+#define lineBuffer ((char*)frameBuffer)	// Command line being received. A frame only starts at the beginning of a line so the two never overlap.
+uint8_t linePos = 0;
+uint8_t lineOverflow = 0;		// Set when the line is too long – the rest of it is ignored
 
 unsigned char recordBuffer[256];
+unsigned char *codeData;		// Code being sent. Points into the code cache or the stream buffer.
+unsigned int codeLength;		// Length of the code loaded by loadCommand()
+uint8_t codeCarrier;			// Carrier frequency in kHz of the code loaded by loadCommand() or 0 for the default
+uint8_t codeRepeat;				// Repeat frames of the compressed code loaded by loadCommand()
+uint16_t codePeriod;			// Frame repeat period in ms of the code loaded by loadCommand() or 0 if unknown
+uint8_t codeCorrupt;			// Set by loadCommand() when the stored code failed its header or CRC check
+uint8_t codeStreamed;			// Set by loadCommand() when the code is sent from the EEPROM with streamIR()
+uint32_t spillAddress;			// EEPROM address for a long code being learned
+unsigned int spillRoom;			// Bytes that can be written at spillAddress
+unsigned int spillWritten;		// Bytes of the long code written so far
+unsigned int macroLength;		// Length of the macro received with the 'M' command. The macro is in recordBuffer.
 unsigned int i;
 
-// Enables USART comm
-void enable_serial()
+// Splits off the next space separated token and returns it. Returns 0 if there are no more tokens.
+static char *nextToken( char **ptr )
 {
-	UCSR0B |= (1<< RXEN0) | (1<< TXEN0);	// Enable TX and RX (8N1 serial format set by default)
-	UBRR0H = (BAUD_PRESCALE >> 8) & 0x0F;	// High part of baud rate masked so bits 15:12 are writted as 0 as per the datasheet (19.10.5)
-	UBRR0L = BAUD_PRESCALE;					// Low part of baud rate. Writing to UBBRnL updates baud prescaler
-	UCSR0B |= (1<< RXCIE0);					// Enable USART RX interrupt
+	char *token;
+	
+	while( **ptr == ' ' )
+		(*ptr)++;
+	if( **ptr == 0 )
+		return 0;
+	
+	token = *ptr;
+	while( **ptr && **ptr != ' ' )
+		(*ptr)++;
+	if( **ptr )
+		*(*ptr)++ = 0;
+	
+	return token;
 }
 
-static int uart_putchar(char c, FILE *stream)
+// Parses a hex or decimal number token. Returns 0 if the token contains anything else.
+static uint8_t parseNumber( char *token, uint8_t base, uint32_t *value )
 {
-	// Wait until we're ready to send
-	while( !(UCSR0A & (1<< UDRE0)))
-		;
+	uint8_t digit;
 	
-	// Send byte
-	UDR0 = c;
-	return 0;
+	if( !token )
+		return 0;
+	
+	for( *value = 0; *token; token++ )
+	{
+		if( *token >= '0' && *token <= '9' )
+			digit = *token - '0';
+		else if( base == 16 && (*token & ~0x20) >= 'A' && (*token & ~0x20) <= 'F' )
+			digit = (*token & ~0x20) - 'A' + 10;
+		else
+			return 0;
+		*value = *value * base + digit;
+	}
+	
+	return 1;
 }
 
-// Interrupt handler for USART receive complete
-ISR( USART_RX_vect ) 
-{ 
-	// Prevent buffer overflow
-	if( usartBufPtr >= RX_BUF_SIZE-1 )
-		usartBufPtr = 0;
-	
-	// Grab the data and but it into the buffer and increase pointer
-	usartBuffer[ usartBufPtr++ ] = UDR0;
+/* Parses a complete command line and sets the state accordingly.
+ * Commands taking a command number ('S', 'L' and 'E') are ignored if the number is missing or invalid.
+ */
+static void parseCommand( char *line )
+{
+	char *command = nextToken( &line );
+	uint32_t number, protocol, address, code, repeat, delay;
+	MacroHeader *macro = (MacroHeader*)recordBuffer;
+	MacroStep *step;
 	
-	// TMP: Echo char to serial stream
-	fputc( usartBuffer[ usartBufPtr-1 ], &mystdout );
-	if( usartBuffer[ usartBufPtr-1 ] == 0x0A )
-		fputc( '\r', &mystdout );
+	if( !command )
+		return;
 	
-	// Check for "terminate command" byte (0x0A, \n, LF)
-	if( usartBuffer[ usartBufPtr-1 ] == 0x0A )
+	switch( command[0] )
 	{
-		// Parse command number
-		// NOTE: This *may* result in an outdated or garbage value if no command number has been sent (e.g. for 'T' and 'Y' commands).
-		nextCommand = (usartBuffer[2] - '0')*100 + (usartBuffer[3] - '0')*10 + (usartBuffer[4] - '0');
-		
-		if( usartBuffer[0] == 'S' )
-		{
-			// Send command
-			state = State_Send;
-		}
-		else if( usartBuffer[0] == 'L' )
-		{
-			// Learn signal
-			state = State_Learn;
-		}
-		else if( usartBuffer[0] == 'D' )
-		{
-			// Write signal to serial
+		case 'S':
+		case 'L':
+		case 'E':
+		case 'H':
+			// Send, learn, erase or press (hold) command. "S! n" is an urgent send which stops the code being sent.
+			if( !parseNumber( nextToken( &line ), 10, &number ) || number > 255 )
+				return;
+			nextCommand = number;
+			sendFlags = (command[0] == 'S' && command[1] == '!') ? SENDJOB_URGENT : 0;
+			state = (command[0] == 'S') ? State_Send : (command[0] == 'L') ? State_Learn : (command[0] == 'E') ? State_Erase : State_Press;
+			break;
+			
+		case 'R':
+			// Release held command
+			state = State_Release;
+			break;
+			
+		case 'D':
+			// Disconnected
 			state = State_DidDisconnect;
-		}
-		else if( usartBuffer[0] == 'T' )
-		{
-			// Write signal to serial
+			break;
+			
+		case 'T':
 			state = State_SendTestCmd;
-		}
-		else if( usartBuffer[0] == 'Y' )
-		{
-			// Write signal to serial
+			break;
+			
+		case 'Y':
 			state = State_SendTestCmd2;
-		}
-		else if( usartBuffer[0] == 'C' )
-		{
+			break;
+			
+		case 'C':
 			// Connected
 			state = State_DidConnect;
+			break;
+			
+		case 'P':
+			// Send protocol code: "P p aaaa cccc [r]" with protocol number, hex address, hex command and optional number of repeats
+			if( !parseNumber( nextToken( &line ), 10, &protocol ) || !parseNumber( nextToken( &line ), 16, &address ) || !parseNumber( nextToken( &line ), 16, &code ))
+				return;
+			if( !parseNumber( nextToken( &line ), 10, &repeat ))
+				repeat = 0;
+			
+			protocolCode.marker = IRCODE_MARKER;
+			protocolCode.protocol = protocol;
+			protocolCode.address = address;
+			protocolCode.command = code;
+			protocolCode.repeat = repeat;
+			
+			// Sony frame length is given by the address size
+			protocolCode.bits = (protocolCode.address > 0xFF) ? 20 : (protocolCode.address > 0x1F) ? 15 : 12;
+			state = State_SendProtocol;
+			break;
+			
+		case 'M':
+			// Store macro: "M n c r d [c r d ...]" with the command number followed by command number, extra transmissions and delay in ms for each step
+			if( !parseNumber( nextToken( &line ), 10, &number ) || number > 255 )
+				return;
+			macro->marker = IRCODE_MARKER;
+			macro->protocol = IRProtocol_Macro;
+			macro->steps = 0;
+			step = (MacroStep*)(recordBuffer + sizeof( MacroHeader ));
+			while( parseNumber( nextToken( &line ), 10, &code ))
+			{
+				if( code > 255 || !parseNumber( nextToken( &line ), 10, &repeat ) || repeat > 255 ||
+				    !parseNumber( nextToken( &line ), 10, &delay ) || delay > 0xFFFF || macro->steps == MACRO_MAX_STEPS )
+					return;
+				step->command = code;
+				step->repeat = repeat;
+				step->delay = delay;
+				step++;
+				macro->steps++;
+			}
+			if( macro->steps == 0 )
+				return;
+			nextCommand = number;
+			macroLength = MACRO_SIZE( macro->steps );
+			state = State_StoreMacro;
+			break;
+			
+		case 'A':
+			// Abort macro and all queued commands
+			state = State_Abort;
+			break;
+			
+		case '?':
+			// Busy query
+			state = State_Status;
+			break;
+			
+		case 'B':
+			// Change baud rate: "B nnnnnn"
+			if( !parseNumber( nextToken( &line ), 10, &requestedBaud ))
+				return;
+			state = State_SetBaud;
+			break;
+			
+		default:
+			// (Unknown commands are ignored)
+			break;
+	}
+}
+
+int commandLength( unsigned char *ptr )
+{
+	unsigned int *data = (unsigned int*)ptr;
+	unsigned int i=0;
+	
+	while( *data++ )
+		i++;
+	
+	return i;
+}
+
+/* Checks whether a code is sent from the EEPROM with streamIR() instead of from the code cache */
+static uint8_t streamedCode( StoreEntry *entry, CodeHeader *header )
+{
+	return header->encoding == IRProtocol_Raw || (header->encoding == IRProtocol_Compressed && entry->length > CODECACHE_ARENA_SIZE);
+}
+
+/* Loads the specified command and returns a pointer to the code or 0 if nothing is stored or the code is corrupt (codeCorrupt is set then).
+ * Recently used codes are served from the SRAM code cache. Otherwise the code header tells us how the code is encoded and exactly how many bytes to read.
+ * Raw codes and compressed codes too long for the cache are not cached: only their first chunk is read and the rest is streamed from the EEPROM while sending. Their CRC is checked the first time they are sent.
+ */
+unsigned char *loadCommand( uint8_t commandNumber )
+{
+	StoreEntry entry;
+	CodeHeader header;
+	unsigned char *data, *cached;
+	unsigned int len;
+	
+	codeCorrupt = 0;
+	codeStreamed = 0;
+	data = cacheLookup( commandNumber, &len );
+	if( !data )
+	{
+		if( !readCodeHeader( commandNumber, &entry, &header ))
+		{
+			codeCorrupt = (entry.address != STORE_EMPTY);
+			return 0;
 		}
 		
-
-		// (Unknown commands are ignored)
+		if( streamedCode( &entry, &header ))
+		{
+			if( !verifyCommand( commandNumber ))
+			{
+				codeCorrupt = 1;
+				return 0;
+			}
+			currentCode.protocol = header.encoding;
+			codeLength = header.length;
+			codeCarrier = header.carrier;
+			codeRepeat = header.repeat;
+			codePeriod = header.period;
+			codeStreamed = 1;
+			if( header.encoding == IRProtocol_Raw )
+				return beginStream( entry.address + sizeof( header ), header.length );
+			
+			data = beginCompressedStream( entry.address + sizeof( header ), header.length );
+			codeCorrupt = !data;
+			return data;
+		}
 		
-		// Reset RX buffer
-		usartBufPtr = 0;
+		// Read header and code into the cache and check the CRC before using it
+		cached = cacheInsert( commandNumber, entry.length );
+		if( !cached )
+			return 0;
+		readData( entry.address, cached, entry.length );
+		if( !checkCode( &header, cached + sizeof( header )))
+		{
+			cacheInvalidate( commandNumber );
+			codeCorrupt = 1;
+			return 0;
+		}
+		data = cached;
+		DEBUG_PRINT( &mystdout, "Read %d bytes from EEPROM address %lu\r\n", entry.length, (unsigned long)entry.address );
 	}
+	else
+		memcpy( &header, data, sizeof( header ));
+	DEBUG_PRINT( &mystdout, "Cache hits %u misses %u\r\n", cacheHits, cacheMisses );
+	
+	data += sizeof( header );
+	codeLength = header.length;
+	codeRepeat = header.repeat;
+	codePeriod = header.period;
+	memcpy( &currentCode, data, sizeof( currentCode ));
+	
+	// Compact codes without a measured carrier frequency use the protocol's usual one
+	codeCarrier = header.carrier;
+	if( !codeCarrier && header.encoding != IRProtocol_Compressed && header.encoding != IRProtocol_Macro )
+		codeCarrier = protocolCarrier( header.encoding );
+	return data;
 }
 
-static inline int addressForCommand( uint8_t commandNumber )
+/* Reads a code into the code cache ahead of time – for the macro player.
+ * Unlike loadCommand() this leaves the code being sent alone: codeData, codeLength, codeCarrier, currentCode and the stream buffers may belong to a job that is still queued. Streamed codes are not read at all.
+ */
+static void prefetchCommand( uint8_t commandNumber )
 {
-	return commandNumber * 2 * 128;	// EEPROM address is simple page size times command index times two (since each command takes up
+	StoreEntry entry;
+	CodeHeader header;
+	unsigned char *cached;
+	unsigned int len;
+	
+	if( cacheLookup( commandNumber, &len ) || !readCodeHeader( commandNumber, &entry, &header ) || streamedCode( &entry, &header ))
+		return;
+	
+	cached = cacheInsert( commandNumber, entry.length );
+	if( !cached )
+		return;
+	readData( entry.address, cached, entry.length );
+	if( !checkCode( &header, cached + sizeof( header )))
+		cacheInvalidate( commandNumber );
 }
 
-void learn()
+/* Writes a part of a long code being learned straight to the code store. The store is compacted only when the code outgrows the free space.
+ */
+static uint8_t spillCode( unsigned int offset, unsigned char *data, uint8_t len )
+{
+	if( offset + len > spillRoom )
+	{
+		spillRoom = growSpill( &spillAddress, spillWritten );
+		if( offset + len > spillRoom )
+			return 0;
+	}
+	
+	writeData( spillAddress + offset, data, len );
+	commitWrites();
+	if( offset + len > spillWritten )
+		spillWritten = offset + len;
+	
+	return 1;
+}
+
+uint8_t learn()
 {
 	IRError status;
+	IRCode code;
+	CodeHeader header;
+	LearnedFrames frames;
+	unsigned int size;
+	uint8_t stored;
 #ifdef DEBUG
 	unsigned int *data;
 	unsigned int i;
@@ -165,70 +413,629 @@ void learn()
 	// Read IR sequence
 	DEBUG_PRINT( &mystdout, "LEARN\r\n" );
 	
-	YELLOW_ON;	
-	status = learnIR( recordBuffer );
-	ALL_OFF;
+	playLED( ledLearning );
+	spillRoom = beginSpill( &spillAddress );
+	spillWritten = 0;
+	status = learnFrames( recordBuffer, spillCode, STORE_MAX_LENGTH - sizeof( CodeHeader ), &frames );
 	
 	if( status != IRError_NoError )
 	{
 		// Error:
 		DEBUG_PRINT( &mystdout, "Error: %d\n\r", status );
 		
-		// Restore saved code
-		readData( addressForCommand( currentCommand ), recordBuffer, 256 );
-		DEBUG_PRINT( &mystdout, "Restored byte sequence from EEPROM" );
-		
 		// Flash RED
-		RED_ON;
-		_delay_ms( 500 );
-		GREEN_ON;	// We switch back to green since we know we're connected. (Otherwise we couldn't send a code.)
+		playLED( ledError );
+		return 0;
 	}
 	else
 	{
-		// No error: print data
-		DEBUG_PRINT( &mystdout, "Read code: " );
+		// Repeat frames seen while learning
+		header.repeat = frames.repeat;
+		header.period = frames.period;
+		DEBUG_PRINT( &mystdout, "%d frames, %d repeats every %u ms ", frames.frames, frames.repeat, frames.period );
+		
+		// The measured carrier frequency (if any) goes in the header
+		header.carrier = learnedCarrier;
+		DEBUG_PRINT( &mystdout, "Carrier %d kHz ", learnedCarrier );
+		
+		if( learnedLength )
+		{
+			// A long code has been compressed and written to the EEPROM while it was being received
+			DEBUG_PRINT( &mystdout, "Long code compressed to %u bytes... ", learnedLength );
+			header.encoding = IRProtocol_Compressed;
+			stored = storeSpilledCommand( nextCommand, &header, learnedLength );
+		}
+		else
+		{
+			// No error: print data
+			DEBUG_PRINT( &mystdout, "Read code: " );
 #ifdef DEBUG
-		data = (unsigned int*)recordBuffer;
-		i=0;
-		while( *data )
+			data = (unsigned int*)recordBuffer;
+			i=0;
+			while( *data )
+			{
+				DEBUG_PRINT( &mystdout, "%04x-", *data++ );
+				DEBUG_PRINT( &mystdout, "%04x ", *data++ );
+				i += 2;
+			}
+#endif
+			DEBUG_PRINT( &mystdout, "00 <end>\r\n" );
+			
+			// Store command in EEPROM: compact record if we recognize the protocol, otherwise the compressed or raw pulse durations
+			if( decodeIR( (unsigned int*)recordBuffer, &code ))
+			{
+				DEBUG_PRINT( &mystdout, "Protocol %d address %04x command %04x repeat %d\r\n", code.protocol, code.address, code.command, code.repeat );
+				if( frames.repeat > code.repeat )
+					code.repeat = frames.repeat;
+				memcpy( recordBuffer, &code, sizeof( code ));
+				size = sizeof( code );
+				header.encoding = code.protocol;
+				header.repeat = code.repeat;
+			}
+			else if( (size = compressIR( recordBuffer )) )
+			{
+				DEBUG_PRINT( &mystdout, "Storing %d pulses compressed to %d bytes... ", i, size );
+				header.encoding = IRProtocol_Compressed;
+			}
+			else
+			{
+				size = (commandLength( recordBuffer ) + 1) * sizeof( unsigned int );	// Including the 0 terminator
+				DEBUG_PRINT( &mystdout, "Storing %d bytes in EEPROM... ", size );
+				header.encoding = IRProtocol_Raw;
+			}
+			stored = storeCommand( nextCommand, &header, recordBuffer, size );
+		}
+		if( !stored )
 		{
-			DEBUG_PRINT( &mystdout, "%04x-", *data++ );
-			DEBUG_PRINT( &mystdout, "%04x ", *data++ );
-			i += 2;
+			// No room in the EEPROM: flash RED
+			DEBUG_PRINT( &mystdout, "EEPROM full.\r\n" );
+			playLED( ledError );
+			return 0;
 		}
+#ifdef DEBUG
+		flushWrites();
 #endif
-		DEBUG_PRINT( &mystdout, "00 <end>\r\n" );
+		DEBUG_PRINT( &mystdout, "Done. Write cycle %u us, durable after %u us\r\n", writeCycleTime, durableTime );
 		
-		// Store command in EEPROM
-		DEBUG_PRINT( &mystdout, "Storing %d bytes in EEPROM at address %d... ", i, addressForCommand( nextCommand ));
-		writePage( addressForCommand( nextCommand ), recordBuffer, 128 );		// First page
-		writePage( addressForCommand( nextCommand )+128	, recordBuffer+128, 128 );	// Second page
-		DEBUG_PRINT( &mystdout, "Done.\r\n" );
+		// The cached copy of the old code is outdated
+		cacheInvalidate( nextCommand );
 		
 		// Flash GREEN twice
-		ALL_OFF;
-		_delay_ms( 100 );
-		GREEN_ON;			// Flash
-		_delay_ms( 100 );
-		ALL_OFF;
-		_delay_ms( 100 );
-		GREEN_ON;			// Flash
-		_delay_ms( 100 );
-		ALL_OFF;
-		_delay_ms( 100 );
-		GREEN_ON;			// Remain on (since we're connected)
+		playLED( ledLearned );
 	}
+	
+	return 1;
 }
 
-int commandLength( unsigned char *ptr )
+/* Flashes RED twice to tell that no code is stored for a command */
+static void flashNotStored()
 {
-	unsigned int *data = (unsigned int*)ptr;
-	unsigned int i=0;
+	playLED( ledNotStored );
 	
-	while( *data++ )
-		i++;
+	DEBUG_PRINT( &mystdout, "No IR code stored – not transmitting.\r\n" );
+}
+
+/* Stops repeating the held command. A compact code finishes its current frame. */
+static void releaseHold()
+{
+	holding = 0;
+	holdIRCode( 0 );
+}
+
+/* Sends a stored command – or starts playing it if it is a macro. Steps of a macro can not start another macro.
+ * This is called for the jobs of the send queue which are only handed out when the transmitter is idle.
+ * Returns a FrameStatus value.
+ */
+static uint8_t sendCommand( uint8_t commandNumber, uint8_t flags )
+{
+	// Send sequence: get the code from the cache or the EEPROM
+	codeData = loadCommand( commandNumber );
+	DEBUG_PRINT( &mystdout, "Loaded command %d\r\n", commandNumber );
 	
-	return i;
+	// Do we have valid data for the specified command? (It may have been erased after it was queued.)
+	if( !codeData )
+	{
+		if( codeCorrupt )
+		{
+			DEBUG_PRINT( &mystdout, "Command %d is corrupt\r\n", commandNumber );
+			playLED( ledError );
+			return FrameStatus_Failed;
+		}
+		flashNotStored();
+		return FrameStatus_NotStored;
+	}
+	
+	if( currentCode.protocol == IRProtocol_Macro )
+	{
+		if( (flags & SENDJOB_MACRO) || !startMacro( codeData, codeLength ))
+			return FrameStatus_Failed;
+		holding = 0;
+		DEBUG_PRINT( &mystdout, "Playing macro %d\r\n", commandNumber );
+		return FrameStatus_OK;
+	}
+	
+	// Yes, we do: send it when the previous code is done
+	while( isSendingIR() )
+		;
+	playLED( ledTransmit );
+	DEBUG_PRINT( &mystdout, "Transmitting...\r\n" );
+	
+	setCarrier( codeCarrier );
+	
+	// A held compact code repeats itself at the protocol's frame period. Other codes are sent again by runHold().
+	if( (flags & SENDJOB_HOLD) && holding )
+	{
+		holdNative = (currentCode.protocol != IRProtocol_Raw && currentCode.protocol != IRProtocol_Compressed);
+		holdIRCode( holdNative );
+		holdLast = millis();
+		
+		// A learned code keeps its frame rhythm: the next transmission starts one period after its last frame
+		holdPeriod = codePeriod ? codePeriod * (codeRepeat + 1) : HOLD_PERIOD;
+	}
+	
+	if( codeStreamed )
+		streamIR( codeRepeat, codePeriod );
+	else if( currentCode.protocol == IRProtocol_Compressed )
+		sendCompressedIR( codeData, codeRepeat, codePeriod );
+	else
+		sendIRCode( &currentCode );
+	
+	return FrameStatus_OK;
+}
+
+/* Starts the next job of the send queue when the transmitter is idle */
+static void runQueue()
+{
+	SendJob *job = nextSendJob();
+	
+	if( job && sendCommand( job->command, job->flags ) != FrameStatus_OK )
+		sendJobFailed();
+}
+
+/* Sends the held command again every holdPeriod ms unless it repeats by itself */
+static void runHold()
+{
+	if( !holding )
+		return;
+	
+	if( (uint16_t)(millis() - holdStart) >= HOLD_MAX_TIME )
+	{
+		DEBUG_PRINT( &mystdout, "Hold timeout\r\n" );
+		releaseHold();
+		return;
+	}
+	
+	if( !holdNative && !sendQueueBusy() && (uint16_t)(millis() - holdLast) >= holdPeriod )
+		queueSend( holdCommand, SENDJOB_HOLD );
+}
+
+/* Lets the macro player take its next step */
+static void runMacro()
+{
+	uint8_t command;
+	
+	switch( macroPoll( &command ))
+	{
+		case MacroAction_Send:
+			// The queue may be full of commands received meanwhile: try again on the next pass
+			if( !queueSend( command, SENDJOB_MACRO ))
+				retryMacroStep();
+			break;
+			
+		case MacroAction_Prefetch:
+			// Get the next code into the cache during the delay. Not while a code is being sent since making room in the cache waits for the transmitter.
+			if( !isSendingIR() )
+				prefetchCommand( command );
+			break;
+	}
+}
+
+/* Waits for the host to send a "B" line at the new baud rate. Anything else – including garbage received while the rates differed – is ignored. */
+static uint8_t confirmBaudRate()
+{
+	uint16_t ms;
+	int c;
+	
+	linePos = 0;
+	for( ms = 0; ms < BAUD_CONFIRM_TIMEOUT; ms++ )
+	{
+		while( (c = serialRead()) >= 0 )
+		{
+			if( c == 0x0A )
+			{
+				if( linePos == 1 && lineBuffer[0] == 'B' )
+				{
+					linePos = 0;
+					return 1;
+				}
+				linePos = 0;
+			}
+			else if( c != '\r' && linePos < LINE_SIZE-1 )
+				lineBuffer[ linePos++ ] = c;
+		}
+		_delay_ms( 1 );
+	}
+	
+	linePos = 0;
+	return 0;
+}
+
+/* Executes a command and returns a FrameStatus value */
+static uint8_t execute( enum States command )
+{
+	uint8_t status = FrameStatus_OK;
+	uint32_t oldBaud;
+	CodeHeader header;
+	
+	// Anything but a status query releases the held command: a held compact code keeps the transmitter busy until it is released, so waiting for the transmitter would never end
+	if( command != State_Status )
+		releaseHold();
+	
+	// Что делать?
+	switch( command )
+	{
+		case State_Learn:
+			// Lean IR code. Timer1 can't send and learn at the same time.
+			abortMacro();
+			while( isSendingIR() )
+				;
+			if( !learn() )
+				status = FrameStatus_Failed;
+			break;
+			
+		case State_Send:
+		case State_Press:
+			// Queue the command. The main loop sends it when the transmitter is free. Another command releases the one being held.
+			// The index tells without EEPROM access whether anything is stored
+			if( !commandStored( nextCommand ))
+			{
+				flashNotStored();
+				status = FrameStatus_NotStored;
+			}
+			else if( commandEncoding( nextCommand ) == STORE_ENCODING_INVALID )
+			{
+				playLED( ledError );
+				status = FrameStatus_Failed;
+			}
+			else if( command == State_Press )
+			{
+				// Held until released
+				if( !queueSend( nextCommand, SENDJOB_HOLD ))
+					status = FrameStatus_Failed;
+				else
+				{
+					holding = 1;
+					holdNative = 0;
+					holdCommand = nextCommand;
+					holdStart = millis();
+				}
+			}
+			else if( !queueSend( nextCommand, sendFlags ))
+				status = FrameStatus_Failed;
+			sendFlags = 0;
+			break;
+			
+		case State_Release:
+			// Released above
+			break;
+			
+		case State_SendProtocol:
+			// Send code generated from protocol, address and command – no EEPROM access
+			while( isSendingIR() )
+				;
+			playLED( ledTransmit );
+			DEBUG_PRINT( &mystdout, "Transmitting protocol %d address %04x command %04x\r\n", protocolCode.protocol, protocolCode.address, protocolCode.command );
+			setCarrier( protocolCarrier( protocolCode.protocol ));
+			sendIRCode( &protocolCode );
+			break;
+
+		case State_Erase:
+			// Delete the stored code. The space is reclaimed when the EEPROM is full.
+			freeCommand( nextCommand );
+			cacheInvalidate( nextCommand );
+			DEBUG_PRINT( &mystdout, "Erased command %d\r\n", nextCommand );
+			break;
+
+		case State_StoreMacro:
+			// The macro from the 'M' command is in recordBuffer
+			header.encoding = IRProtocol_Macro;
+			header.carrier = 0;
+			header.repeat = 0;
+			header.period = 0;
+			if( !storeCommand( nextCommand, &header, recordBuffer, macroLength ))
+				status = FrameStatus_Failed;
+			cacheInvalidate( nextCommand );
+			DEBUG_PRINT( &mystdout, "Stored macro %d with %d steps\r\n", nextCommand, ((MacroHeader*)recordBuffer)->steps );
+			break;
+			
+		case State_Abort:
+			abortMacro();
+			abortSendQueue();
+			break;
+			
+		case State_Status:
+			// Number of commands queued or being sent
+			fprintf_P( &mystdout, PSTR( "BUSY %d\r\n" ), sendQueueBusy() );
+			fprintf_P( &mystdout, PSTR( "STORE %u %u\r\n" ), storedCommands, storeScanTime );
+			break;
+			
+		case State_SetBaud:
+			// Change baud rate: acknowledge at the old rate, switch and wait for the host to confirm at the new rate
+			if( !baudRateSupported( requestedBaud ))
+			{
+				fprintf_P( &mystdout, PSTR( "B ERR\r\n" ));
+				status = FrameStatus_Failed;
+				break;
+			}
+			
+			oldBaud = baudRate;
+			fprintf_P( &mystdout, PSTR( "B %lu\r\n" ), (unsigned long)requestedBaud );
+			setBaudRate( requestedBaud );
+			if( confirmBaudRate() )
+				fprintf_P( &mystdout, PSTR( "B OK\r\n" ));
+			else
+			{
+				// No answer: the host did not follow – go back to the old rate
+				setBaudRate( oldBaud );
+				status = FrameStatus_Failed;
+			}
+			break;
+
+		case State_DidDisconnect:
+			// Disconnect: turn off GREEN. The held command has been released above since nobody is left to release it.
+			setLED( LED_Off );
+			break;
+			
+		case State_DidConnect:
+			// Connect: turn on GREEN
+			setLED( LED_Green );
+			break;
+			
+		default:
+			break;
+	}
+	
+	return status;
+}
+
+/* Executes the operations in a received frame and sends the reply frame.
+ * The reply is put together in recordBuffer. A learn operation needs recordBuffer itself, so it moves the reply to frameBuffer and ends the batch.
+ */
+static void runFrame()
+{
+	unsigned char *reply = recordBuffer;
+	uint8_t pos = 0, replyLen = 0, status, op, ops = 0, size;
+	unsigned int args, len;
+	StoreEntry entry;
+	CodeHeader header;
+	
+	while( pos < frameLength )
+	{
+		op = frameBuffer[ pos ];
+		
+		// Stop before the reply frame overflows – leaving room for the Truncated status and the number of operations executed
+		size = (op == FrameOp_Info) ? 5 : (op == FrameOp_Query) ? 3 : (op == FrameOp_Busy) ? 2 : 1;
+		if( replyLen + size + 2 > FRAME_MAX_PAYLOAD )
+		{
+			reply[ replyLen++ ] = FrameStatus_Truncated;
+			reply[ replyLen++ ] = ops;
+			break;
+		}
+		pos++;
+		ops++;
+		
+		// Number of argument bytes
+		switch( op )
+		{
+			case FrameOp_Send:
+			case FrameOp_Urgent:
+			case FrameOp_Press:
+			case FrameOp_Learn:
+			case FrameOp_Erase:
+			case FrameOp_Query:
+				args = 1;
+				break;
+			case FrameOp_Protocol:
+				args = 6;
+				break;
+			case FrameOp_Upload:
+				args = (pos + 1 < frameLength) ? 2 + frameBuffer[ pos+1 ] : 2;
+				break;
+			case FrameOp_Info:
+			case FrameOp_Abort:
+			case FrameOp_Busy:
+			case FrameOp_Release:
+				args = 0;
+				break;
+			default:
+				args = 0xFF;
+				break;
+		}
+		if( args > (unsigned int)(frameLength - pos) )
+		{
+			// Unknown operation or arguments missing: we can't tell where the next operation starts
+			reply[ replyLen++ ] = FrameStatus_BadOp;
+			break;
+		}
+		
+		status = FrameStatus_OK;
+		switch( op )
+		{
+			case FrameOp_Send:
+			case FrameOp_Urgent:
+				nextCommand = frameBuffer[ pos ];
+				sendFlags = (op == FrameOp_Urgent) ? SENDJOB_URGENT : 0;
+				status = execute( State_Send );
+				break;
+			case FrameOp_Learn:
+				// The operations after this one are not executed, so frameBuffer is free to hold the reply while learning
+				nextCommand = frameBuffer[ pos ];
+				memcpy( frameBuffer, reply, replyLen );
+				reply = frameBuffer;
+				status = execute( State_Learn );
+				break;
+			case FrameOp_Erase:
+				nextCommand = frameBuffer[ pos ];
+				status = execute( State_Erase );
+				break;
+			case FrameOp_Protocol:
+				protocolCode.marker = IRCODE_MARKER;
+				protocolCode.protocol = frameBuffer[ pos ];
+				protocolCode.address = frameBuffer[ pos+1 ] | (frameBuffer[ pos+2 ] << 8);
+				protocolCode.command = frameBuffer[ pos+3 ] | (frameBuffer[ pos+4 ] << 8);
+				protocolCode.repeat = frameBuffer[ pos+5 ];
+				protocolCode.bits = (protocolCode.address > 0xFF) ? 20 : (protocolCode.address > 0x1F) ? 15 : 12;
+				status = execute( State_SendProtocol );
+				break;
+			case FrameOp_Query:
+				// Reply with the length of the code without its header
+				if( readCodeHeader( frameBuffer[ pos ], &entry, &header ))
+					entry.length = header.length;
+				else
+				{
+					status = (entry.address == STORE_EMPTY) ? FrameStatus_NotStored : FrameStatus_Failed;
+					entry.length = 0;
+				}
+				break;
+			case FrameOp_Abort:
+				status = execute( State_Abort );
+				break;
+			case FrameOp_Press:
+				nextCommand = frameBuffer[ pos ];
+				status = execute( State_Press );
+				break;
+			case FrameOp_Release:
+				status = execute( State_Release );
+				break;
+			case FrameOp_Upload:
+				// The uploaded code comes with the header fields the receiver can't work out: encoding, carrier, repeat and period
+				// Replacing a cached code waits for the transmitter, which a held compact code never frees
+				releaseHold();
+				len = frameBuffer[ pos+1 ];
+				if( len <= FRAME_UPLOAD_HEADER )
+					status = FrameStatus_Failed;
+				else
+				{
+					header.encoding = frameBuffer[ pos+2 ];
+					header.carrier = frameBuffer[ pos+3 ];
+					header.repeat = frameBuffer[ pos+4 ];
+					header.period = frameBuffer[ pos+5 ] | (frameBuffer[ pos+6 ] << 8);
+					if( !storeCommand( frameBuffer[ pos ], &header, frameBuffer + pos + 2 + FRAME_UPLOAD_HEADER, len - FRAME_UPLOAD_HEADER ))
+						status = FrameStatus_Failed;
+				}
+				cacheInvalidate( frameBuffer[ pos ] );
+				break;
+		}
+		pos += args;
+		
+		reply[ replyLen++ ] = status;
+		if( op == FrameOp_Query )
+		{
+			reply[ replyLen++ ] = entry.length;
+			reply[ replyLen++ ] = entry.length >> 8;
+		}
+		else if( op == FrameOp_Info )
+		{
+			reply[ replyLen++ ] = framesReceived;
+			reply[ replyLen++ ] = framesReceived >> 8;
+			reply[ replyLen++ ] = frameErrors;
+			reply[ replyLen++ ] = frameErrors >> 8;
+		}
+		else if( op == FrameOp_Busy )
+			reply[ replyLen++ ] = sendQueueBusy();
+		else if( op == FrameOp_Learn && pos < frameLength )
+		{
+			// The room for this was kept by the overflow check above
+			reply[ replyLen++ ] = FrameStatus_Truncated;
+			reply[ replyLen++ ] = ops;
+			break;
+		}
+	}
+	
+	frameSend( frameSequence, reply, replyLen );
+}
+
+/* Takes received bytes out of the receive buffer until a complete command has been parsed or the buffer is empty.
+ * Several commands may be waiting – they are parsed one at a time by successive calls.
+ */
+static void readCommand()
+{
+	int c;
+	
+	while( state == State_NOOP && (c = serialRead()) >= 0 )
+	{
+		// Binary frames start with a sync byte which never starts a command line
+		if( frameActive() || (linePos == 0 && c == FRAME_SYNC) )
+		{
+			if( frameReceive( c ))
+				runFrame();
+			continue;
+		}
+		
+		// TMP: Echo char to serial stream
+		fputc( c, &mystdout );
+		if( c == 0x0A )
+			fputc( '\r', &mystdout );
+		
+		if( c == '\r' )
+			continue;
+		
+		// Check for "terminate command" byte (0x0A, \n, LF)
+		if( c == 0x0A )
+		{
+			lineBuffer[ linePos ] = 0;
+			if( !lineOverflow )
+				parseCommand( lineBuffer );
+			
+			// Start a new line
+			linePos = 0;
+			lineOverflow = 0;
+		}
+		else if( linePos < LINE_SIZE-1 )
+			lineBuffer[ linePos++ ] = c;
+		else
+			lineOverflow = 1;
+	}
+}
+
+/* Sleeps until the next interrupt if no received byte is waiting.
+ * Idle sleep mode keeps the USART, TWI and timers running. The millisecond clock wakes the CPU every 1 ms, so this halts the CPU between 1 kHz polls rather than sleeping deeply. The wake latency has not been measured.
+ * If nothing is going on at all – no code being sent, no queued jobs, macro or held command and no I2C traffic or STOP condition – the TWI and Timer0/Timer1 are also powered down until the CPU wakes up. Only the USART receive interrupt and the millisecond clock can wake it then.
+ */
+static void sleepUntilInterrupt()
+{
+	uint8_t powerDown;
+	
+	// Interrupts are disabled so a byte received after the check still wakes us: sleep_cpu() is executed before any pending interrupt
+	cli();
+	if( serialAvailable() )
+	{
+		sei();
+		return;
+	}
+	
+	// A STOP condition may still be going out after the last transaction has ended
+	powerDown = !isSendingIR() && !twiBusy() && !(TWCR & (1<< TWSTO)) && !sendQueueBusy() && !macroActive() && !holding;
+	if( powerDown )
+	{
+		power_twi_disable();
+		power_timer0_disable();
+		power_timer1_disable();
+	}
+	
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	
+	if( powerDown )
+	{
+		// The TWI must be initialized again after it has been powered down. Its queue is empty so no transaction is lost.
+		power_twi_enable();
+		twiInit();
+		power_timer0_enable();
+		power_timer1_enable();
+	}
 }
 
 int main(void)
@@ -238,100 +1045,49 @@ int main(void)
 	int i;
 #endif
 	
-	// Setup
+	// Setup. The ADC, SPI and analog comparator are never used.
+	power_adc_disable();
+	power_spi_disable();
+	ACSR |= (1<< ACD);
+	set_sleep_mode( SLEEP_MODE_IDLE );
 	enable_serial();
-	i2c_init();
+	twiInit();
+	initClock();
 	sei();
-	DDRB |= (1<< PB0);	// PB0 -> output for debugging GREEN
-	DDRB |= (1<< PB1);	// PB1 -> output for debugging RED
+	initLED();			// PB0 and PB1 -> outputs for GREEN and RED
 	DDRD |= (1<< PD5);	// OC0B/PD5 -> output
 	
-	// Zero the USART buffer
-	memset( usartBuffer, '0', RX_BUF_SIZE );
-	
 	// Init IR
 	initIR();
 		
 	DEBUG_PRINT( &mystdout, "BLE command mode\n\r" );
 
-	RED_ON;
-	_delay_ms( 200 );
-	YELLOW_ON;
-	_delay_ms( 200 );
-	GREEN_ON;
-	_delay_ms( 200 );
-	ALL_OFF;
+	playLED( ledBoot );
 
 	// Pull-up on I2C pins PC4 and PC5. Oops – someone forgot to put those resistors on the PCB…
 	PORTC |= (1<< PC4) | (1<< PC5);
 	
+	// Check the code store in the EEPROM and build the index
+	initStore( recordBuffer );
+	DEBUG_PRINT( &mystdout, "%u codes stored, index built in %u ms, %u EEPROM errors\r\n", storedCommands, storeScanTime, eepromErrors );
+	
 	// Main loop
 	for( ;; )
 	{
-		// Wait until a command has been received
+		// Wait until a command has been received. A macro keeps playing meanwhile. The queue is run last so jobs queued by the macro or the held command start right away.
 		while( state == State_NOOP )
-			;
-		
-		// Что делать?
-		switch( state )
 		{
-			case State_Learn:
-				// Lean IR code
-				learn();
-				break;
-				
-			case State_Send:
-				// Send sequence: have we already loaded the specified command?
-				if( currentCommand != nextCommand )
-				{
-					// No: load it from EEPROM into SRAM first
-					readData( addressForCommand( nextCommand ), recordBuffer, 256 );
-					DEBUG_PRINT( &mystdout, "Read %d pairs from EEPROM at address %d for command %d\r\n", commandLength( recordBuffer ), addressForCommand( nextCommand ), nextCommand );
-					
-					// We now have correct command loaded
-					currentCommand = nextCommand;
-				}
-				
-				// Do we have valid data for the specified command?
-				if( recordBuffer[0] == 0xFF )
-				{
-					// No, we don't: flash RED
-					RED_ON;
-					_delay_ms( 100 );
-					ALL_OFF;
-					_delay_ms( 100 );
-					RED_ON;
-					_delay_ms( 100 );
-					ALL_OFF;
-					_delay_ms( 100 );
-					GREEN_ON;
-					
-					DEBUG_PRINT( &mystdout, "No IR code stored – not transmitting.\r\n" );
-				}
-				else
-				{
-					// Yes, we do: send it
-					RED_ON;
-					DEBUG_PRINT( &mystdout, "Transmitting...\r\n" );
-					sendSequence2( recordBuffer );
-					GREEN_ON;
-				}
-				break;
-
-			case State_DidDisconnect:
-				// Disconnect: turn off GREEN
-				ALL_OFF;
-				break;
-				
-			case State_DidConnect:
-				// Connect: turn on GREEN
-				GREEN_ON;
-				break;
-				
-			default:
+			readCommand();
+			if( state != State_NOOP )
 				break;
+			runMacro();
+			runHold();
+			runQueue();
+			sleepUntilInterrupt();
 		}
 		
+		execute( state );
+		
 		// Go to idle state
 		state = State_NOOP;
 	}
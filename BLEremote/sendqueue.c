@@ -0,0 +1,136 @@
+//
+//  sendqueue.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 19-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include "infrared.h"
+#include "sendqueue.h"
+
+static SendJob jobs[ SENDQUEUE_SIZE ];			// Queued, sending and finished jobs
+static uint8_t order[ SENDQUEUE_SIZE ];			// Indices into jobs in the order they are to be sent
+static uint8_t head;							// First queued job in order
+static uint8_t count;							// Number of queued jobs
+static SendJob *current;						// The job being sent
+static uint8_t lastId;
+
+/* Returns a job entry that is neither queued nor being sent */
+static SendJob *allocateJob()
+{
+	static uint8_t next;
+	uint8_t i;
+
+	for( i = 0; i < SENDQUEUE_SIZE; i++ )
+	{
+		next = (next + 1) & (SENDQUEUE_SIZE-1);
+		if( jobs[ next ].state != SendJob_Queued && &jobs[ next ] != current )
+			return &jobs[ next ];
+	}
+	return 0;
+}
+
+/* Queues a command */
+uint8_t queueSend( uint8_t command, uint8_t flags )
+{
+	SendJob *job;
+
+	if( count == SENDQUEUE_SIZE || !(job = allocateJob()) )
+		return 0;
+
+	if( ++lastId == 0 )
+		lastId = 1;
+	job->id = lastId;
+	job->command = command;
+	job->flags = flags;
+	job->state = SendJob_Queued;
+
+	if( flags & SENDJOB_URGENT )
+	{
+		// Stop the job being sent and jump the queue
+		if( current )
+		{
+			stopIR();
+			current->state = SendJob_Aborted;
+			current = 0;
+		}
+		head = (head - 1) & (SENDQUEUE_SIZE-1);
+		order[ head ] = job - jobs;
+	}
+	else
+		order[ (head + count) & (SENDQUEUE_SIZE-1) ] = job - jobs;
+	count++;
+
+	return job->id;
+}
+
+/* Hands out the next job when the transmitter is idle */
+SendJob *nextSendJob()
+{
+	if( isSendingIR() )
+		return 0;
+
+	// The job being sent has ended
+	if( current )
+	{
+		current->state = SendJob_Done;
+		current = 0;
+	}
+
+	if( count == 0 )
+		return 0;
+
+	current = &jobs[ order[ head ] ];
+	head = (head + 1) & (SENDQUEUE_SIZE-1);
+	count--;
+	current->state = SendJob_Sending;
+
+	return current;
+}
+
+/* Marks the job being started as failed */
+void sendJobFailed()
+{
+	if( current )
+	{
+		current->state = SendJob_Failed;
+		current = 0;
+	}
+}
+
+/* Returns the number of jobs queued or being sent */
+uint8_t sendQueueBusy()
+{
+	return count + (current ? 1 : 0);
+}
+
+/* Returns the state of a job */
+uint8_t sendJobState( uint8_t id )
+{
+	uint8_t i;
+
+	for( i = 0; i < SENDQUEUE_SIZE; i++ )
+		if( jobs[ i ].id == id && id != 0 )
+			return jobs[ i ].state;
+
+	return SendJob_Free;
+}
+
+/* Stops everything */
+void abortSendQueue()
+{
+	if( current )
+	{
+		stopIR();
+		current->state = SendJob_Aborted;
+		current = 0;
+	}
+
+	for( ; count; count-- )
+	{
+		jobs[ order[ head ] ].state = SendJob_Aborted;
+		head = (head + 1) & (SENDQUEUE_SIZE-1);
+	}
+}
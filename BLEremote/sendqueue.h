@@ -0,0 +1,103 @@
+//
+//  sendqueue.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 19-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_sendqueue_h
+#define BLEremote_sendqueue_h
+
+#include <avr/io.h>
+
+/**
+ @defgroup jwj_sendqueue Send Queue
+ @brief Queue of commands waiting to be sent.
+
+ @code #include "sendqueue.h" @endcode
+
+ Send Queue
+
+ Codes are sent in the background by the Timer1 interrupt handler, and the handler reads the code from the code cache or the stream buffers while it is sending. So a new code must not be loaded until the previous one is done. Instead of waiting for that whenever a command arrives, send commands are queued as jobs and the main loop takes the next job from the queue with nextSendJob() – which only hands out a job when the transmitter is idle, so the buffers are only ever loaded when the interrupt handler is not using them.
+
+ Every job has an id and goes through the states of @link SendJobState @endlink. An urgent job is put at the front of the queue and stops the job being sent, so e.g. a "power off" doesn't have to wait for a long repeated code to finish.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** Maximum number of jobs queued or remembered. Must be a power of 2. */
+#define SENDQUEUE_SIZE 8
+
+/** Job flag: put the job at the front of the queue and stop the job being sent. */
+#define SENDJOB_URGENT 0x01
+
+/** Job flag: the job is a step of a macro. Such a job can not start another macro. */
+#define SENDJOB_MACRO 0x02
+
+/** Job flag: the command is being held down and is repeated until it is released. */
+#define SENDJOB_HOLD 0x04
+
+/** Job states. */
+typedef enum {
+	/** Unknown job – the id has not been used or the job has been forgotten */
+	SendJob_Free = 0,
+	/** Waiting in the queue */
+	SendJob_Queued = 1,
+	/** Being sent */
+	SendJob_Sending = 2,
+	/** Sent */
+	SendJob_Done = 3,
+	/** Stopped by an urgent job or abortSendQueue() */
+	SendJob_Aborted = 4,
+	/** Could not be sent – e.g. because no code is stored for the command */
+	SendJob_Failed = 5
+} SendJobState;
+
+/** A send job. */
+typedef struct {
+	/** Job id. Never 0. */
+	uint8_t id;
+	/** The command number to send */
+	uint8_t command;
+	/** SENDJOB_ flags */
+	uint8_t flags;
+	/** A @link SendJobState @endlink value */
+	uint8_t state;
+} SendJob;
+
+/** Queues a command to be sent.
+ @param command The command number.
+ @param flags SENDJOB_ flags or 0.
+ @return The job id or 0 if the queue is full.
+ */
+uint8_t queueSend( uint8_t command, uint8_t flags );
+
+/** Gets the next job to send. The job being sent is marked as done when the transmitter has become idle.
+ @return Pointer to the job which the caller must start sending now, or 0 if there is nothing to send or the transmitter is busy.
+ */
+SendJob *nextSendJob();
+
+/** Marks the job returned by nextSendJob() as failed. Call this if the job could not be sent. */
+void sendJobFailed();
+
+/** Checks whether jobs are queued or being sent.
+ @return Number of jobs queued or being sent.
+ */
+uint8_t sendQueueBusy();
+
+/** Gets the state of a job.
+ @param id The job id returned by queueSend().
+ @return A @link SendJobState @endlink value.
+ */
+uint8_t sendJobState( uint8_t id );
+
+/** Stops the job being sent and aborts all queued jobs. */
+void abortSendQueue();
+
+/**@}*/
+
+#endif
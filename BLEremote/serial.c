@@ -0,0 +1,211 @@
+//
+//  serial.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 12-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdio.h>
+#include "serial.h"
+
+static unsigned char rxBuffer[ RX_BUF_SIZE ];
+static volatile uint8_t rxHead;		// Written by the interrupt handler only
+static volatile uint8_t rxTail;		// Written by the main loop only
+
+volatile uint8_t rxOverflows;
+
+static unsigned char txBuffer[ TX_BUF_SIZE ];
+static volatile uint8_t txHead;		// Written by the main loop only
+static volatile uint8_t txTail;		// Written by the interrupt handler only
+
+uint8_t txPolicy = TX_DEFAULT_POLICY;
+volatile uint16_t txOverflows;
+static volatile uint8_t txUsed;		// Set when a byte has been sent since the last baud rate change
+
+uint32_t baudRate;
+
+// Serial stream
+static int uart_putchar( char c, FILE *stream );
+FILE mystdout = FDEV_SETUP_STREAM( uart_putchar, NULL, _FDEV_SETUP_WRITE );
+
+/* Returns the double speed mode UBRR value for a baud rate or 0xFFFF if the error is too large */
+static uint16_t baudPrescale( uint32_t baud )
+{
+	uint32_t ubrr, actual, error;
+	
+	if( baud == 0 || baud > F_CPU/8 )
+		return 0xFFFF;
+	
+	ubrr = (F_CPU + baud*4) / (baud*8) - 1;		// Rounded
+	if( ubrr > 0x0FFF )
+		return 0xFFFF;
+	
+	actual = F_CPU / (8 * (ubrr + 1));
+	error = (actual > baud) ? actual - baud : baud - actual;
+	if( error * 1000 / baud > BAUD_TOLERANCE )
+		return 0xFFFF;
+	
+	return ubrr;
+}
+
+// Enables USART comm
+void enable_serial()
+{
+	UCSR0B |= (1<< RXEN0) | (1<< TXEN0);	// Enable TX and RX (8N1 serial format set by default)
+	setBaudRate( USART_BAUDRATE );
+	UCSR0B |= (1<< RXCIE0);					// Enable USART RX interrupt
+	
+#if SERIAL_FLOW_CONTROL
+	// RTS output, asserted. CTS input with pull-up and pin change interrupt.
+	RTS_DDR |= (1<< RTS_BIT);
+	RTS_PORT &= ~(1<< RTS_BIT);
+	CTS_PORT |= (1<< CTS_BIT);
+	CTS_PCMSK |= (1<< CTS_PCINT);
+	PCICR |= (1<< CTS_PCIE);
+#endif
+}
+
+/* Checks whether a baud rate can be used */
+uint8_t baudRateSupported( uint32_t baud )
+{
+	return baudPrescale( baud ) != 0xFFFF;
+}
+
+/* Changes the baud rate */
+uint8_t setBaudRate( uint32_t baud )
+{
+	uint16_t ubrr = baudPrescale( baud );
+	
+	if( ubrr == 0xFFFF )
+		return 0;
+	
+	// Let the last byte leave the shift register at the old rate
+	serialFlush();
+	if( txUsed )
+		while( !(UCSR0A & (1<< TXC0)))
+			;
+	txUsed = 0;
+	
+	UCSR0A = (1<< U2X0);					// Double speed mode. Assigned, not or'ed: FE0, DOR0 and UPE0 must be written as 0
+	UBRR0H = (ubrr >> 8) & 0x0F;			// High part of baud rate masked so bits 15:12 are writted as 0 as per the datasheet (19.10.5)
+	UBRR0L = ubrr;							// Low part of baud rate. Writing to UBBRnL updates baud prescaler
+	baudRate = baud;
+	
+	return 1;
+}
+
+static int uart_putchar(char c, FILE *stream)
+{
+	uint8_t next = (txHead + 1) & (TX_BUF_SIZE-1);
+
+	// Buffer full: drop or wait for the interrupt handler to make room
+	if( next == txTail )
+	{
+		if( txPolicy == TxPolicy_Drop || !(SREG & (1<< SREG_I)) )
+		{
+			txOverflows++;
+			return 0;
+		}
+		while( next == txTail )
+			;
+	}
+
+	txBuffer[ txHead ] = c;
+	txHead = next;
+
+	// Make sure the interrupt handler is running
+	UCSR0B |= (1<< UDRIE0);
+	return 0;
+}
+
+/* Waits until the transmit buffer is empty */
+void serialFlush()
+{
+	while( txTail != txHead )
+		;
+}
+
+/* Takes the next byte out of the receive buffer */
+int serialRead()
+{
+	unsigned char c;
+
+	if( rxTail == rxHead )
+		return -1;
+
+	c = rxBuffer[ rxTail ];
+	rxTail = (rxTail + 1) & (RX_BUF_SIZE-1);
+	
+#if SERIAL_FLOW_CONTROL
+	// Assert RTS again when the buffer is half empty
+	if( ((rxHead - rxTail) & (RX_BUF_SIZE-1)) < RX_BUF_SIZE/2 )
+		RTS_PORT &= ~(1<< RTS_BIT);
+#endif
+	return c;
+}
+
+/* Checks for received bytes */
+uint8_t serialAvailable()
+{
+	return rxTail != rxHead;
+}
+
+// Interrupt handler for USART receive complete: just store the byte
+ISR( USART_RX_vect )
+{
+	unsigned char c = UDR0;
+	uint8_t next = (rxHead + 1) & (RX_BUF_SIZE-1);
+
+	// Drop the byte if the buffer is full
+	if( next == rxTail )
+	{
+		rxOverflows++;
+		return;
+	}
+
+	rxBuffer[ rxHead ] = c;
+	rxHead = next;
+	
+#if SERIAL_FLOW_CONTROL
+	// Almost full: ask the sender to stop
+	if( ((rxHead - rxTail) & (RX_BUF_SIZE-1)) >= RX_BUF_SIZE - RTS_MARGIN )
+		RTS_PORT |= (1<< RTS_BIT);
+#endif
+}
+
+// Interrupt handler for USART data register empty: send the next buffered byte
+ISR( USART_UDRE_vect )
+{
+	if( txTail == txHead )
+	{
+		// Nothing more to send
+		UCSR0B &= ~(1<< UDRIE0);
+		return;
+	}
+	
+#if SERIAL_FLOW_CONTROL
+	if( CTS_PIN & (1<< CTS_BIT) )
+	{
+		// The receiver is not ready: the CTS pin change interrupt will resume sending
+		UCSR0B &= ~(1<< UDRIE0);
+		return;
+	}
+#endif
+
+	UCSR0A = (UCSR0A & (1<< U2X0)) | (1<< TXC0);		// Clear "transmit complete" so setBaudRate() can wait for this byte. U2X0 is kept and the error flags are written as 0.
+	txUsed = 1;
+	UDR0 = txBuffer[ txTail ];
+	txTail = (txTail + 1) & (TX_BUF_SIZE-1);
+}
+
+#if SERIAL_FLOW_CONTROL
+// Pin change interrupt handler for CTS: resume sending when the receiver is ready again
+ISR( CTS_vect )
+{
+	if( !(CTS_PIN & (1<< CTS_BIT)) && txTail != txHead )
+		UCSR0B |= (1<< UDRIE0);
+}
+#endif
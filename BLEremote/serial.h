@@ -0,0 +1,134 @@
+//
+//  serial.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 12-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_serial_h
+#define BLEremote_serial_h
+
+#include <avr/io.h>
+#include <stdio.h>
+
+/**
+ @defgroup jwj_serial Serial Functions
+ @brief USART communication with the BLE module.
+
+ @code #include "serial.h" @endcode
+
+ Serial Functions
+
+ The receive interrupt handler does nothing but put the received byte into a ring buffer. The main loop takes the bytes out with serialRead() and does all the parsing, so no interrupt handler is held up by command processing.
+
+ The ring buffer has a single producer (the interrupt handler, which only moves the head) and a single consumer (the main loop, which only moves the tail). Both indices are 8 bit so they are read and written atomically and no locking is needed.
+
+ Output written to @link mystdout @endlink goes into a transmit ring buffer which is emptied by the USART data register empty interrupt, so printing only costs the time it takes to copy the characters. What happens when the transmit buffer is full is decided by @link txPolicy @endlink. Here the main loop is the producer and the interrupt handler the consumer – so don't print from interrupt handlers.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** USART baud rate after reset. The rate can be changed at runtime with setBaudRate(). */
+#define USART_BAUDRATE 9600	// error 0.2%
+
+/** Largest acceptable baud rate error in per mille. The USART runs in double speed mode (U2X) so at 12 MHz all the standard rates up to 115200 baud are within 0.2% – and 250000, 500000 and 1500000 baud are exact. */
+#define BAUD_TOLERANCE 20
+
+/** Set to 1 to use RTS/CTS hardware flow control.
+ @see RTS_BIT
+ @see CTS_BIT
+ */
+#define SERIAL_FLOW_CONTROL 0
+
+/** The PORTx of the RTS output. RTS is active low: it is driven high when the receive buffer is almost full. */
+#define RTS_PORT PORTD
+/** The DDRx of the RTS output. */
+#define RTS_DDR DDRD
+/** The Pxy of the RTS output. */
+#define RTS_BIT PD2
+
+/** The PINx of the CTS input. CTS is active low: nothing is sent while it is high. */
+#define CTS_PIN PIND
+/** The PORTx of the CTS input – used to enable the pull-up so an unconnected CTS stops output. */
+#define CTS_PORT PORTD
+/** The Pxy of the CTS input. */
+#define CTS_BIT PD3
+/** The pin change mask register for the CTS input. */
+#define CTS_PCMSK PCMSK2
+/** The pin change interrupt bit for the CTS input. */
+#define CTS_PCINT PCINT19
+/** The pin change interrupt enable bit for the pin group containing the CTS input. */
+#define CTS_PCIE PCIE2
+/** The pin change interrupt vector for the pin group containing the CTS input. */
+#define CTS_vect PCINT2_vect
+
+/** RTS is deasserted when there is less room than this in the receive buffer – leaving room for the bytes the sender may have in flight. */
+#define RTS_MARGIN 16
+
+/** Size of the receive ring buffer. Must be a power of 2 and no larger than 256. */
+#define RX_BUF_SIZE 64
+
+/** Size of the transmit ring buffer. Must be a power of 2 and no larger than 256. */
+#define TX_BUF_SIZE 64
+
+/** What to do when a character is written and the transmit buffer is full. */
+typedef enum {
+	/** Drop the character and count it in @link txOverflows @endlink */
+	TxPolicy_Drop = 0,
+	/** Wait until there is room. Characters are still dropped if interrupts are disabled since the buffer would never be emptied. */
+	TxPolicy_Block = 1
+} TxPolicy;
+
+/** The initial value of @link txPolicy @endlink. Dropping characters means debug output never holds up sending IR codes. */
+#define TX_DEFAULT_POLICY TxPolicy_Drop
+
+/** Current policy for a full transmit buffer. */
+extern uint8_t txPolicy;
+
+/** Number of characters dropped because the transmit buffer was full. */
+extern volatile uint16_t txOverflows;
+
+/** Stream for writing to the USART. */
+extern FILE mystdout;
+
+/** Number of received bytes that were dropped because the receive buffer was full. */
+extern volatile uint8_t rxOverflows;
+
+/** Current baud rate. */
+extern uint32_t baudRate;
+
+/** Enables the USART receiver and transmitter and the receive interrupt. */
+void enable_serial();
+
+/** Checks whether a baud rate can be generated within @link BAUD_TOLERANCE @endlink.
+ @param baud The baud rate.
+ @return Non-zero if the rate is supported.
+ */
+uint8_t baudRateSupported( uint32_t baud );
+
+/** Changes the baud rate. Buffered output is sent at the old rate first.
+ @param baud The new baud rate.
+ @return 1 if the rate was changed or 0 if it is not supported.
+ */
+uint8_t setBaudRate( uint32_t baud );
+
+/** Gets the next received byte.
+ @return The byte or -1 if the receive buffer is empty.
+ */
+int serialRead();
+
+/** Waits until all buffered output has been handed to the USART. */
+void serialFlush();
+
+/** Checks whether there are received bytes waiting.
+ @return Non-zero if serialRead() will return a byte.
+ */
+uint8_t serialAvailable();
+
+/**@}*/
+
+#endif
@@ -0,0 +1,14 @@
+//
+//  eeprom.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Stand-in for <avr/eeprom.h>. The firmware keeps its codes in the external EEPROM, so nothing from here is used.
+
+#ifndef BLEremote_tests_avr_eeprom_h
+#define BLEremote_tests_avr_eeprom_h
+
+#endif
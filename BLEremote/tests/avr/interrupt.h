@@ -0,0 +1,18 @@
+//
+//  interrupt.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Stand-in for <avr/interrupt.h>: an interrupt handler is a plain function the test calls when the simulated event occurs.
+
+#ifndef BLEremote_tests_avr_interrupt_h
+#define BLEremote_tests_avr_interrupt_h
+
+#define ISR( vector ) void vector( void ); void vector( void )
+#define cli()
+#define sei()
+
+#endif
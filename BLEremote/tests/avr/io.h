@@ -0,0 +1,86 @@
+//
+//  io.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Stand-in for <avr/io.h> so the firmware sources compile on the host. The registers are plain variables defined in host.c.
+
+#ifndef BLEremote_tests_avr_io_h
+#define BLEremote_tests_avr_io_h
+
+#include <stdint.h>
+
+#ifndef REG8
+#define REG8( name ) extern volatile uint8_t name
+#define REG16( name ) extern volatile uint16_t name
+#endif
+
+REG8( TCCR0A ); REG8( TCCR0B ); REG8( OCR0A ); REG8( OCR0B ); REG8( TIMSK0 ); REG8( TIFR0 ); REG8( TCNT0 );
+REG8( TCCR1A ); REG8( TCCR1B ); REG16( OCR1A ); REG16( OCR1B ); REG8( TIMSK1 ); REG8( TIFR1 ); REG16( TCNT1 );
+REG8( TCCR2A ); REG8( TCCR2B ); REG8( OCR2A ); REG8( TIMSK2 ); REG8( TIFR2 ); REG8( TCNT2 );
+REG8( PORTB ); REG8( DDRB ); REG8( PINB ); REG8( PORTC ); REG8( DDRC ); REG8( PORTD ); REG8( DDRD ); REG8( PIND );
+REG8( PCMSK0 ); REG8( PCMSK2 ); REG8( PCICR ); REG8( PCIFR );
+REG8( UCSR0A ); REG8( UCSR0B ); REG8( UBRR0H ); REG8( UBRR0L ); REG8( UDR0 );
+REG8( TWSR ); REG8( TWBR ); REG8( TWCR ); REG8( TWDR );
+REG8( SREG ); REG8( ACSR ); REG8( PRR );
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PC4 4
+#define PC5 5
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+
+#define WGM00 0
+#define WGM01 1
+#define WGM02 3
+#define WGM21 1
+#define COM0B1 5
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define CS10 0
+#define CS11 1
+#define CS22 2
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCF1A 1
+#define OCF1B 2
+#define OCIE2A 1
+#define OCF2A 1
+#define TOIE0 0
+#define TOV0 0
+
+#define PCINT2 2
+#define PCINT19 3
+#define PCIE0 0
+#define PCIE2 2
+
+#define RXEN0 4
+#define TXEN0 3
+#define RXCIE0 7
+#define UDRIE0 5
+#define UDRE0 5
+#define TXC0 6
+#define U2X0 1
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWEN 2
+#define TWIE 0
+
+#define SREG_I 7
+#define ACD 7
+
+#endif
@@ -0,0 +1,23 @@
+//
+//  pgmspace.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Stand-in for <avr/pgmspace.h>: flash data is plain memory on the host.
+
+#ifndef BLEremote_tests_avr_pgmspace_h
+#define BLEremote_tests_avr_pgmspace_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR( s ) (s)
+#define pgm_read_byte( address ) (*(const uint8_t*)(address))
+#define pgm_read_word( address ) (*(const uint16_t*)(address))
+#define memcpy_P memcpy
+
+#endif
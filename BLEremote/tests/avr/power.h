@@ -0,0 +1,23 @@
+//
+//  power.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Stand-in for <avr/power.h>: the peripherals are always powered on the host.
+
+#ifndef BLEremote_tests_avr_power_h
+#define BLEremote_tests_avr_power_h
+
+#define power_adc_disable()
+#define power_spi_disable()
+#define power_twi_disable()
+#define power_twi_enable()
+#define power_timer0_disable()
+#define power_timer0_enable()
+#define power_timer1_disable()
+#define power_timer1_enable()
+
+#endif
@@ -0,0 +1,20 @@
+//
+//  sleep.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Stand-in for <avr/sleep.h>. sleep_cpu() returns right away as if an interrupt had woken the CPU.
+
+#ifndef BLEremote_tests_avr_sleep_h
+#define BLEremote_tests_avr_sleep_h
+
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode( mode )
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+
+#endif
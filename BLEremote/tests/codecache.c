@@ -0,0 +1,119 @@
+//
+//  codecache.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Checks the least recently used eviction of the code cache and that the codes moved down to close a gap keep their contents.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include "../codecache.h"
+#include "host.h"
+
+#define QUARTER (CODECACHE_ARENA_SIZE / 4)
+
+void holdIRCode( uint8_t hold )
+{
+}
+
+uint8_t isSendingIR()
+{
+	return 0;
+}
+
+/* Caches a code filled with its command number */
+static uint8_t insert( uint8_t command, unsigned int len )
+{
+	unsigned char *code = cacheInsert( command, len );
+
+	if( !code )
+		return 0;
+	memset( code, command, len );
+	return 1;
+}
+
+/* Checks that a code is cached with the right length and contents – this makes it the most recently used one */
+static uint8_t cached( uint8_t command, unsigned int len )
+{
+	unsigned char *code;
+	unsigned int cachedLen, i;
+
+	code = cacheLookup( command, &cachedLen );
+	if( !code || cachedLen != len )
+		return 0;
+	for( i = 0; i < len; i++ )
+		if( code[i] != command )
+			return 0;
+	return 1;
+}
+
+/* Evicts the least recently used codes when the arena is full */
+static void testArenaFull()
+{
+	unsigned int len;
+
+	insert( 1, QUARTER );
+	insert( 2, QUARTER );
+	insert( 3, QUARTER );
+	check( cached( 1, QUARTER ), "code 1 cached" );
+
+	// 1 is now more recently used than 2 and 3
+	insert( 4, 2 * QUARTER );
+	check( !cacheLookup( 2, &len ) && cached( 1, QUARTER ) && cached( 3, QUARTER ) && cached( 4, 2 * QUARTER ), "least recently used code 2 evicted, the others moved intact" );
+
+	// 4, 3 and 1 are used in that order, so 4 is the least recently used now
+	cached( 3, QUARTER );
+	cached( 1, QUARTER );
+	insert( 5, QUARTER );
+	check( !cacheLookup( 4, &len ) && cached( 3, QUARTER ) && cached( 1, QUARTER ) && cached( 5, QUARTER ), "code 4 evicted after the others were used" );
+
+	check( !cacheInsert( 6, CODECACHE_ARENA_SIZE + 1 ) && cached( 5, QUARTER ), "code larger than the arena not cached" );
+	check( insert( 7, CODECACHE_ARENA_SIZE ) && cached( 7, CODECACHE_ARENA_SIZE ) && !cacheLookup( 1, &len ) && !cacheLookup( 3, &len ) && !cacheLookup( 5, &len ), "code as large as the arena evicts everything" );
+	cacheInvalidate( 7 );
+}
+
+/* Evicts the least recently used code when all entries are taken */
+static void testEntriesFull()
+{
+	unsigned int len;
+	uint8_t i, all = 1;
+
+	for( i = 0; i < CODECACHE_ENTRIES; i++ )
+		insert( 10 + i, 2 );
+	insert( 10 + CODECACHE_ENTRIES, 2 );
+	for( i = 1; i <= CODECACHE_ENTRIES; i++ )
+		if( !cached( 10 + i, 2 ))
+			all = 0;
+	check( all && !cacheLookup( 10, &len ), "%u entries: the oldest one evicted", CODECACHE_ENTRIES );
+
+	// Invalidating a code in the middle closes the gap
+	cacheInvalidate( 13 );
+	insert( 30, 5 );
+	all = !cacheLookup( 13, &len ) && cached( 30, 5 );
+	for( i = 1; i <= CODECACHE_ENTRIES; i++ )
+		if( i != 3 && !cached( 10 + i, 2 ))
+			all = 0;
+	check( all, "invalidated code removed, the others intact" );
+}
+
+int main()
+{
+	uint16_t hits, misses;
+	unsigned int len;
+
+	testArenaFull();
+	testEntriesFull();
+
+	hits = cacheHits;
+	misses = cacheMisses;
+	cacheLookup( 30, &len );
+	cacheLookup( 99, &len );
+	check( cacheHits == hits + 1 && cacheMisses == misses + 1, "hits and misses counted" );
+
+	return testResult();
+}
@@ -0,0 +1,315 @@
+//
+//  codestore.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Runs the code store against a simulated 24LC512 (eepromsim.c).
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#include "../codestore.h"
+#include "../irprotocol.h"
+#include "../ircompress.h"
+#include "../infrared.h"
+#include "eepromsim.h"
+#include "host.h"
+
+// The work buffer initStore() gets from main.c
+static unsigned char workBuffer[ 256 ];
+
+uint16_t millis()
+{
+	return simTime / 1000;
+}
+
+uint16_t micros()
+{
+	return simTime;
+}
+
+// The spill function of main.c: writes a long code being learned and makes room with growSpill() when it runs out
+static uint32_t spillAddress;
+static unsigned int spillRoom, spillWritten, spillGrown;
+
+static uint8_t spillCode( unsigned int offset, unsigned char *data, uint8_t len )
+{
+	if( offset + len > spillRoom )
+	{
+		spillGrown++;
+		spillRoom = growSpill( &spillAddress, spillWritten );
+		if( offset + len > spillRoom )
+			return 0;
+	}
+	writeData( spillAddress + offset, data, len );
+	if( offset + len > spillWritten )
+		spillWritten = offset + len;
+	return 1;
+}
+
+/* Writes a code through the spill function like learnIR() does: the symbol chunks first and the header and width table at the start last */
+static uint8_t spillLearned( const unsigned char *code, unsigned int len )
+{
+	unsigned int offset, chunk;
+
+	spillRoom = beginSpill( &spillAddress );
+	spillWritten = 0;
+	spillGrown = 0;
+	for( offset = 64; offset < len; offset += chunk )
+	{
+		chunk = (len - offset > 32) ? 32 : len - offset;
+		if( !spillCode( offset, (unsigned char*)code + offset, chunk ))
+			return 0;
+	}
+	return spillCode( 0, (unsigned char*)code, 64 );
+}
+
+/* Reads a stored code back and compares it */
+static uint8_t storedAs( uint8_t commandNumber, const unsigned char *code, unsigned int len )
+{
+	static unsigned char back[ STORE_MAX_LENGTH ];
+	StoreEntry entry;
+	CodeHeader header;
+
+	if( !readCodeHeader( commandNumber, &entry, &header ) || header.length != len )
+		return 0;
+	readData( entry.address + sizeof( header ), back, len );
+	return checkCode( &header, back ) && memcmp( back, code, len ) == 0;
+}
+
+/* Long learned codes are written straight to the EEPROM; the store is only compacted when one does not fit the free space */
+static void testSpill()
+{
+	static unsigned char big[ 0x1F00 ], code[ 6000 ];
+	CodeHeader header;
+	StoreEntry before, after;
+	unsigned int i, bad = 0;
+
+	simReset( 1 );
+	initStore( workBuffer );
+	memset( &header, 0, sizeof( header ));
+	header.encoding = IRProtocol_Compressed;
+
+	// Eight codes of almost 8 KB fill the chip; every other one is deleted
+	for( i = 0; i < 8; i++ )
+	{
+		memset( big, i, sizeof( big ));
+		storeCommand( i, &header, big, sizeof( big ));
+	}
+	for( i = 0; i < 8; i += 2 )
+		freeCommand( i );
+	lookupCommand( 1, &before );
+
+	for( i = 0; i < sizeof( code ); i++ )
+		code[i] = i * 7 + 3;
+
+	// A short code fits the free space at the end: no compaction
+	check( spillLearned( code, 200 ) && spillGrown == 0 && storeSpilledCommand( 20, &header, 200 ), "short code spilled without compaction" );
+	lookupCommand( 1, &after );
+	check( after.address == before.address && storedAs( 20, code, 200 ), "short code intact, live codes not moved" );
+
+	// A 6000 byte code does not fit: the store is compacted once and the part written so far is moved down with it
+	i = spillLearned( code, sizeof( code ));
+	check( i && spillGrown == 1, "long code spilled with %u compaction(s)", spillGrown );
+	check( storeSpilledCommand( 21, &header, sizeof( code )) && storedAs( 21, code, sizeof( code )), "long code intact after the move down" );
+	lookupCommand( 1, &after );
+	check( after.address < before.address, "live codes moved down by the compaction" );
+
+	// The codes that were kept are intact and the index survives a reboot
+	flushWrites();
+	initStore( workBuffer );
+	for( i = 1; i < 8; i += 2 )
+	{
+		memset( big, i, sizeof( big ));
+		if( !storedAs( i, big, sizeof( big )))
+			bad++;
+	}
+	check( bad == 0 && commandStored( 20 ) && storedAs( 21, code, sizeof( code )), "kept codes intact after reboot" );
+}
+
+/* Every code carries a header with its encoding, carrier and repeat information and a CRC over the header and the code */
+static void testCodeHeader()
+{
+	unsigned char code[ 40 ];
+	CodeHeader header;
+	StoreEntry entry;
+	uint8_t i;
+
+	simReset( 1 );
+	initStore( workBuffer );
+	for( i = 0; i < sizeof( code ); i++ )
+		code[i] = i;
+	memset( &header, 0, sizeof( header ));
+	header.encoding = IRProtocol_Raw;
+	header.carrier = 38;
+	header.repeat = 2;
+	header.period = 108;
+	storeCommand( 5, &header, code, sizeof( code ));
+	storeCommand( 6, &header, code, sizeof( code ));
+
+	memset( &header, 0, sizeof( header ));
+	check( readCodeHeader( 5, &entry, &header ) && entry.length == sizeof( header ) + sizeof( code ), "header read back" );
+	check( header.magic == CODE_MAGIC && header.version == CODE_VERSION && header.encoding == IRProtocol_Raw && header.carrier == 38 && header.repeat == 2 && header.period == 108 && header.length == sizeof( code ), "header fields kept" );
+	check( verifyCommand( 5 ) && storedAs( 5, code, sizeof( code )), "CRC checks out" );
+
+	// A corrupted code byte is caught by the CRC, in SRAM and in the EEPROM
+	simMemory[0][ entry.address + sizeof( header ) + 17 ] ^= 0x04;
+	lookupCommand( 6, &entry );
+	simMemory[0][ entry.address + sizeof( header ) + 3 ] ^= 0x80;
+	check( !storedAs( 6, code, sizeof( code )) && !verifyCommand( 6 ), "corrupted code rejected" );
+	check( verifyCommand( 5 ), "a code checked once is not read again" );
+
+	// Storing the code again replaces it and it must be checked again
+	header.encoding = IRProtocol_Raw;
+	storeCommand( 6, &header, code, sizeof( code ));
+	check( verifyCommand( 6 ) && storedAs( 6, code, sizeof( code )), "replaced code checks out" );
+
+	// A corrupted header is marked in the index at boot
+	lookupCommand( 6, &entry );
+	simMemory[0][ entry.address ] ^= 0x01;
+	flushWrites();
+	initStore( workBuffer );
+	check( commandStored( 6 ) && commandEncoding( 6 ) == STORE_ENCODING_INVALID && !readCodeHeader( 6, &entry, &header ), "corrupted header indexed as invalid" );
+	check( commandEncoding( 5 ) == IRProtocol_Raw, "intact header indexed with its encoding" );
+}
+
+/* The SRAM index answers for empty commands without touching the EEPROM and is kept up to date by storing and freeing */
+static void testIndex()
+{
+	unsigned char code[ 8 ] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	CodeHeader header;
+	StoreEntry entry;
+	uint32_t before;
+	unsigned int i;
+
+	simReset( 1 );
+	initStore( workBuffer );
+	memset( &header, 0, sizeof( header ));
+
+	// Neighbouring commands share an index byte and a nibble byte
+	for( i = 0; i < STORE_COMMANDS; i += 3 )
+	{
+		header.encoding = (i % 5 == 0) ? IRProtocol_Macro : (i & 1) ? IRProtocol_NEC : IRProtocol_Compressed;
+		storeCommand( i, &header, code, sizeof( code ));
+	}
+	freeCommand( 3 );
+	freeCommand( 3 );
+	check( storedCommands == 85, "%u commands in the index", storedCommands );
+
+	before = simTime;
+	check( !commandStored( 4 ) && commandEncoding( 4 ) == STORE_ENCODING_NONE && !readCodeHeader( 4, &entry, &header ) && entry.address == STORE_EMPTY, "empty command" );
+	check( simTime == before, "empty command answered without EEPROM access" );
+	check( !commandStored( 3 ) && commandEncoding( 3 ) == STORE_ENCODING_NONE, "freed command" );
+	check( commandEncoding( 255 ) == IRProtocol_Macro && commandEncoding( 9 ) == IRProtocol_NEC && commandEncoding( 6 ) == IRProtocol_Compressed, "encodings of odd and even commands" );
+
+	// The index built at boot matches the one kept up to date
+	flushWrites();
+	initStore( workBuffer );
+	for( i = 0; i < STORE_COMMANDS; i++ )
+		if( (commandStored( i ) != 0) != (i % 3 == 0 && i != 3) )
+			break;
+	check( i == STORE_COMMANDS && storedCommands == 85 && commandEncoding( 255 ) == IRProtocol_Macro && commandEncoding( 9 ) == IRProtocol_NEC, "index rebuilt at boot in %u ms", storeScanTime );
+
+	// A store written with another layout version is not taken for a code store
+	simMemory[0][2]++;
+	initStore( workBuffer );
+	check( storedCommands == 0 && simMemory[0][2] == STORE_VERSION, "other layout version formatted" );
+}
+
+// Pulses in an old slot besides the terminator: 127 with the 16 bit unsigned int of the AVR
+#define SLOT_PULSES (256 / sizeof( unsigned int ) - 1)
+
+/* Writes the slot of a command in the old layout */
+static void writeOldSlot( uint8_t commandNumber, const unsigned int *pulses, unsigned int count )
+{
+	memcpy( simMemory[0] + commandNumber * 256, pulses, count * sizeof( unsigned int ));
+}
+
+/* Codes in the old fixed 256 byte slot layout are converted on the first boot instead of being formatted away */
+static void testMigration()
+{
+	unsigned int jvc[ 36 ], widths[ 41 ], simple[ 21 ], overflow[ SLOT_PULSES + 1 ], full[ SLOT_PULSES + 1 ], bad[ 5 ] = { 100, 200, 9000, 200, 0 };
+	uint16_t value = 0x2C81;
+	CodeHeader header;
+	StoreEntry entry;
+	IRCode code;
+	IRCompressedHeader compressed;
+	unsigned int i, n = 0;
+
+	// JVC: leader, 16 bits and stop mark
+	jvc[ n++ ] = IR_US( 8400 );
+	jvc[ n++ ] = IR_US( 4200 );
+	for( i = 0; i < 16; i++ )
+	{
+		jvc[ n++ ] = IR_US( 526 );
+		jvc[ n++ ] = ((value >> i) & 1) ? IR_US( 1574 ) : IR_US( 526 );
+	}
+	jvc[ n++ ] = IR_US( 526 );
+	jvc[ n++ ] = 0;
+
+	// 20 widths too far apart to be clustered: too many to compress
+	for( i = 0; i < 20; i++ )
+		widths[ i ] = widths[ i + 20 ] = i ? (widths[ i - 1 ] + 14) * 8 / 7 + 2 : 10;
+	widths[40] = 0;
+
+	// Two widths
+	for( i = 0; i < 20; i++ )
+		simple[i] = (i & 1) ? 400 : 150;
+	simple[20] = 0;
+
+	// Codes learned past the end of the slot: no terminator
+	for( i = 0; i <= SLOT_PULSES; i++ )
+	{
+		overflow[i] = (i & 1) ? 300 : 120;
+		full[i] = widths[ i % 20 ];
+	}
+
+	simReset( 1 );
+	writeOldSlot( 0, simple, 21 );
+	writeOldSlot( 1, jvc, 36 );
+	writeOldSlot( 3, bad, 5 );
+	writeOldSlot( 7, widths, 41 );
+	writeOldSlot( 200, simple, 21 );
+	writeOldSlot( 254, overflow, SLOT_PULSES + 1 );
+	writeOldSlot( 255, full, SLOT_PULSES + 1 );
+	initStore( workBuffer );
+
+	check( storedCommands == 5, "%u codes taken over", storedCommands );
+	check( readCodeHeader( 1, &entry, &header ) && header.encoding == IRProtocol_JVC, "JVC slot stored as a compact code" );
+	readData( entry.address + sizeof( header ), (unsigned char*)&code, sizeof( code ));
+	check( checkCode( &header, (unsigned char*)&code ) && code.address == 0x81 && code.command == 0x2C, "JVC address %02x command %02x", code.address, code.command );
+
+	check( readCodeHeader( 7, &entry, &header ) && header.encoding == IRProtocol_Raw && storedAs( 7, (unsigned char*)widths, sizeof( widths )), "slot with 20 widths stored raw" );
+	check( commandEncoding( 0 ) == IRProtocol_Compressed && commandEncoding( 200 ) == IRProtocol_Compressed, "slots 0 and 200 stored compressed" );
+	check( verifyCommand( 0 ) && verifyCommand( 200 ), "slot 0 intact under the header page" );
+
+	check( readCodeHeader( 254, &entry, &header ) && header.encoding == IRProtocol_Compressed, "unterminated slot stored" );
+	readData( entry.address + sizeof( header ), (unsigned char*)&compressed, sizeof( compressed ));
+	check( compressed.pulseCount == SLOT_PULSES, "unterminated slot cut at %u pulses", compressed.pulseCount );
+
+	check( !commandStored( 3 ) && !commandStored( 2 ), "slot with a pulse over MAXPULSE and empty slot not stored" );
+	check( !commandStored( 255 ), "full raw code in the top slot does not fit and is dropped" );
+
+	// The next boot finds the store
+	flushWrites();
+	initStore( workBuffer );
+	check( storedCommands == 5 && verifyCommand( 1 ) && verifyCommand( 7 ) && verifyCommand( 254 ), "store kept on the next boot" );
+
+	// An erased EEPROM is just formatted
+	simReset( 1 );
+	initStore( workBuffer );
+	check( storedCommands == 0 && simMemory[0][0] == (STORE_MAGIC & 0xFF), "erased EEPROM formatted" );
+}
+
+int main()
+{
+	testSpill();
+	testCodeHeader();
+	testIndex();
+	testMigration();
+
+	return testResult();
+}
@@ -0,0 +1,166 @@
+//
+//  commands.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Feeds command lines byte by byte through the USART receive interrupt handler and checks what readCommand() and
+// parseCommand() make of them: the state, the arguments, the echo and what happens to invalid and over-long lines.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#define main firmwareMain
+#include "../main.c"
+#undef main
+#include "eepromsim.h"
+#include "host.h"
+
+void USART_RX_vect( void );
+void USART_UDRE_vect( void );
+
+uint16_t millis()
+{
+	return simTime / 1000;
+}
+
+uint16_t micros()
+{
+	return simTime;
+}
+
+void initClock()
+{
+}
+
+/* Receives bytes as the USART would */
+static void receive( const char *bytes )
+{
+	while( *bytes )
+	{
+		UDR0 = *bytes++;
+		USART_RX_vect();
+	}
+}
+
+/* Runs the transmit interrupt handler until the transmit buffer is empty and returns what was sent */
+static const char *sent()
+{
+	static char text[ TX_BUF_SIZE + 1 ];
+	uint8_t len = 0;
+
+	while( UCSR0B & (1<< UDRIE0) )
+	{
+		USART_UDRE_vect();
+		if( UCSR0B & (1<< UDRIE0) )
+			text[ len++ ] = UDR0;
+	}
+	text[ len ] = 0;
+	return text;
+}
+
+/* Receives a line, runs readCommand() once and returns the state it set. The state is reset like the main loop does after execute(). */
+static enum States command( const char *line )
+{
+	enum States result;
+
+	receive( line );
+	readCommand();
+	result = state;
+	state = State_NOOP;
+	return result;
+}
+
+/* Commands with a command number */
+static void testNumbers()
+{
+	check( command( "S 12\n" ) == State_Send && nextCommand == 12 && sendFlags == 0, "send 12" );
+	check( strcmp( sent(), "S 12\n\r" ) == 0, "line echoed with CR after LF" );
+	check( command( "S! 7\r\n" ) == State_Send && nextCommand == 7 && sendFlags == SENDJOB_URGENT, "urgent send 7, CR ignored" );
+	check( command( "  L   255 \n" ) == State_Learn && nextCommand == 255, "learn 255 with extra spaces" );
+	check( command( "H 0\n" ) == State_Press && nextCommand == 0, "press 0" );
+	check( command( "R\n" ) == State_Release, "release" );
+
+	check( command( "S 256\n" ) == State_NOOP, "command number 256 ignored" );
+	check( command( "E 1x\n" ) == State_NOOP, "command number 1x ignored" );
+	check( command( "L\n" ) == State_NOOP, "missing command number ignored" );
+	check( command( "\n" ) == State_NOOP && command( "Q 1\n" ) == State_NOOP, "empty line and unknown command ignored" );
+	sent();
+}
+
+/* Commands with several arguments */
+static void testArguments()
+{
+	MacroHeader *macro = (MacroHeader*)recordBuffer;
+	MacroStep *step = (MacroStep*)(recordBuffer + sizeof( MacroHeader ));
+
+	check( command( "P 1 00fF 1a 3\n" ) == State_SendProtocol && protocolCode.protocol == 1 && protocolCode.address == 0xFF &&
+		   protocolCode.command == 0x1A && protocolCode.repeat == 3 && protocolCode.bits == 15, "protocol code with hex address and command" );
+	check( command( "P 1 0012 1a\n" ) == State_SendProtocol && protocolCode.repeat == 0 && protocolCode.bits == 12, "protocol code without repeats" );
+	check( command( "P 1 00g0 1a\n" ) == State_NOOP, "protocol code with a bad address ignored" );
+
+	check( command( "M 5 1 0 100 2 3 65535\n" ) == State_StoreMacro && nextCommand == 5 && macro->steps == 2 && macroLength == MACRO_SIZE( 2 ) &&
+		   step[1].command == 2 && step[1].repeat == 3 && step[1].delay == 65535, "macro with two steps" );
+	check( command( "M 5 1 0\n" ) == State_NOOP, "macro with an incomplete step ignored" );
+	check( command( "M 5 1 0 65536\n" ) == State_NOOP, "macro with a delay of 65536 ms ignored" );
+
+	check( command( "B 115200\n" ) == State_SetBaud && requestedBaud == 115200, "baud rate" );
+	sent();
+}
+
+/* Bytes arriving in pieces and several commands in one burst */
+static void testSplitLines()
+{
+	receive( "S 1" );
+	readCommand();
+	check( state == State_NOOP, "half a line: nothing parsed yet" );
+	check( command( "23\n" ) == State_Send && nextCommand == 123, "rest of the line completes it" );
+
+	check( command( "L 3\nE 4\n" ) == State_Learn && nextCommand == 3, "first of two commands" );
+	check( command( "" ) == State_Erase && nextCommand == 4, "second command parsed by the next call" );
+	check( !serialAvailable(), "receive buffer empty" );
+	sent();
+}
+
+/* A line too long for the line buffer is discarded, and bytes received while the ring buffer is full are dropped */
+static void testOverflow()
+{
+	char half[ LINE_SIZE/2 + 5 ];
+	uint8_t i, dropped;
+
+	// More than LINE_SIZE bytes, received in two parts so none are dropped from the ring buffer
+	memset( half, '1', sizeof( half ) - 1 );
+	half[ sizeof( half ) - 1 ] = 0;
+	receive( "S " );
+	receive( half );
+	readCommand();
+	receive( half );
+	readCommand();
+	sent();
+	check( lineOverflow, "line longer than the line buffer" );
+	check( command( "\n" ) == State_NOOP && linePos == 0 && !lineOverflow, "over-long line discarded" );
+	check( command( "S 9\n" ) == State_Send && nextCommand == 9, "next line parsed" );
+	sent();
+
+	dropped = rxOverflows;
+	for( i = 0; i < RX_BUF_SIZE + 5; i++ )
+		receive( " " );
+	dropped = rxOverflows - dropped;
+	check( dropped == 6, "%u bytes dropped from a full receive buffer", dropped );
+	readCommand();
+	sent();
+	check( command( "\nE 2\n" ) == State_Erase && nextCommand == 2, "line of spaces ignored, command after the overflow parsed" );
+	sent();
+}
+
+int main()
+{
+	testNumbers();
+	testArguments();
+	testSplitLines();
+	testOverflow();
+
+	return testResult();
+}
@@ -0,0 +1,118 @@
+//
+//  eeprom.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Runs the 24C EEPROM library and the code store against simulated 24LC512 chips (eepromsim.c).
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../24c_eeprom.h"
+#include "../codestore.h"
+#include "eepromsim.h"
+#include "host.h"
+
+// The work buffer initStore() gets from main.c
+static unsigned char workBuffer[ 256 ];
+
+uint16_t millis()
+{
+	return simTime / 1000;
+}
+
+uint16_t micros()
+{
+	return simTime;
+}
+
+/* Random writes of random lengths through the page buffers, read back in random chunks */
+static void testRandomWrites()
+{
+	static unsigned char model[ 0x10000 ], data[ 600 ];
+	unsigned int i, n, len, bad = 0;
+	uint32_t address;
+
+	simReset( 1 );
+	srand( 1 );
+	memset( model, 0xFF, sizeof( model ));
+	for( n = 0; n < 2000; n++ )
+	{
+		len = 1 + rand() % sizeof( data );
+		address = rand() % (sizeof( model ) - len);
+		for( i = 0; i < len; i++ )
+			data[i] = rand();
+		memcpy( model + address, data, len );
+		writeData( address, data, len );
+
+		// Reads commit the buffers first
+		if( n % 7 == 0 )
+		{
+			address = rand() % (sizeof( model ) - sizeof( data ));
+			readData( address, data, sizeof( data ));
+			if( memcmp( data, model + address, sizeof( data )))
+				bad++;
+		}
+	}
+	flushWrites();
+	check( bad == 0 && memcmp( simMemory[0], model, sizeof( model )) == 0, "random writes: %lu page writes, %u bad reads", simPageWrites, bad );
+}
+
+/* The write cycle and durable time are measured from the clock, not computed from the number of poll attempts */
+static void testWriteTiming()
+{
+	unsigned char data[ 64 ];
+	uint32_t start;
+
+	simReset( 1 );
+	memset( data, 0x55, sizeof( data ));
+	simTime = 1000;
+	start = simTime;
+	writeData( 0x200, data, sizeof( data ));
+	flushWrites();
+	check( writeCycleTime >= SIM_WRITE_CYCLE && writeCycleTime <= SIM_WRITE_CYCLE + TWI_ATTEMPT_US, "write cycle measured as %u us, chip takes %u us", writeCycleTime, SIM_WRITE_CYCLE );
+	check( durableTime == simTime - start && durableTime > writeCycleTime, "durable after %u us", durableTime );
+}
+
+/* A missing chip makes every transfer fail after the retry limit instead of hanging */
+static void testMissingChip()
+{
+	unsigned char data[ 16 ] = "0123456789abcde";
+	CodeHeader header;
+	uint16_t errors;
+	uint32_t start;
+
+	simReset( 0 );
+	errors = eepromErrors;
+	check( readData( 0x100, data, sizeof( data )) == 0, "missing chip: readData fails" );
+	check( data[0] == 0xFF && data[15] == 0xFF, "missing chip: data reads as erased" );
+	check( readByte( 0x100 ) == 0xFF, "missing chip: readByte reads as erased" );
+	check( eepromErrors == errors + 2, "missing chip: errors counted" );
+
+	// A write and its ACK poll both give up
+	start = simTime;
+	writeData( 0x100, data, sizeof( data ));
+	flushWrites();
+	check( simBytesWritten[0] == 0 && eepromErrors == errors + 3, "missing chip: write dropped and counted" );
+	check( simTime - start < 2 * 11000, "missing chip: write gave up after %lu us", (unsigned long)(simTime - start) );
+
+	// initStore() returns without formatting and nothing can be stored
+	start = simTime;
+	initStore( workBuffer );
+	check( simTime - start < 11000 && storedCommands == 0, "missing chip: initStore returns after %lu us", (unsigned long)(simTime - start) );
+	memset( &header, 0, sizeof( header ));
+	check( !storeCommand( 1, &header, data, sizeof( data )), "missing chip: nothing stored" );
+}
+
+int main()
+{
+	testMissingChip();
+	testRandomWrites();
+	testWriteTiming();
+
+	return testResult();
+}
@@ -0,0 +1,105 @@
+//
+//  eepromsim.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <string.h>
+#include "../twi.h"
+#include "eepromsim.h"
+
+unsigned char simMemory[ SIM_CHIPS ][ 0x10000 ];
+uint8_t simPresent;
+uint32_t simTime;
+unsigned long simPageWrites;
+unsigned long simBytesWritten[ SIM_CHIPS ];
+
+static uint32_t busyUntil[ SIM_CHIPS ];
+static uint16_t pointer[ SIM_CHIPS ];
+
+/* Erases the chips */
+void simReset( uint8_t chips )
+{
+	memset( simMemory, 0xFF, sizeof( simMemory ));
+	memset( busyUntil, 0, sizeof( busyUntil ));
+	memset( pointer, 0, sizeof( pointer ));
+	memset( simBytesWritten, 0, sizeof( simBytesWritten ));
+	simPresent = (1 << chips) - 1;
+	simTime = 0;
+	simPageWrites = 0;
+}
+
+/* Checks whether a chip is writing */
+uint8_t simBusy( uint8_t chip )
+{
+	return simTime < busyUntil[ chip ];
+}
+
+void twiInit()
+{
+}
+
+/* Runs the transaction like the interrupt driven driver would: address attempts until the chip answers or the retry limit is reached, then the transfer */
+uint8_t twiSubmit( TWITransaction *transaction )
+{
+	uint8_t chip = (transaction->device >> 1) & 7;
+	uint16_t i;
+
+	transaction->retries = 0;
+	transaction->status = TWIStatus_Busy;
+	for( ;; )
+	{
+		simTime += TWI_ATTEMPT_US;
+		if( ((simPresent >> chip) & 1) && !simBusy( chip ))
+			break;
+		if( transaction->retries >= TWI_MAX_RETRIES )
+		{
+			transaction->status = TWIStatus_Error;
+			if( transaction->callback )
+				transaction->callback( transaction );
+			return 1;
+		}
+		transaction->retries++;
+	}
+
+	simTime += (transaction->addressLength + transaction->length) * TWI_BYTE_US;
+	if( transaction->addressLength == 2 )
+		pointer[ chip ] = transaction->address;
+	for( i = 0; i < transaction->length; i++ )
+	{
+		if( transaction->read )
+			transaction->data[i] = simMemory[ chip ][ pointer[ chip ]++ ];
+		else
+		{
+			// A page write wraps around within the page
+			simMemory[ chip ][ (pointer[ chip ] & ~0x7F) | ((pointer[ chip ] + i) & 0x7F) ] = transaction->data[i];
+			simBytesWritten[ chip ]++;
+		}
+	}
+	if( !transaction->read && transaction->length )
+	{
+		pointer[ chip ] = (pointer[ chip ] & ~0x7F) | ((pointer[ chip ] + transaction->length) & 0x7F);
+		simPageWrites++;
+		busyUntil[ chip ] = simTime + SIM_WRITE_CYCLE;
+	}
+
+	transaction->status = TWIStatus_Done;
+	if( transaction->callback )
+		transaction->callback( transaction );
+	return 1;
+}
+
+/* Runs the transaction */
+uint8_t twiTransfer( TWITransaction *transaction )
+{
+	twiSubmit( transaction );
+	return transaction->status;
+}
+
+/* Nothing is ever left running */
+uint8_t twiBusy()
+{
+	return 0;
+}
@@ -0,0 +1,45 @@
+//
+//  eepromsim.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Simulated 24LC512 chips behind the twi.h API. A transaction runs to its end inside twiSubmit(), so the EEPROM library and
+// everything above it run unchanged on the host. Time is simulated: every address attempt and byte on the bus takes the time
+// twi.h estimates for it, and a page write keeps its chip busy for the write cycle.
+
+#ifndef BLEremote_tests_eepromsim_h
+#define BLEremote_tests_eepromsim_h
+
+#include <stdint.h>
+
+/** Number of simulated chips. */
+#define SIM_CHIPS 8
+
+/** Write cycle of a simulated chip in µs. */
+#define SIM_WRITE_CYCLE 5000
+
+/** Contents of the chips. Erased chips read 0xFF. */
+extern unsigned char simMemory[ SIM_CHIPS ][ 0x10000 ];
+
+/** Bit mask of the chips that answer. */
+extern uint8_t simPresent;
+
+/** Simulated time in µs. */
+extern uint32_t simTime;
+
+/** Number of page writes. */
+extern unsigned long simPageWrites;
+
+/** Number of bytes written to each chip. */
+extern unsigned long simBytesWritten[ SIM_CHIPS ];
+
+/** Erases all chips, makes the first chips present and resets the time and counters. */
+void simReset( uint8_t chips );
+
+/** Checks whether a chip is still in its write cycle. */
+uint8_t simBusy( uint8_t chip );
+
+#endif
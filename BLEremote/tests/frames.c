@@ -0,0 +1,218 @@
+//
+//  frames.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Sends binary frames through the USART receive interrupt handler and checks the receiver and the reply frames: the CRC,
+// frames with errors, a batch of operations with the simulated EEPROM, a bad operation ending the batch and a batch whose
+// results don't fit in one reply frame.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#include <util/crc16.h>
+#define main firmwareMain
+#include "../main.c"
+#undef main
+#include "eepromsim.h"
+#include "host.h"
+
+void USART_RX_vect( void );
+
+uint16_t millis()
+{
+	return simTime / 1000;
+}
+
+uint16_t micros()
+{
+	return simTime;
+}
+
+void initClock()
+{
+}
+
+// Output captured from mystdout
+static unsigned char output[ 256 ];
+static unsigned int outputLen;
+
+static int capture( char c, FILE *stream )
+{
+	if( outputLen < sizeof( output ))
+		output[ outputLen++ ] = c;
+	return 0;
+}
+
+// Frame being sent to the firmware
+static unsigned char frame[ FRAME_MAX_PAYLOAD + 5 ];
+
+/* Builds a frame with its CRC in frame[]. Returns the length of the frame. */
+static unsigned int buildFrame( uint8_t sequence, const unsigned char *payload, uint8_t len )
+{
+	uint16_t crc = 0;
+	uint8_t i;
+
+	frame[0] = FRAME_SYNC;
+	frame[1] = len;
+	frame[2] = sequence;
+	memcpy( frame + 3, payload, len );
+	for( i = 0; i < len + 2; i++ )
+		crc = _crc_xmodem_update( crc, frame[ i+1 ] );
+	frame[ len+3 ] = crc >> 8;
+	frame[ len+4 ] = crc;
+	return len + 5;
+}
+
+/* Receives bytes one by one and lets the main loop take each byte */
+static void receive( const unsigned char *bytes, unsigned int len )
+{
+	for( ; len; len--, bytes++ )
+	{
+		UDR0 = *bytes;
+		USART_RX_vect();
+		readCommand();
+	}
+}
+
+/* Checks the output for a reply frame. Returns its payload length or -1 if there is no valid reply. */
+static int replyLength( uint8_t sequence )
+{
+	uint16_t crc = 0;
+	uint8_t i;
+
+	if( outputLen < 5 || output[0] != FRAME_SYNC || output[2] != sequence || output[1] + 5 != outputLen )
+		return -1;
+	for( i = 0; i < output[1] + 2; i++ )
+		crc = _crc_xmodem_update( crc, output[ i+1 ] );
+	if( output[ outputLen-2 ] != (crc >> 8) || output[ outputLen-1 ] != (crc & 0xFF) )
+		return -1;
+	return output[1];
+}
+
+/* Sends a frame and returns the payload length of the reply frame or -1 if there is no valid reply */
+static int exchange( uint8_t sequence, const unsigned char *payload, uint8_t len )
+{
+	unsigned int frameLen = buildFrame( sequence, payload, len );
+
+	outputLen = 0;
+	receive( frame, frameLen );
+	return replyLength( sequence );
+}
+
+/* The CRC, frames with errors and frames mixed with command lines */
+static void testReceiver()
+{
+	static const unsigned char payload[] = { FrameOp_Busy };
+	static const unsigned char tooLong[] = { FRAME_SYNC, FRAME_MAX_PAYLOAD + 1 };
+	uint16_t crc = 0, errors = frameErrors, received = framesReceived;
+	unsigned int len;
+	const char *digits = "123456789";
+
+	// The CRC-16/XMODEM check value
+	while( *digits )
+		crc = _crc_xmodem_update( crc, *digits++ );
+	check( crc == 0x31C3, "CRC of \"123456789\" is 0x%04X", crc );
+
+	check( exchange( 1, payload, 0 ) == 0, "empty frame: empty reply" );
+
+	// A bit error in the payload or in the CRC drops the frame
+	len = buildFrame( 2, payload, sizeof( payload ));
+	frame[3] ^= 0x10;
+	outputLen = 0;
+	receive( frame, len );
+	len = buildFrame( 3, payload, sizeof( payload ));
+	frame[ len-1 ] ^= 0x01;
+	receive( frame, len );
+	check( outputLen == 0 && frameErrors == errors + 2 && framesReceived == received + 1, "frames with a bad payload byte and a bad CRC dropped and counted" );
+
+	// A length over the maximum ends the frame at once: the bytes after it are a command line
+	outputLen = 0;
+	receive( tooLong, sizeof( tooLong ));
+	receive( (const unsigned char*)"R\n", 2 );
+	check( frameErrors == errors + 3 && state == State_Release, "too long frame dropped, command line after it parsed" );
+	state = State_NOOP;
+
+	// Frames and command lines mixed
+	len = buildFrame( 4, payload, sizeof( payload ));
+	outputLen = 0;
+	receive( frame, len );
+	check( replyLength( 4 ) == 2 && output[3] == FrameStatus_OK, "frame answered" );
+	receive( (const unsigned char*)"S 5\n", 4 );
+	check( state == State_Send && nextCommand == 5, "command line after a frame parsed" );
+	state = State_NOOP;
+}
+
+/* A batch with an upload, queries, statistics and a send */
+static void testBatch()
+{
+	static const unsigned char batch[] = {
+		FrameOp_Upload, 5, FRAME_UPLOAD_HEADER + 8, IRProtocol_Raw, 38, 0, 108, 0, 1, 2, 3, 4, 5, 6, 7, 8,
+		FrameOp_Query, 5,
+		FrameOp_Query, 6,
+		FrameOp_Send, 6,
+		FrameOp_Info,
+		FrameOp_Busy
+	};
+	unsigned char expected[] = {
+		FrameStatus_OK,
+		FrameStatus_OK, 8, 0,
+		FrameStatus_NotStored, 0, 0,
+		FrameStatus_NotStored,
+		FrameStatus_OK, framesReceived + 1, 0, frameErrors, 0,
+		FrameStatus_OK, 0
+	};
+	int len = exchange( 42, batch, sizeof( batch ));
+
+	check( len == sizeof( expected ) && memcmp( output + 3, expected, sizeof( expected )) == 0, "batch of six operations: %d byte reply", len );
+	check( commandStored( 5 ), "uploaded code stored" );
+}
+
+/* An unknown operation ends the batch */
+static void testBadOp()
+{
+	static const unsigned char batch[] = { FrameOp_Busy, 'Z', FrameOp_Busy };
+	static const unsigned char expected[] = { FrameStatus_OK, 0, FrameStatus_BadOp };
+	static const unsigned char missing[] = { FrameOp_Query };
+	int len = exchange( 43, batch, sizeof( batch ));
+
+	check( len == sizeof( expected ) && memcmp( output + 3, expected, sizeof( expected )) == 0, "unknown operation ends the batch" );
+
+	len = exchange( 44, missing, sizeof( missing ));
+	check( len == 1 && output[3] == FrameStatus_BadOp, "missing argument ends the batch" );
+}
+
+/* More results than fit in the reply frame */
+static void testTruncated()
+{
+	unsigned char batch[ 40 ];
+	unsigned int executed = framesReceived;
+	int len;
+
+	memset( batch, FrameOp_Info, sizeof( batch ));
+	len = exchange( 45, batch, sizeof( batch ));
+	check( len == 25 * 5 + 2 && output[ 3 + 125 ] == FrameStatus_Truncated && output[ 3 + 126 ] == 25, "40 info operations: truncated after %u", output[ 3 + 126 ] );
+	check( output[ 3 + 120 ] == FrameStatus_OK && output[ 3 + 121 ] == (uint8_t)(executed + 1), "last result before the truncation" );
+
+	// Operations with one status byte fit right up to the end
+	memset( batch, FrameOp_Abort, sizeof( batch ));
+	len = exchange( 46, batch, sizeof( batch ));
+	check( len == 40 && output[ 3 + 39 ] == FrameStatus_OK, "40 abort operations: not truncated" );
+}
+
+int main()
+{
+	mystdout.put = capture;
+	simReset( 1 );
+	initStore( recordBuffer );
+
+	testReceiver();
+	testBatch();
+	testBadOp();
+	testTruncated();
+
+	return testResult();
+}
@@ -0,0 +1,80 @@
+//
+//  host.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Defines the register stand-ins and the avr-libc functions the firmware uses, and the check helpers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#define REG8( name ) volatile uint8_t name
+#define REG16( name ) volatile uint16_t name
+#include <avr/io.h>
+#include <util/crc16.h>
+#include "host.h"
+
+static unsigned int failures;
+
+/* CRC-16 XMODEM as in avr-libc: polynomial 0x1021, most significant bit first */
+uint16_t _crc_xmodem_update( uint16_t crc, uint8_t data )
+{
+	uint8_t i;
+
+	crc ^= (uint16_t)data << 8;
+	for( i = 0; i < 8; i++ )
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	return crc;
+}
+
+/* Writes a character to an avr-libc device stream */
+int avrFputc( int c, AVRFile *stream )
+{
+	stream->put( c, stream );
+	return c;
+}
+
+/* Formats into a device stream a character at a time */
+int avrFprintf( AVRFile *stream, const char *format, ... )
+{
+	char text[ 256 ];
+	va_list args;
+	int i, len;
+
+	va_start( args, format );
+	len = vsnprintf( text, sizeof( text ), format, args );
+	va_end( args );
+	for( i = 0; i < len && i < (int)sizeof( text ) - 1; i++ )
+		stream->put( text[i], stream );
+	return len;
+}
+
+/* Reports a check */
+void check( int ok, const char *format, ... )
+{
+	va_list args;
+
+	printf( ok ? "ok   " : "FAIL " );
+	va_start( args, format );
+	vprintf( format, args );
+	va_end( args );
+	printf( "\n" );
+	if( !ok )
+		failures++;
+}
+
+/* Prints the number of failed checks */
+int testResult()
+{
+	if( failures )
+	{
+		printf( "%u failed\n", failures );
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,20 @@
+//
+//  host.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Helpers shared by the host tests. host.c also defines the register stand-ins declared in avr/io.h.
+
+#ifndef BLEremote_tests_host_h
+#define BLEremote_tests_host_h
+
+/* Reports a check: prints "ok" or "FAIL" and the message and counts the failures */
+void check( int ok, const char *format, ... );
+
+/* Prints the number of failed checks. Returns the exit status for main(). */
+int testResult();
+
+#endif
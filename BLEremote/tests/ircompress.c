@@ -0,0 +1,136 @@
+//
+//  ircompress.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Checks the clustering of compressPulse(), the format written by compressIR() and the pulses sendCompressedIR() unpacks
+// from it – with and without repeat frames.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include "../ircompress.h"
+#include "host.h"
+
+static IRPulseSource source;
+
+/* Takes the pulse source instead of starting Timer1 */
+void sendPulses( IRPulseSource pulseSource )
+{
+	source = pulseSource;
+}
+
+/* Width classes and running averages */
+static void testCompressPulse()
+{
+	IRCompressor compressor;
+	uint8_t a, b, c, full = 1;
+	unsigned int i;
+
+	initCompressor( &compressor );
+	a = compressPulse( &compressor, 100 );
+	b = compressPulse( &compressor, 110 );
+	c = compressPulse( &compressor, 90 );
+	check( a == 0 && b == 0 && c == 0 && compressor.tableSize == 1 && compressor.table[0] == 100 && compressor.members[0] == 3, "widths within the tolerance share an entry (%u)", compressor.table[0] );
+
+	b = compressPulse( &compressor, 330 );
+	c = compressPulse( &compressor, 320 );
+	check( b == 1 && c == 1 && compressor.table[1] == 325, "a third longer width gets its own entry, averaged to %u", compressor.table[1] );
+
+	initCompressor( &compressor );
+	for( i = 0; i < IRCOMPRESS_MAX_WIDTHS; i++ )
+		if( compressPulse( &compressor, (100 << (i / 2)) + (i & 1) * (50 << (i / 2)) ) != i )
+			full = 0;
+	check( full && compressPulse( &compressor, 60000U ) == 0xFF, "table full after %u widths", IRCOMPRESS_MAX_WIDTHS );
+}
+
+/* Compresses a code and checks the header and the unpacked pulses. Returns the symbol size or 0 if the code can't be compressed. */
+static uint8_t roundTrip( const unsigned int *pulses, unsigned int count, uint8_t repeat, uint16_t period, uint8_t *ok )
+{
+	unsigned char data[ 300 * sizeof( unsigned int ) ];
+	IRCompressedHeader header;
+	unsigned int len, i, width, expected;
+	uint32_t frameTicks = 0;
+	uint8_t frame;
+
+	memcpy( data, pulses, count * sizeof( unsigned int ));
+	memset( data + count * sizeof( unsigned int ), 0, sizeof( unsigned int ));
+	len = compressIR( data );
+	if( len == 0 )
+		return 0;
+	memcpy( &header, data, sizeof( header ));
+	*ok = header.marker == IRCODE_MARKER && header.protocol == IRProtocol_Compressed && header.pulseCount == count && len == compressedIRSize( data );
+
+	sendCompressedIR( data, repeat, period );
+	for( frame = 0; frame <= repeat; frame++ )
+	{
+		if( frame )
+		{
+			expected = (frameTicks < (uint32_t)period * IR_US( 1000 )) ? period * IR_US( 1000 ) - frameTicks : IRCOMPRESS_FRAME_GAP;
+			if( source() != expected )
+				*ok = 0;
+		}
+		frameTicks = 0;
+		for( i = 0; i < count; i++ )
+		{
+			width = source();
+			frameTicks += width;
+			if( width + pulses[i]/8 + IR_US( 60 ) < pulses[i] || width > pulses[i] + pulses[i]/8 + IR_US( 60 ))
+				*ok = 0;
+		}
+	}
+	if( source() != 0 )
+		*ok = 0;
+
+	return header.symbolBits;
+}
+
+/* Symbol sizes, the pulses sent from the compressed code and the repeat frames */
+static void testCompressIR()
+{
+	unsigned int pulses[ 300 ];
+	unsigned int i;
+	uint8_t ok, bits;
+
+	// Two widths with some jitter: 1 bit symbols
+	for( i = 0; i < 67; i++ )
+		pulses[i] = (i % 3 == 0) ? 330 + i % 5 : 110 - i % 4;
+	bits = roundTrip( pulses, 67, 0, 0, &ok );
+	check( bits == 1 && ok, "two widths: %u bit symbols", bits );
+
+	// An NEC-like frame: 2 bit symbols. Two repeat frames 108 ms apart.
+	pulses[0] = 1770;
+	pulses[1] = 885;
+	for( i = 2; i < 67; i++ )
+		pulses[i] = (i & 1) && (i % 7 < 3) ? 332 : 110;
+	bits = roundTrip( pulses, 67, 2, 108, &ok );
+	check( bits == 2 && ok, "four widths and two repeat frames: %u bit symbols", bits );
+
+	// A frame longer than its period gets the default gap
+	bits = roundTrip( pulses, 67, 1, 10, &ok );
+	check( bits == 2 && ok, "frame longer than the period: default gap" );
+
+	// A code ending with a space is never repeated
+	bits = roundTrip( pulses, 66, 0, 108, &ok );
+	check( bits == 2 && ok, "code ending with a space" );
+
+	// 16 widths: 4 bit symbols. One more can't be compressed.
+	for( i = 0; i < 200; i++ )
+		pulses[i] = (100 << (i % 16 / 2)) + (i & 1) * (50 << (i % 16 / 2));
+	bits = roundTrip( pulses, 200, 0, 0, &ok );
+	check( bits == 4 && ok, "16 widths: %u bit symbols", bits );
+	pulses[ 199 ] = 60000U;
+	check( roundTrip( pulses, 200, 0, 0, &ok ) == 0, "17 widths can't be compressed" );
+}
+
+int main()
+{
+	testCompressPulse();
+	testCompressIR();
+
+	return testResult();
+}
@@ -0,0 +1,117 @@
+//
+//  irprotocol.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Runs decodeIR() on captured signals – an NEC frame followed by NEC repeat codes and the other shapes a held NEC button
+// produces – and on the pulses sendIRCode() generates for every protocol, which must decode to the code that was sent.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include "../irprotocol.h"
+#include "host.h"
+
+// Durations in µs as an IR receiver module delivered them: marks a little long, spaces a little short
+#define NEC_LEADER		9060, 4440
+#define NEC_REPEAT		9040, 2210, 590
+#define NEC_ZERO		590, 530
+#define NEC_ONE			590, 1660
+#define NEC_STOP		600
+
+// Address 0x04, command 0x08 (LG "input") – LSB first, each byte followed by its inverse
+#define NEC_BITS \
+	NEC_ZERO, NEC_ZERO, NEC_ONE, NEC_ZERO, NEC_ZERO, NEC_ZERO, NEC_ZERO, NEC_ZERO, \
+	NEC_ONE, NEC_ONE, NEC_ZERO, NEC_ONE, NEC_ONE, NEC_ONE, NEC_ONE, NEC_ONE, \
+	NEC_ZERO, NEC_ZERO, NEC_ZERO, NEC_ONE, NEC_ZERO, NEC_ZERO, NEC_ZERO, NEC_ZERO, \
+	NEC_ONE, NEC_ONE, NEC_ONE, NEC_ZERO, NEC_ONE, NEC_ONE, NEC_ONE, NEC_ONE
+#define NEC_FRAME		NEC_LEADER, NEC_BITS, NEC_STOP
+
+static IRPulseSource source;
+
+/* Takes the pulse source instead of starting Timer1 */
+void sendPulses( IRPulseSource pulseSource )
+{
+	source = pulseSource;
+}
+
+/* Converts a 0 terminated list of µs durations to ticks like learnIR() does and decodes it */
+static uint8_t decode( const uint32_t *us, IRCode *code )
+{
+	unsigned int data[ 300 ];
+	unsigned int n;
+
+	for( n = 0; us[n]; n++ )
+		data[n] = (us[n] * (F_CPU / 1000000UL) + TICK_CYCLES/2) / TICK_CYCLES;
+	data[n] = 0;
+	return decodeIR( data, code );
+}
+
+/* Checks that a signal decodes to the LG code with the specified number of repeat frames */
+static uint8_t isNEC( const uint32_t *us, uint8_t repeat )
+{
+	IRCode code;
+
+	return decode( us, &code ) && code.protocol == IRProtocol_NEC && code.address == 0xFB04 && code.command == 0xF708 && code.repeat == repeat;
+}
+
+/* Generates a code with sendIRCode() and decodes the pulses */
+static uint8_t roundTrip( uint8_t protocol, uint8_t bits, uint16_t address, uint16_t command, uint8_t repeat, uint8_t decodedRepeat )
+{
+	IRCode code, decoded;
+	unsigned int data[ 300 ];
+	unsigned int n = 0;
+
+	memset( &code, 0, sizeof( code ));
+	code.protocol = protocol;
+	code.bits = bits;
+	code.address = address;
+	code.command = command;
+	code.repeat = repeat;
+	sendIRCode( &code );
+	while( n < 299 && (data[n] = source()) )
+		n++;
+	data[n] = 0;
+
+	return decodeIR( data, &decoded ) && decoded.protocol == protocol && decoded.address == address && decoded.command == command &&
+		   decoded.repeat == decodedRepeat && (protocol != IRProtocol_Sony || decoded.bits == bits);
+}
+
+/* Every protocol sendIRCode() generates is recognized again by decodeIR() */
+static void testGenerate()
+{
+	check( roundTrip( IRProtocol_NEC, 0, 0xFB04, 0xF708, 0, 0 ), "NEC generated and decoded" );
+	check( roundTrip( IRProtocol_NEC, 0, 0xFB04, 0xF708, 3, 3 ), "NEC with three repeat codes" );
+	check( roundTrip( IRProtocol_JVC, 0, 0x03, 0x17, 2, 2 ), "JVC with two repeat frames without leader" );
+	check( roundTrip( IRProtocol_Sony, 12, 0x01, 0x15, 0, 2 ), "Sony 12 bits sent three times" );
+	check( roundTrip( IRProtocol_Sony, 15, 0x97, 0x2A, 0, 2 ), "Sony 15 bits" );
+	check( roundTrip( IRProtocol_Sony, 20, 0x1A5A, 0x33, 4, 4 ), "Sony 20 bits with four repeat frames" );
+	check( roundTrip( IRProtocol_RC5, 0, 0x05, 0x35, 0, 0 ), "RC-5" );
+	check( roundTrip( IRProtocol_RC5, 0, 0x1F, 0x7F, 0, 0 ), "RC-5X command with bit 6 set" );
+	check( roundTrip( IRProtocol_RC6, 0, 0x00, 0x0C, 0, 0 ), "RC-6 mode 0" );
+	check( roundTrip( IRProtocol_RC6, 0, 0xFF, 0x81, 0, 0 ), "RC-6 ending with a space" );
+}
+
+int main()
+{
+	static const uint32_t single[] = { NEC_FRAME, 0 };
+	static const uint32_t held[] = { NEC_FRAME, 40560, NEC_REPEAT, 96120, NEC_REPEAT, 0 };
+	static const uint32_t copies[] = { NEC_FRAME, 40560, NEC_FRAME, 40560, NEC_REPEAT, 0 };
+	static const uint32_t repeatOnly[] = { NEC_REPEAT, 0 };
+	static const uint32_t badRepeat[] = { NEC_FRAME, 40560, 9040, 4440, 590, 0 };
+	IRCode code;
+
+	check( isNEC( single, 0 ), "NEC frame" );
+	check( isNEC( held, 2 ), "NEC frame and two repeat codes" );
+	check( isNEC( copies, 2 ), "NEC frame, a copy and a repeat code" );
+	check( decode( repeatOnly, &code ) && code.protocol == IRProtocol_NECRepeat, "repeat code on its own" );
+	check( !isNEC( badRepeat, 1 ), "leader with a stop mark only is no repeat code" );
+
+	testGenerate();
+
+	return testResult();
+}
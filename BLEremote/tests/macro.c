@@ -0,0 +1,89 @@
+//
+//  macro.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Plays a macro against the send queue the way the main loop does and checks that a step which can't be queued
+// because the queue is full is sent later instead of being skipped.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#include "../sendqueue.h"
+#include "../irprotocol.h"
+#include "../macro.h"
+#include "host.h"
+
+static uint16_t now;
+
+uint16_t millis()
+{
+	return now;
+}
+
+uint8_t isSendingIR()
+{
+	return 0;
+}
+
+void stopIR()
+{
+}
+
+/* Plays the macro for a number of ms with the queue full for the first ones. Returns the number of commands sent and puts them in sent. */
+static uint8_t play( const unsigned char *macro, unsigned int len, uint16_t fullTime, uint8_t *sent )
+{
+	uint8_t command, count = 0, i;
+
+	// Commands received while the macro is playing fill the queue
+	for( i = 0; i < SENDQUEUE_SIZE; i++ )
+		queueSend( 99, 0 );
+	startMacro( macro, len );
+
+	for( now = 0; now < 1000 && macroActive(); now++ )
+	{
+		if( macroPoll( &command ) == MacroAction_Send )
+		{
+			if( queueSend( command, SENDJOB_MACRO ))
+				sent[ count++ ] = command;
+			else
+				retryMacroStep();
+		}
+
+		// The transmitter starts the next job – once the queued commands have gone out
+		if( now >= fullTime )
+			nextSendJob();
+	}
+
+	return count;
+}
+
+int main()
+{
+	unsigned char macro[ MACRO_SIZE( 2 ) ];
+	MacroHeader *header = (MacroHeader*)macro;
+	MacroStep *steps = (MacroStep*)(macro + sizeof( MacroHeader ));
+	uint8_t sent[ 8 ], count;
+
+	header->marker = IRCODE_MARKER;
+	header->protocol = IRProtocol_Macro;
+	header->steps = 2;
+	steps[0].command = 10;
+	steps[0].repeat = 1;
+	steps[0].delay = 100;
+	steps[1].command = 11;
+	steps[1].repeat = 0;
+	steps[1].delay = 0;
+
+	count = play( macro, sizeof( macro ), 50, sent );
+	check( count == 3 && sent[0] == 10 && sent[1] == 10 && sent[2] == 11, "queue full for 50 ms: %u commands sent", count );
+
+	abortSendQueue();
+	count = play( macro, sizeof( macro ), 0, sent );
+	check( count == 3 && sent[0] == 10 && sent[1] == 10 && sent[2] == 11, "queue emptied right away: %u commands sent", count );
+
+	return testResult();
+}
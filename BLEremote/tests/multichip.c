@@ -0,0 +1,138 @@
+//
+//  multichip.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Runs the 24C EEPROM library and the code store with four simulated 24LC512 chips: transfers split at chip boundaries,
+// ACK polling of the chip that was written and a code store filled past the first 64 KB.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#include "../24c_eeprom.h"
+#undef EEPROM_CHIPS
+#define EEPROM_CHIPS 4
+#include "../24c_eeprom.c"
+#include "../codestore.c"
+#include "../irprotocol.h"
+#include "eepromsim.h"
+#include "host.h"
+
+// The work buffer initStore() gets from main.c
+static unsigned char workBuffer[ 256 ];
+
+uint16_t millis()
+{
+	return simTime / 1000;
+}
+
+uint16_t micros()
+{
+	return simTime;
+}
+
+static uint8_t asyncDone;
+
+/* Callback of the background read */
+static void readDone( TWITransaction *transaction )
+{
+	asyncDone = transaction->status == TWIStatus_Done ? 1 : 2;
+}
+
+/* Reads and writes crossing from one chip to the next */
+static void testSplitTransfers()
+{
+	unsigned char data[ 64 ], back[ 64 ];
+	TWITransaction transaction;
+	uint8_t i;
+
+	simReset( 4 );
+	for( i = 0; i < sizeof( data ); i++ )
+		data[i] = i + 1;
+
+	writeData( 0x1FFE0, data, sizeof( data ));
+	flushWrites();
+	check( memcmp( simMemory[1] + 0xFFE0, data, 32 ) == 0 && memcmp( simMemory[2], data + 32, 32 ) == 0, "write split between chips 1 and 2" );
+
+	memset( back, 0, sizeof( back ));
+	check( readData( 0x1FFE0, back, sizeof( back )) && memcmp( back, data, sizeof( data )) == 0, "read split between chips 1 and 2" );
+
+	memset( back, 0, sizeof( back ));
+	asyncDone = 0;
+	readDataAsync( &transaction, 0x1FFF0, back, sizeof( back ), readDone );
+	check( asyncDone == 1 && memcmp( back, data + 16, 48 ) == 0 && transaction.length == sizeof( back ), "background read split between chips 1 and 2" );
+}
+
+/* The ACK poll after a page write must go to the chip that was written */
+static void testPollChip()
+{
+	unsigned char data[ 16 ];
+	uint8_t chip;
+
+	memset( data, 0xA5, sizeof( data ));
+	for( chip = 0; chip < 4; chip++ )
+	{
+		simReset( 4 );
+		writeData( chip * EEPROM_CHIP_SIZE + 0x400, data, sizeof( data ));
+		flushWrites();
+		check( !simBusy( chip ) && writeCycleTime >= SIM_WRITE_CYCLE, "chip %u: flushWrites() waited for its write cycle (%u us)", chip, writeCycleTime );
+	}
+}
+
+/* Fills the store past the first chip, frees every other code and compacts */
+static void testStorePastFirstChip()
+{
+	static unsigned char code[ 3000 ];
+	CodeHeader header;
+	StoreEntry entry;
+	unsigned int i, n, bad = 0;
+
+	simReset( 4 );
+	initStore( workBuffer );
+	memset( &header, 0, sizeof( header ));
+	header.encoding = IRProtocol_Compressed;
+	for( n = 0; n < 60; n++ )
+	{
+		memset( code, n, sizeof( code ));
+		if( !storeCommand( n, &header, code, sizeof( code )))
+			break;
+	}
+	lookupCommand( n - 1, &entry );
+	check( n == 60 && entry.address > 2 * EEPROM_CHIP_SIZE, "60 codes of 3000 bytes stored, last one at 0x%05lx", (unsigned long)entry.address );
+
+	for( i = 0; i < n; i += 2 )
+		freeCommand( i );
+	compactStore();
+	flushWrites();
+
+	// The index is rebuilt from the EEPROM as at boot
+	initStore( workBuffer );
+	for( i = 0; i < n; i++ )
+	{
+		if( (i & 1) != (readCodeHeader( i, &entry, &header ) ? 1 : 0) )
+		{
+			bad++;
+			continue;
+		}
+		if( i & 1 )
+		{
+			readData( entry.address + sizeof( header ), code, sizeof( code ));
+			if( !checkCode( &header, code ) || code[0] != i || code[ sizeof( code ) - 1 ] != i )
+				bad++;
+		}
+	}
+	lookupCommand( n - 1, &entry );
+	check( bad == 0 && storedCommands == n / 2, "after compaction %u codes kept, %u bad, last one at 0x%05lx", storedCommands, bad, (unsigned long)entry.address );
+}
+
+int main()
+{
+	testSplitTransfers();
+	testPollChip();
+	testStorePastFirstChip();
+
+	return testResult();
+}
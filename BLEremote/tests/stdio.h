@@ -0,0 +1,33 @@
+//
+//  stdio.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Stand-in for the avr-libc <stdio.h>: the host's stdio plus avr-libc device streams. A stream set up with
+// FDEV_SETUP_STREAM() hands every character to its put function, as on the AVR. printf() still writes to the host's stdout.
+
+#ifndef BLEremote_tests_stdio_h
+#define BLEremote_tests_stdio_h
+
+#include_next <stdio.h>
+
+typedef struct AVRFile
+{
+	int (*put)( char, struct AVRFile* );
+} AVRFile;
+
+#define FILE AVRFile
+#define _FDEV_SETUP_WRITE 2
+#define FDEV_SETUP_STREAM( put, get, rwflag ) { put }
+
+#define fputc avrFputc
+#define fprintf avrFprintf
+#define fprintf_P avrFprintf
+
+int avrFputc( int c, AVRFile *stream );
+int avrFprintf( AVRFile *stream, const char *format, ... );
+
+#endif
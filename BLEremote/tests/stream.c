@@ -0,0 +1,108 @@
+//
+//  stream.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Streams a compressed code from the simulated EEPROM and checks the pulses the transmit interrupt handler would get:
+// the frame and its repeat frames, each one frame period after the previous one.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#include "../irstream.c"
+#include "eepromsim.h"
+#include "host.h"
+
+#define PULSES 101		// 26 bytes of 2 bit symbols: more than one chunk
+
+static IRPulseSource source;
+
+uint16_t millis()
+{
+	return simTime / 1000;
+}
+
+uint16_t micros()
+{
+	return simTime;
+}
+
+/* Takes the pulse source instead of starting Timer1 */
+void sendPulses( IRPulseSource pulseSource )
+{
+	source = pulseSource;
+}
+
+uint8_t isSendingIR()
+{
+	return 0;
+}
+
+/* Compresses a code of the specified number of pulses and writes it to the EEPROM. Returns the length of the code. */
+static unsigned int storeCode( unsigned int *pulses, unsigned int count )
+{
+	static const unsigned int widths[] = { IR_US( 560 ), IR_US( 1690 ), IR_US( 4500 ) };
+	unsigned char code[ (PULSES + 1) * sizeof( unsigned int ) ];
+	unsigned int i, len;
+
+	for( i = 0; i < count; i++ )
+		pulses[i] = widths[ (i * 7 + i / 3) % 3 ];
+	pulses[ count ] = 0;
+	memcpy( code, pulses, (count + 1) * sizeof( unsigned int ));
+	len = compressIR( code );
+	writeData( 0x100, code, len );
+	flushWrites();
+	return len;
+}
+
+/* Takes pulses from the source until the code ends and checks them against the frame, the gaps and the repeat frames */
+static uint8_t checkFrames( const unsigned int *pulses, unsigned int count, uint8_t frames, unsigned int gap )
+{
+	unsigned int i;
+	uint8_t frame;
+
+	for( frame = 0; frame < frames; frame++ )
+	{
+		if( frame && source() != gap )
+			return 0;
+		for( i = 0; i < count; i++ )
+			if( source() != pulses[i] )
+				return 0;
+	}
+	return source() == 0 && source() == 0;
+}
+
+int main()
+{
+	unsigned int pulses[ PULSES + 1 ];
+	unsigned int len, i;
+	uint32_t frameTicks = 0;
+
+	simReset( 1 );
+	len = storeCode( pulses, PULSES );
+	for( i = 0; i < PULSES; i++ )
+		frameTicks += pulses[i];
+
+	check( beginCompressedStream( 0x100, len ) != 0, "compressed code of %u bytes", len );
+	streamIR( 2, 250 );
+	check( checkFrames( pulses, PULSES, 3, 250 * IR_US( 1000 ) - frameTicks ) && streamUnderruns == 0, "frame and two repeat frames 250 ms apart" );
+
+	beginCompressedStream( 0x100, len );
+	streamIR( 1, 0 );
+	check( checkFrames( pulses, PULSES, 2, IRCOMPRESS_FRAME_GAP ), "unknown period: frames separated by the default gap" );
+
+	beginCompressedStream( 0x100, len );
+	streamIR( 0, 110 );
+	check( checkFrames( pulses, PULSES, 1, 0 ), "no repeat frames" );
+
+	// A frame ending with a space can't be followed by a gap
+	len = storeCode( pulses, PULSES - 1 );
+	beginCompressedStream( 0x100, len );
+	streamIR( 2, 110 );
+	check( checkFrames( pulses, PULSES - 1, 1, 0 ) && streamUnderruns == 0, "code ending with a space sent once" );
+
+	return testResult();
+}
@@ -0,0 +1,157 @@
+//
+//  twidriver.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Drives the TWI interrupt handler with the status codes the hardware would produce and checks that a device which never
+// acknowledges its address fails the transaction after TWI_MAX_RETRIES attempts instead of being retried forever.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include <compat/twi.h>
+#include "../twi.h"
+#include "host.h"
+
+void TWI_vect( void );
+
+// The simulated device
+static uint8_t present;				// Answers at all
+static unsigned int busyAttempts;	// Number of address attempts it NACKs before it answers
+static unsigned int attempts;		// Address attempts seen
+static unsigned char memory[ 0x10000 ];
+static uint16_t pointer;			// Address pointer
+static uint8_t addressBytes;		// Address bytes received in this write
+
+// Bus phases
+enum { Idle, Address, Transmit, Receive };
+
+/* Answers every TWCR write of the interrupt handler like the TWI hardware and the device would, until the bus is idle */
+static void runBus()
+{
+	uint8_t phase = Idle;
+	uint8_t control, ack;
+
+	for( ;; )
+	{
+		control = TWCR;
+		if( control & (1<< TWSTO) )
+		{
+			// STOP goes out right away
+			TWCR = control & ~(1<< TWSTO);
+			phase = Idle;
+		}
+
+		if( control & (1<< TWSTA) )
+		{
+			TWSR = (phase == Idle) ? TW_START : TW_REP_START;
+			phase = Address;
+		}
+		else if( phase == Address )
+		{
+			attempts++;
+			ack = present && attempts > busyAttempts;
+			addressBytes = 0;
+			if( TWDR & TW_READ )
+			{
+				TWSR = ack ? TW_MR_SLA_ACK : TW_MR_SLA_NACK;
+				phase = Receive;
+			}
+			else
+			{
+				TWSR = ack ? TW_MT_SLA_ACK : TW_MT_SLA_NACK;
+				phase = Transmit;
+			}
+		}
+		else if( phase == Transmit )
+		{
+			// Two address bytes, then data
+			if( addressBytes < 2 )
+				pointer = (addressBytes++ == 0) ? TWDR << 8 : pointer | TWDR;
+			else
+				memory[ pointer++ ] = TWDR;
+			TWSR = TW_MT_DATA_ACK;
+		}
+		else if( phase == Receive )
+		{
+			TWDR = memory[ pointer++ ];
+			TWSR = (control & (1<< TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+		}
+		else
+			return;
+
+		TWI_vect();
+	}
+}
+
+/* Fills in a transaction for the device at 0xA0 */
+static void setup( TWITransaction *transaction, uint8_t read, uint8_t addressLength, uint16_t address, unsigned char *data, uint16_t len )
+{
+	memset( transaction, 0, sizeof( *transaction ));
+	transaction->device = 0xA0;
+	transaction->read = read;
+	transaction->addressLength = addressLength;
+	transaction->address = address;
+	transaction->data = data;
+	transaction->length = len;
+}
+
+/* Submits a transaction and runs the bus until it has ended */
+static uint8_t transfer( TWITransaction *transaction )
+{
+	attempts = 0;
+	twiSubmit( transaction );
+	runBus();
+	return transaction->status;
+}
+
+int main()
+{
+	TWITransaction transaction, poll;
+	unsigned char data[4], written[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+	twiInit();
+
+	// A missing device: the read fails after the retry limit
+	present = 0;
+	setup( &transaction, 1, 2, 0x1000, data, sizeof( data ));
+	transfer( &transaction );
+	check( transaction.status == TWIStatus_Error, "missing device: read fails" );
+	check( attempts == TWI_MAX_RETRIES + 1 && transaction.retries == TWI_MAX_RETRIES, "missing device: %u attempts, %u retries, limit %u", attempts, transaction.retries, (unsigned int)TWI_MAX_RETRIES );
+	check( twiBusy() == 0, "missing device: queue empty afterwards" );
+
+	// ACK polling a missing device ends too
+	setup( &poll, 0, 0, 0, 0, 0 );
+	check( transfer( &poll ) == TWIStatus_Error, "missing device: ACK poll fails" );
+
+	// A device busy with its write cycle answers within the limit
+	present = 1;
+	busyAttempts = 90;
+	setup( &transaction, 0, 2, 0x1000, written, sizeof( written ));
+	transfer( &transaction );
+	check( transaction.status == TWIStatus_Done && transaction.retries == 90, "busy device: write done after %u retries", transaction.retries );
+	check( memcmp( memory + 0x1000, written, sizeof( written )) == 0, "busy device: data written" );
+
+	busyAttempts = 0;
+	setup( &transaction, 1, 2, 0x1000, data, sizeof( data ));
+	check( transfer( &transaction ) == TWIStatus_Done && memcmp( data, written, sizeof( data )) == 0, "read back" );
+
+	// A failed transaction does not hold up the next one in the queue
+	present = 0;
+	setup( &poll, 0, 0, 0, 0, 0 );
+	setup( &transaction, 1, 2, 0x1000, data, sizeof( data ));
+	memset( data, 0, sizeof( data ));
+	attempts = 0;
+	twiSubmit( &poll );
+	twiSubmit( &transaction );
+	busyAttempts = TWI_MAX_RETRIES + 1;		// The device answers once the poll has given up
+	present = 1;
+	runBus();
+	check( poll.status == TWIStatus_Error && transaction.status == TWIStatus_Done && memcmp( data, written, sizeof( data )) == 0, "queued read runs after a failed poll" );
+
+	return testResult();
+}
@@ -0,0 +1,168 @@
+//
+//  txtiming.c
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Checks that the compare-scheduled transmitter (sendPulses() and the Timer1 compare A handler) produces the same edges as the
+// old tick-based handler which ran every TICK_CYCLES cycles – and that it takes one interrupt per edge, plus one per extra 32768
+// cycle chunk of a pulse longer than the 16 bit timer range.
+// Build and run on the host with "make test".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../infrared.c"
+
+#define MAX_EDGES 64
+
+// Edges of one run: cycle times from the start of the timer and the number of interrupts taken
+typedef struct {
+	uint32_t edges[ MAX_EDGES ];
+	unsigned int count;
+	uint32_t interrupts;
+} Run;
+
+static unsigned int failures;
+
+uint16_t millis()
+{
+	return 0;
+}
+
+/* The old handler: Timer1 in CTC mode with TICK_OCR as TOP, so the compare matches came TICK_OCR cycles after the start and then every TICK_CYCLES cycles.
+ * The handler body is the one the stored codes were learned and tuned with. The IR went high when the timer was started.
+ */
+static void runTickModel( const unsigned int *code, Run *run )
+{
+	const unsigned int *buffer = code;
+	unsigned int duration = *buffer++;
+	uint32_t now = TICK_OCR;
+
+	run->count = 0;
+	run->interrupts = 0;
+	for( ; run->count < MAX_EDGES; now += TICK_CYCLES )
+	{
+		run->interrupts++;
+		if( --duration == 0 )
+		{
+			run->edges[ run->count++ ] = now;
+			duration = *buffer++;
+			if( duration == 0 )
+				return;
+			duration++;
+		}
+	}
+}
+
+/* The new transmitter: sendSequence2() followed by the compare A handler every time the free-running Timer1 reaches OCR1A.
+ * An edge is a change of the carrier output or the end of the code.
+ */
+static void runCompareEngine( unsigned int *code, Run *run )
+{
+	uint32_t now = 0;
+	uint16_t step;
+	uint8_t level;
+
+	run->count = 0;
+	run->interrupts = 0;
+	TCCR0A = 0;
+	sendSequence2( (unsigned char*)code );
+	while( (TIMSK1 & (1<< OCIE1A)) && run->count < MAX_EDGES )
+	{
+		// Run the timer up to the next compare match. OCR1A is never equal to TCNT1 after a match since every chunk is at least one cycle.
+		step = OCR1A - TCNT1;
+		now += step;
+		TCNT1 = OCR1A;
+
+		level = TCCR0A & (1<< COM0B1);
+		TIMER1_COMPA_vect();
+		run->interrupts++;
+		if( (TCCR0A & (1<< COM0B1)) != level || !(TIMSK1 & (1<< OCIE1A)) )
+			run->edges[ run->count++ ] = now;
+	}
+}
+
+/* Number of compare interrupts a pulse of the specified number of cycles takes: one per 32768 cycle chunk until the rest fits the timer */
+static uint32_t chunksFor( uint32_t cycles )
+{
+	uint32_t chunks = 1;
+
+	while( cycles > 0xFFFF )
+	{
+		cycles -= 0x8000;
+		chunks++;
+	}
+	return chunks;
+}
+
+/* Runs a code through both models and compares the edges */
+static void checkCode( const char *name, unsigned int *code )
+{
+	Run old, new;
+	uint32_t expected = 0, cycles;
+	unsigned int i;
+
+	runTickModel( code, &old );
+	runCompareEngine( code, &new );
+
+	// Every pulse but the first is one tick longer than its stored duration in both models
+	for( i = 0; code[i]; i++ )
+	{
+		cycles = ((uint32_t)code[i] + (i ? 1 : 0)) * TICK_CYCLES;
+		expected += chunksFor( cycles );
+	}
+
+	if( new.count != old.count || new.count != i )
+	{
+		printf( "FAIL %s: %u edges, tick model has %u, code has %u pulses\n", name, new.count, old.count, i );
+		failures++;
+		return;
+	}
+
+	// The tick model's matches came at TOP – one cycle before a full tick – so its edges are all one cycle earlier. The pulse widths are identical.
+	for( i = 0; i < new.count; i++ )
+		if( new.edges[i] != old.edges[i] + 1 )
+		{
+			printf( "FAIL %s: edge %u at cycle %lu, tick model at %lu\n", name, i, (unsigned long)new.edges[i], (unsigned long)old.edges[i] );
+			failures++;
+			return;
+		}
+
+	if( new.interrupts != expected )
+	{
+		printf( "FAIL %s: %lu interrupts for %u edges, expected %lu\n", name, (unsigned long)new.interrupts, new.count, (unsigned long)expected );
+		failures++;
+		return;
+	}
+
+	printf( "ok   %s: %u edges, %lu interrupts (tick model %lu)\n", name, new.count, (unsigned long)new.interrupts, (unsigned long)old.interrupts );
+}
+
+int main()
+{
+	// NEC-style frame and repeat frame with a MAXPULSE gap between them: the gap is chunked
+	unsigned int nec[] = { 1800, 900, 112, 112, 112, 337, 112, 112, 112, 337, 112, MAXPULSE, 1800, 450, 112, 0 };
+
+	// Pulses on both sides of the 16 bit range: (1073+1)*61 = 65514 cycles fits, (1074+1)*61 = 65575 cycles takes two chunks
+	unsigned int boundary[] = { 100, 1073, 100, 1074, 100, 0 };
+
+	// A first pulse (no extra tick) just over the range and the longest pulse a code can hold
+	unsigned int longest[] = { 1075, 0xFFFE, 100, 0 };
+
+	// A code ending with a space: the end is not a change of the output
+	unsigned int space[] = { 200, 300, 200, 3000, 0 };
+
+	checkCode( "nec", nec );
+	checkCode( "boundary", boundary );
+	checkCode( "longest", longest );
+	checkCode( "space", space );
+
+	if( failures )
+	{
+		printf( "%u failed\n", failures );
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,18 @@
+//
+//  crc16.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Stand-in for <util/crc16.h>. The function is defined in host.c.
+
+#ifndef BLEremote_tests_util_crc16_h
+#define BLEremote_tests_util_crc16_h
+
+#include <stdint.h>
+
+uint16_t _crc_xmodem_update( uint16_t crc, uint8_t data );
+
+#endif
@@ -0,0 +1,17 @@
+//
+//  delay.h
+//  BLEremote host tests
+//
+//  Created by Jens Willy Johannsen on 22-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+// Stand-in for <util/delay.h>. The busy-wait delays take no simulated time.
+
+#ifndef BLEremote_tests_util_delay_h
+#define BLEremote_tests_util_delay_h
+
+#define _delay_us( us )
+#define _delay_ms( ms )
+
+#endif
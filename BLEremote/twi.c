@@ -0,0 +1,192 @@
+//
+//  twi.c
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 09-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <compat/twi.h>
+#include "twi.h"
+
+// TWCR values. TWINT is cleared by writing a 1 to it.
+#define TWCR_CONTINUE	((1<< TWINT) | (1<< TWEN) | (1<< TWIE))
+#define TWCR_ACK		(TWCR_CONTINUE | (1<< TWEA))
+#define TWCR_START		(TWCR_CONTINUE | (1<< TWSTA))
+#define TWCR_RESTART	(TWCR_CONTINUE | (1<< TWSTO) | (1<< TWSTA))
+#define TWCR_STOP		((1<< TWINT) | (1<< TWEN) | (1<< TWSTO))
+
+static TWITransaction *queue[ TWI_QUEUE_SIZE ];
+static volatile uint8_t queueHead;
+static volatile uint8_t queueCount;
+static uint8_t addressPos;			// Number of address bytes sent
+static uint16_t dataPos;			// Number of data bytes transferred
+
+/* Initializes the TWI clock */
+void twiInit()
+{
+	TWSR = 0;									// No prescaler
+	TWBR = ((F_CPU/TWI_SCL_CLOCK)-16)/2;		// Must be > 10 for stable operation
+	TWCR = (1<< TWEN);
+}
+
+/* Sends a START condition for the transaction at the head of the queue */
+static void startTransaction()
+{
+	queue[ queueHead ]->status = TWIStatus_Busy;
+	queue[ queueHead ]->retries = 0;
+	addressPos = 0;
+	dataPos = 0;
+
+	// A STOP condition may still be on its way out
+	while( TWCR & (1<< TWSTO) )
+		;
+	TWCR = TWCR_START;
+}
+
+/* Ends the transaction at the head of the queue and starts the next one. Called from the interrupt handler. */
+static void endTransaction( uint8_t status )
+{
+	TWITransaction *transaction = queue[ queueHead ];
+
+	queueHead = (queueHead + 1) % TWI_QUEUE_SIZE;
+	queueCount--;
+
+	// STOP and then START the next transaction right away
+	if( queueCount )
+	{
+		queue[ queueHead ]->status = TWIStatus_Busy;
+		queue[ queueHead ]->retries = 0;
+		addressPos = 0;
+		dataPos = 0;
+		TWCR = TWCR_RESTART;
+	}
+	else
+		TWCR = TWCR_STOP;
+
+	// The bus has been taken care of so the callback may queue a new transaction
+	transaction->status = status;
+	if( transaction->callback )
+		transaction->callback( transaction );
+}
+
+/* Queues a transaction */
+uint8_t twiSubmit( TWITransaction *transaction )
+{
+	uint8_t sreg = SREG;
+	uint8_t queued = 0;
+
+	cli();
+	if( queueCount < TWI_QUEUE_SIZE )
+	{
+		transaction->status = TWIStatus_Queued;
+		queue[ (queueHead + queueCount) % TWI_QUEUE_SIZE ] = transaction;
+		queueCount++;
+		queued = 1;
+
+		// Bus idle: start now. Otherwise the interrupt handler will get to it.
+		if( queueCount == 1 )
+			startTransaction();
+	}
+	SREG = sreg;
+
+	return queued;
+}
+
+/* Queues a transaction and waits for it */
+uint8_t twiTransfer( TWITransaction *transaction )
+{
+	while( !twiSubmit( transaction ))
+		;
+	while( transaction->status >= TWIStatus_Queued )
+		;
+
+	return transaction->status;
+}
+
+/* Checks whether the driver is busy */
+uint8_t twiBusy()
+{
+	return queueCount;
+}
+
+/* TWI interrupt handler
+ * Runs the transaction at the head of the queue one bus event at a time.
+ */
+ISR( TWI_vect )
+{
+	TWITransaction *transaction = queue[ queueHead ];
+
+	switch( TW_STATUS )
+	{
+		case TW_START:
+			// Reads without an address go straight to SLA+R
+			if( transaction->read && transaction->addressLength == 0 )
+				TWDR = transaction->device | TW_READ;
+			else
+				TWDR = transaction->device | TW_WRITE;
+			TWCR = TWCR_CONTINUE;
+			break;
+
+		case TW_REP_START:
+			TWDR = transaction->device | TW_READ;
+			TWCR = TWCR_CONTINUE;
+			break;
+
+		case TW_MT_SLA_ACK:
+		case TW_MT_DATA_ACK:
+			if( addressPos < transaction->addressLength )
+			{
+				// Address: most significant byte first
+				TWDR = (addressPos == 0 && transaction->addressLength == 2) ? transaction->address >> 8 : transaction->address;
+				addressPos++;
+				TWCR = TWCR_CONTINUE;
+			}
+			else if( transaction->read )
+				TWCR = TWCR_START;		// Repeated START for reading
+			else if( dataPos < transaction->length )
+			{
+				TWDR = transaction->data[ dataPos++ ];
+				TWCR = TWCR_CONTINUE;
+			}
+			else
+				endTransaction( TWIStatus_Done );
+			break;
+
+		case TW_MT_SLA_NACK:
+		case TW_MR_SLA_NACK:
+			// Device busy: STOP and try again. A device that never answers is missing.
+			if( transaction->retries >= TWI_MAX_RETRIES )
+			{
+				endTransaction( TWIStatus_Error );
+				break;
+			}
+			transaction->retries++;
+			addressPos = 0;
+			dataPos = 0;
+			TWCR = TWCR_RESTART;
+			break;
+
+		case TW_MR_SLA_ACK:
+			// ACK every byte but the last one
+			TWCR = (transaction->length > 1) ? TWCR_ACK : TWCR_CONTINUE;
+			break;
+
+		case TW_MR_DATA_ACK:
+			transaction->data[ dataPos++ ] = TWDR;
+			TWCR = (dataPos < transaction->length - 1) ? TWCR_ACK : TWCR_CONTINUE;
+			break;
+
+		case TW_MR_DATA_NACK:
+			transaction->data[ dataPos++ ] = TWDR;
+			endTransaction( TWIStatus_Done );
+			break;
+
+		default:
+			// Data NACK, lost arbitration or bus error
+			endTransaction( TWIStatus_Error );
+			break;
+	}
+}
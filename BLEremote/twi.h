@@ -0,0 +1,119 @@
+//
+//  twi.h
+//  BLEremote
+//
+//  Created by Jens Willy Johannsen on 09-07-12.
+//  Copyright (c) 2012 Greener Pastures. All rights reserved.
+//
+
+#ifndef BLEremote_twi_h
+#define BLEremote_twi_h
+
+#include <avr/io.h>
+
+/**
+ @defgroup jwj_twi TWI Master Driver
+ @brief Interrupt driven I2C (TWI) master.
+
+ @code #include "twi.h" @endcode
+
+ TWI Master Driver
+
+ Transfers are described by TWITransaction structures which are queued with twiSubmit(). The TWI interrupt handler runs the transactions one after the other without any help from the main loop, so the CPU is free while the bytes are being clocked out.
+
+ A transaction consists of:
+
+	START, device address + W, 0–2 address bytes (most significant byte first)
+	and then either the data bytes to write
+	or a repeated START, device address + R and the data bytes to read
+	STOP
+
+ When a transaction has ended, its status is set to @link TWIStatus_Done @endlink or @link TWIStatus_Error @endlink and the callback (if any) is called from the interrupt handler.
+
+ If the device does not acknowledge its address (e.g. because an EEPROM is busy with its internal write cycle), the transaction is started again until it does – at most @link TWI_MAX_RETRIES @endlink times, after which it ends with @link TWIStatus_Error @endlink. A write transaction with no address and no data bytes can therefore be used for ACK polling: it ends when the device is ready, or with an error if the device is missing.
+
+ @author Jens Willy Johannsen <jens@jenswilly.dk> http://atomslagstyrken.dk/arduino
+
+ */
+
+/**@{*/
+
+/** I2C clock in Hz. */
+#define TWI_SCL_CLOCK 200000L
+
+/** Approximate time in µs to transfer one byte (8 data bits and the ACK bit). */
+#define TWI_BYTE_US (9 * 1000000L / TWI_SCL_CLOCK)
+
+/** Approximate time in µs of an address attempt that the device does not acknowledge: START, address byte and STOP. */
+#define TWI_ATTEMPT_US (11 * 1000000L / TWI_SCL_CLOCK)
+
+/** Number of times a transaction is started again when the device does not acknowledge its address: about 10 ms of attempts, twice the 5 ms write cycle of a 24LC512. A missing device fails within that time instead of hanging the bus. */
+#define TWI_MAX_RETRIES (10000 / TWI_ATTEMPT_US)
+
+/** Maximum number of queued transactions. */
+#define TWI_QUEUE_SIZE 4
+
+/** Transaction status values. A zero initialized transaction counts as ended. */
+typedef enum {
+	/** Completed */
+	TWIStatus_Done = 0,
+	/** Failed – the device did not acknowledge its address after @link TWI_MAX_RETRIES @endlink attempts or a data byte, or the bus is in trouble */
+	TWIStatus_Error = 1,
+	/** Waiting in the queue */
+	TWIStatus_Queued = 2,
+	/** Being transferred */
+	TWIStatus_Busy = 3
+} TWIStatus;
+
+struct TWITransaction;
+
+/** Function called from the TWI interrupt handler when a transaction has ended. */
+typedef void (*TWICallback)( struct TWITransaction *transaction );
+
+/** A TWI transaction. The structure must remain untouched until the transaction has ended. */
+typedef struct TWITransaction {
+	/** I2C device address shifted one bit to the left. The R/W bit is set by the driver. */
+	uint8_t device;
+	/** Number of address bytes sent before the data: 0, 1 or 2 */
+	uint8_t addressLength;
+	/** Address within the device */
+	uint16_t address;
+	/** 1 to read data or 0 to write data */
+	uint8_t read;
+	/** Pointer to the data */
+	unsigned char *data;
+	/** Number of data bytes. Must be at least 1 for reads. */
+	uint16_t length;
+	/** Number of times the device did not acknowledge its address. Set by the driver. */
+	uint16_t retries;
+	/** Function called when the transaction has ended or 0 */
+	TWICallback callback;
+	/** A @link TWIStatus @endlink value */
+	volatile uint8_t status;
+} TWITransaction;
+
+/** Initializes the TWI hardware. */
+void twiInit();
+
+/** Queues a transaction. The transaction is started immediately if the bus is idle.
+
+ This may also be called from interrupt handlers – including a TWICallback.
+ @param transaction Pointer to the transaction.
+ @return 1 if the transaction was queued or 0 if the queue is full.
+ */
+uint8_t twiSubmit( TWITransaction *transaction );
+
+/** Queues a transaction and waits for it to end.
+ @param transaction Pointer to the transaction.
+ @return The final @link TWIStatus @endlink.
+ */
+uint8_t twiTransfer( TWITransaction *transaction );
+
+/** Checks whether any transactions are queued or running.
+ @return Non-zero while the driver is busy.
+ */
+uint8_t twiBusy();
+
+/**@}*/
+
+#endif